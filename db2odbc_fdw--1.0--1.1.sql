@@ -0,0 +1,85 @@
+/*-------------------------------------------------------------------------
+ *
+ *                foreign-data wrapper for DB2/CLI/ODBC
+ *
+ * Copyright (c) 2020, PostgreSQL Global Development Group
+ *
+ * This software is released under the PostgreSQL Licence
+ *
+ * Author: stanislawbartkowski@gmail.com
+ *
+ * IDENTIFICATION
+ *                db2odbc_fdw/db2odbc_fdw--1.0--1.1.sql
+ *
+ *-------------------------------------------------------------------------
+ */
+
+-- complain if script is sourced in psql, rather than via ALTER EXTENSION
+\echo Use "ALTER EXTENSION db2odbc_fdw UPDATE TO '1.1'" to load this file. \quit
+
+CREATE FUNCTION db2odbc_list_dsns(OUT dsn text, OUT description text)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
+
+CREATE FUNCTION db2odbc_cache_invalidate()
+RETURNS integer
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION db2odbc_cache_invalidate(regclass)
+RETURNS integer
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
+
+-- removing results of other users' tables is left to the superuser to grant
+REVOKE ALL ON FUNCTION db2odbc_cache_invalidate() FROM PUBLIC;
+REVOKE ALL ON FUNCTION db2odbc_cache_invalidate(regclass) FROM PUBLIC;
+
+CREATE FUNCTION db2odbc_stat_servers(
+    OUT server text,
+    OUT connects bigint,
+    OUT connection_cache_hits bigint,
+    OUT retries bigint,
+    OUT queries bigint,
+    OUT fetches bigint,
+    OUT rows bigint,
+    OUT bytes bigint,
+    OUT errors bigint,
+    OUT connect_time double precision,
+    OUT execute_time double precision,
+    OUT fetch_time double precision)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
+
+CREATE FUNCTION db2odbc_stat_connections(
+    OUT server text,
+    OUT username text,
+    OUT connects bigint,
+    OUT connection_cache_hits bigint,
+    OUT retries bigint,
+    OUT queries bigint,
+    OUT fetches bigint,
+    OUT rows bigint,
+    OUT bytes bigint,
+    OUT errors bigint,
+    OUT connect_time double precision,
+    OUT execute_time double precision,
+    OUT fetch_time double precision)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
+
+CREATE FUNCTION db2odbc_stat_errors(OUT server text, OUT username text, OUT sqlstate text, OUT count bigint)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
+
+CREATE FUNCTION db2odbc_stat_reset()
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE;
+
+-- resets the statistics of all users
+REVOKE ALL ON FUNCTION db2odbc_stat_reset() FROM PUBLIC;
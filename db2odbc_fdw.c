@@ -17,68 +17,451 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "access/hash.h"
+#include "access/htup_details.h"
+#include "access/parallel.h"
 #include "access/reloptions.h"
+#if PG_VERSION_NUM >= 120000
+#include "access/table.h"
+#else
+#include "access/heapam.h"
+#endif
+#include "access/xact.h"
+#include "catalog/pg_attribute.h"
+#include "catalog/pg_authid.h"
 #include "catalog/pg_foreign_server.h"
 #include "catalog/pg_foreign_table.h"
 #include "catalog/pg_user_mapping.h"
 #include "catalog/pg_type.h"
 #include "commands/defrem.h"
 #include "commands/explain.h"
+#include "commands/vacuum.h"
 #include "foreign/fdwapi.h"
 #include "foreign/foreign.h"
 #include "miscadmin.h"
+#include "pgstat.h"
+#if PG_VERSION_NUM < 130000
+#include "postmaster/autovacuum.h"
+#include "replication/walsender.h"
+#endif
 #include "optimizer/cost.h"
+#include "optimizer/paths.h"
 #include "optimizer/pathnode.h"
 #include "optimizer/restrictinfo.h"
 #include "optimizer/planmain.h"
+#include "optimizer/tlist.h"
+#if PG_VERSION_NUM >= 140000
+#include "optimizer/appendinfo.h"
+#endif
+#include "utils/selfuncs.h"
+#include "utils/guc.h"
+#include "utils/inval.h"
+#include "utils/syscache.h"
+#if PG_VERSION_NUM >= 120000
+#include "optimizer/optimizer.h"
+#else
+#include "optimizer/var.h"
+#endif
 #include "mb/pg_wchar.h"
 #include "storage/fd.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/acl.h"
 #include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/date.h"
+#include "utils/datetime.h"
+#include "utils/dsa.h"
+#include "utils/hsearch.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/sampling.h"
+#include "utils/timestamp.h"
+#include "utils/typcache.h"
+#if PG_VERSION_NUM >= 110000
+#include "utils/varlena.h"
+#endif
 #include "funcapi.h"
 #include "utils/rel.h"
 #include "nodes/pg_list.h"
+#include "nodes/nodeFuncs.h"
+#include "executor/executor.h"
+#if PG_VERSION_NUM >= 140000
+#include "executor/execAsync.h"
+#endif
+#include "storage/latch.h"
+#include "port/atomics.h"
+#include "portability/instr_time.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <sql.h>
 #include <sqlext.h>
 
+#include "db2odbc_fdw.h"
+
 PG_MODULE_MAGIC;
 
 typedef struct db2ColumnDesc
 {
-    char *buf;
+    char *buf;        /* fetch_size rows, width bytes each */
+    SQLLEN *indicator; /* fetch_size length/null indicators */
     SQLULEN columnsize;
+    SQLLEN width;
+    SQLSMALLINT sqltype; /* type reported by SQLDescribeCol */
+    SQLSMALLINT ctype;   /* C type used in SQLBindCol, SQL_C_CHAR is text fallback */
+    int attnum;          /* index of target attribute, -1 if column is ignored */
     bool isNumber;
+    bool streamed;       /* not bound, read piecewise by SQLGetData after SQLFetch */
 } db2ColumnDesc;
 
+/*
+ * Work done with DB2, kept per scan for EXPLAIN ANALYZE and per server and user mapping
+ * for db2odbc_stat_servers() and db2odbc_stat_connections()
+ */
+typedef struct db2Counters
+{
+    int64 connects;
+    int64 connection_hits; /* connection taken open from the cache */
+    int64 retries;         /* executions repeated on new connection, cached option */
+    int64 queries;         /* SQLExecute calls */
+    int64 fetches;         /* row arrays fetched */
+    int64 rows;
+    int64 bytes;
+    int64 errors;
+    instr_time connect_time;
+    instr_time execute_time;
+    instr_time fetch_time;
+} db2Counters;
+
+// distinct SQLSTATEs counted per server and user mapping, other errors are counted only in errors
+#define STAT_SQLSTATES 8
+
+typedef struct db2SqlStateCount
+{
+    char sqlstate[6];
+    int64 count;
+} db2SqlStateCount;
+
 typedef struct db2PrivateData
 {
     AttInMetadata *attinmeta;
-    SQLHENV env;
+    Oid serverid;
+    struct db2ConnectionCacheEntry *conn;
+    // reference taken by getConnection, released by closeConnection or by abort of the subtransaction
+    struct db2ConnectionRef *ref;
     SQLHDBC dbc;
     SQLHSTMT stmt;
+    // statement taken from the cache of the connection, NULL if stmt is freed after use
+    struct db2CachedStatement *prepared;
+    // INSERT, UPDATE or DELETE, the connection joins DB2 transaction ended with the local one
+    bool write;
     SQLSMALLINT no_columns;
     db2ColumnDesc *columnsbuf;
     char *cached;
-    char **values;
+    int natts;
+    // per row allocations, reset before the next row is converted
+    MemoryContext rowcontext;
+    // remote SQL and text values of its parameter markers
+    char *query;
+    int no_params;
+    List *param_exprs;
+    Oid *param_types;
+    char **param_values;
+    SQLLEN *param_ind;
+    MemoryContext paramcontext;
+    // col = ANY(array) parameter bound by batches of batch_size markers, -1 if there is none
+    // the elements are kept in batchcontext until the parameter is evaluated again
+    int batch_param;
+    int batch_size;
+    char **batch_values;
+    SQLLEN *batch_ind;
+    int batch_count;
+    int batch_pos;
+    MemoryContext batchcontext;
+    // asynchronous execution for Append: SQLExecute and SQLFetch run in async_thread which
+    // writes one byte to async_pipe when the call is finished
+    // the thread lives until the scan is released, async_request and async_stop are protected
+    // by async_lock and signaled by async_wakeup, async_pending is used by the scan only
+    bool async;
+    bool async_pending;
+    bool async_execute;
+    SQLRETURN async_ret;
+    pthread_t async_thread;
+    bool async_running;
+    bool async_request;
+    bool async_stop;
+    pthread_mutex_t async_lock;
+    pthread_cond_t async_wakeup;
+    int async_pipe[2];
+    // statement is prepared once and executed again by rescan
+    Oid relid;
+    List *retrieved_attrs;
+    bool cursor_open;
+    // row array fetched by the last SQLFetch
+    long fetch_size;
+    SQLULEN rows_fetched;
+    SQLULEN next_row;
+    bool eof;
+    // row arrays fetched ahead by a thread, prefetch option
+    long prefetch_slots;
+    struct db2Prefetch *prefetch;
+    // scan with running prefetch or async thread is linked in helperScans
+    bool helper_listed;
+    struct db2PrivateData *next_helper;
+    // parallel scan: slice bound to the last marker, slices are claimed from pscan
+    // or from next_slice if the scan runs without parallel context
+    int slices;
+    int slice;
+    int next_slice;
+    struct db2ParallelScan *pscan;
+    char slice_value[16];
+    SQLLEN slice_ind;
+    // shared result cache, cache_ttl option: rows of cached result returned instead of executing
+    // the query (cache_hit) or rows of complete result collected for the cache (cache_fill)
+    int cache_ttl;
+    List *cache_relids;
+    char *cache_key;
+    bool cache_hit;
+    bool cache_fill;
+    StringInfoData cache_rows;
+    int cache_pos;
+    Size cache_limit;
+    MemoryContext cachecontext;
+    // counters shown by EXPLAIN ANALYZE, summed over rescans
+    // conversion is timed only if the node is instrumented, SQLGetData of streamed columns counts as fetch
+    bool instrument;
+    bool conn_used;
+    bool conn_reused;
+    long cache_hits;
+    db2Counters counters;
+    instr_time convert_time;
+    // part of counters already added to the statistics of the connection
+    db2Counters reported;
 } db2PrivateData;
 
+/*
+ * State of INSERT, the connection and prepared statement are kept in data
+ */
+typedef struct db2ModifyState
+{
+    db2PrivateData data;
+    // attribute numbers bound to the markers and their types
+    List *target_attrs;
+    Oid *types;
+    // rows sent in one SQLExecute and status of each of them
+    int batch_size;
+    SQLUSMALLINT *status;
+    // parameter arrays of the current batch
+    MemoryContext batchcontext;
+} db2ModifyState;
+
+/*
+ * State of UPDATE or DELETE executed as a single statement
+ */
+typedef struct db2DirectModifyState
+{
+    db2PrivateData data;
+    bool set_processed;
+    bool executed;
+} db2DirectModifyState;
+
+/*
+ * Shared state of parallel scan in DSM
+ */
+typedef struct db2ParallelScan
+{
+    pg_atomic_uint32 next_slice;
+} db2ParallelScan;
+
+/*
+ * Row array copied from the bound buffers by the prefetch thread
+ */
+typedef struct db2PrefetchSlot
+{
+    char **buf;         /* per column, fetch_size rows */
+    SQLLEN **indicator; /* per column, fetch_size indicators */
+    SQLULEN rows;
+    SQLRETURN ret;
+} db2PrefetchSlot;
+
+/*
+ * Ring of nslots row arrays, the thread fills the slots ahead of the scan
+ * The scan converts rows of the slot at head, the columnsbuf buffers point to it
+ */
+typedef struct db2Prefetch
+{
+    pthread_t thread;
+    bool running;
+    // byte is written by the thread when a slot is filled
+    int pipe[2];
+    int nslots;
+    db2PrefetchSlot *slots;
+    // filled and stop are protected by lock, released is signaled when the scan frees a slot
+    pthread_mutex_t lock;
+    pthread_cond_t released;
+    int filled;
+    bool stop;
+    // used by the scan only
+    int head;
+    bool holding;
+    // buffers bound by SQLBindCol and SQL_ATTR_ROWS_FETCHED_PTR, used by the thread only
+    char **fetchbuf;
+    SQLLEN **fetchind;
+    SQLULEN rows_fetched;
+} db2Prefetch;
+
 // ---------------------------------------
 // connection cache entry
 // ---------------------------------------
 
-#define DSN_MAX_LEN 128
+/*
+ * Result column as reported by SQLDescribeCol
+ */
+typedef struct db2ResultColumn
+{
+    char *name;
+    SQLSMALLINT sqltype;
+    SQLULEN columnsize;
+    SQLSMALLINT scale;
+    SQLLEN displaysize;
+} db2ResultColumn;
+
+/*
+ * Statement prepared on cached connection, reused by next statements with the same SQL text
+ * Kept in TopMemoryContext and used only by the backend, query is NULL if the slot is empty
+ */
+typedef struct db2CachedStatement
+{
+    char *query;
+    uint32 hash;
+    SQLHSTMT stmt;
+    // taken by a running statement
+    bool in_use;
+    uint64 last_used;
+    // result columns described by the first execution, no_columns is -1 until then
+    SQLSMALLINT no_columns;
+    db2ResultColumn *columns;
+} db2CachedStatement;
+
+// prepared statements kept per connection, the least recently used one is freed
+#define STATEMENT_CACHE_SIZE 32
+
+typedef struct db2ConnectionKey
+{
+    Oid serverid;
+    Oid umid; /* user mapping */
+} db2ConnectionKey;
 
+/*
+ * Connection kept open for the whole session, shared by all statements of the same server and user mapping
+ */
 typedef struct db2ConnectionCacheEntry
 {
-    char dsn_name[DSN_MAX_LEN];
-    Oid userId;
-    SQLHENV env;
-    SQLHDBC dbc;
-    struct db2ConnectionCacheEntry *next;
+    db2ConnectionKey key; /* hash key */
+    SQLHDBC dbc;          /* NULL if not connected */
+    // number of statements using the connection, it is not closed while in use
+    int refs;
+    // server or user mapping was changed, reconnect when not in use
+    bool invalidated;
+    uint32 server_hashvalue;
+    uint32 mapping_hashvalue;
+    // connection parameters in TopMemoryContext, used also by the maintenance thread
+    char *dsn;
+    char *username;
+    char *password;
+    // the maintenance thread works with the connection, statements wait for it
+    bool busy;
+    // connection of preconnect_servers to be opened by the maintenance thread
+    bool connect_pending;
+    // time when the last statement released the connection and of the last keepalive
+    time_t last_used;
+    time_t last_ping;
+    // incremented whenever the connection is opened or closed, SQLDisconnect frees the prepared
+    // statements, so stmts are forgotten if stmts_generation differs
+    uint32 generation;
+    uint32 stmts_generation;
+    db2CachedStatement *stmts;
+    // DB2 transaction of writes: 0 autocommit, 1 transaction open, n savepoint of nesting level n exists
+    // the transaction holds a reference, so the connection is not replaced until it ends
+    int xact_depth;
+    bool xact_failed;
+    // statistics not added to shared memory yet, the maintenance thread counts its connects too
+    bool stats_pending;
+    db2Counters stats;
+    db2SqlStateCount sqlstates[STAT_SQLSTATES];
 } db2ConnectionCacheEntry;
 
-static db2ConnectionCacheEntry *cache = NULL; // initialize as null
+static HTAB *connectionCache = NULL;
+
+/*
+ * Connection and prepared statement taken by a statement in subtransaction level
+ * Statements interrupted by error are not closed, abort of the subtransaction releases what they took
+ * Kept in TopTransactionContext, entry is NULL after the release
+ */
+typedef struct db2ConnectionRef
+{
+    db2ConnectionCacheEntry *entry;
+    db2CachedStatement *prepared;
+    // statement not kept in the cache, freed by abort unless the connection was opened again since
+    SQLHSTMT stmt;
+    uint32 generation;
+    int level;
+    struct db2ConnectionRef *next;
+} db2ConnectionRef;
+
+static db2ConnectionRef *connectionRefs = NULL;
+
+// environment shared by all connections of the backend
+static SQLHENV odbcEnv = SQL_NULL_HENV;
+
+// refs, busy and all fields used by the maintenance thread are protected by connLock
+// connChanged is signaled when the thread releases a busy entry
+static pthread_mutex_t connLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t connChanged = PTHREAD_COND_INITIALIZER;
+
+// maintenance thread and the entries it checks
+static db2ConnectionCacheEntry **maintained = NULL;
+static int maintainedCount = 0;
+static int maintainedSize = 0;
+static pthread_t maintenanceThreadId;
+static bool maintenanceRunning = false;
+static bool maintenanceStop = false;
+static pthread_cond_t maintenanceWake = PTHREAD_COND_INITIALIZER;
+static int maintenanceKeepalive = 0;
+static int maintenanceIdleTimeout = 0;
+
+// GUC variables
+static char *preconnectList = NULL;
+static int keepaliveInterval = 0;
+static int idleTimeout = 0;
+static bool preconnectDone = false;
+static int resultCacheSize = 65536;
+
+// ---------------------------------------
+// remote estimate cache entry
+// ---------------------------------------
+
+/*
+ * DB2 catalog statistics of the table, valid for the statement being planned
+ */
+typedef struct db2EstimateCacheEntry
+{
+    Oid relid; /* hash key */
+    TimestampTz stmt_start;
+    // CARD, -1 if not known
+    double tuples;
+    // AVGCOLLEN by attribute number - 1, -1 if not known
+    int natts;
+    int32 *widths;
+} db2EstimateCacheEntry;
+
+static HTAB *estimateCache = NULL;
 
 // ----------------------------------------
 
@@ -97,9 +480,45 @@ typedef struct db2FdwOption
 #define USERNAME "username"
 #define PASSWORD "password"
 #define QUERY "sql_query"
+#define TABLE "table"
+#define SCHEMA "schema"
+#define COLUMNNAME "column_name"
+#define FETCHSIZE "fetch_size"
+#define USEREMOTEESTIMATE "use_remote_estimate"
+#define FDWSTARTUPCOST "fdw_startup_cost"
+#define FDWTUPLECOST "fdw_tuple_cost"
+#define LOOKUPBATCHSIZE "lookup_batch_size"
+#define ASYNCCAPABLE "async_capable"
+#define PREFETCH "prefetch"
+#define PARTITIONCOLUMN "partition_column"
+#define PARTITIONS "partitions"
+#define BATCHSIZE "batch_size"
+#define AUTOCOMMIT "autocommit"
+#define CACHETTL "cache_ttl"
+
+#define DEFAULT_FETCH_SIZE 100
+#define DEFAULT_LOOKUP_BATCH_SIZE 100
+#define DEFAULT_PARTITIONS 8
+#define DEFAULT_BATCH_SIZE 1
+
+// cost of starting remote statement and of transferring one row
+#define DEFAULT_FDW_STARTUP_COST 100.0
+#define DEFAULT_FDW_TUPLE_COST 0.01
+
+// cost of sorting done by DB2
+#define DEFAULT_FDW_SORT_MULTIPLIER 1.2
 
 #define ANYERROR -1
 
+// DB2 specific SQL types reported by SQLDescribeCol, not defined by sql.h
+#define DB2_SQL_BLOB (-98)
+#define DB2_SQL_CLOB (-99)
+#define DB2_SQL_DBCLOB (-350)
+#define DB2_SQL_XML (-370)
+
+// wider columns are not bound to row array buffers, they are streamed by SQLGetData
+#define MAX_BOUND_COLUMN_SIZE 32672
+
 /*
  * Array of valid options
  *
@@ -108,9 +527,33 @@ static struct db2FdwOption valid_options[] = {
     /* Foreign server options */
     {DSN, ForeignServerRelationId, true},
     {CACHED, ForeignServerRelationId, false},
+    {FETCHSIZE, ForeignServerRelationId, false},
+    {USEREMOTEESTIMATE, ForeignServerRelationId, false},
+    {FDWSTARTUPCOST, ForeignServerRelationId, false},
+    {FDWTUPLECOST, ForeignServerRelationId, false},
+    {LOOKUPBATCHSIZE, ForeignServerRelationId, false},
+    {ASYNCCAPABLE, ForeignServerRelationId, false},
+    {PREFETCH, ForeignServerRelationId, false},
+    {BATCHSIZE, ForeignServerRelationId, false},
+    {AUTOCOMMIT, ForeignServerRelationId, false},
 
     /* Foreign table options */
-    {QUERY, ForeignTableRelationId, true},
+    // either sql_query or table is required
+    {QUERY, ForeignTableRelationId, false},
+    {TABLE, ForeignTableRelationId, false},
+    {SCHEMA, ForeignTableRelationId, false},
+    {FETCHSIZE, ForeignTableRelationId, false},
+    {USEREMOTEESTIMATE, ForeignTableRelationId, false},
+    {LOOKUPBATCHSIZE, ForeignTableRelationId, false},
+    {ASYNCCAPABLE, ForeignTableRelationId, false},
+    {PREFETCH, ForeignTableRelationId, false},
+    {PARTITIONCOLUMN, ForeignTableRelationId, false},
+    {PARTITIONS, ForeignTableRelationId, false},
+    {BATCHSIZE, ForeignTableRelationId, false},
+    {CACHETTL, ForeignTableRelationId, false},
+
+    /* Foreign table column options */
+    {COLUMNNAME, AttributeRelationId, false},
 
     /* User mapping options */
     {USERNAME, UserMappingRelationId, true},
@@ -119,785 +562,6473 @@ static struct db2FdwOption valid_options[] = {
     /* Sentinel */
     {NULL, InvalidOid}};
 
-static void lognotice(const char *s)
-{
-    elog(NOTICE, s);
-}
-
-//#define DEBUG
-
-#ifdef DEBUG
-
-#define N NOTICE
-#define NCONNECTION NOTICE
-
-#else
-
-#define N DEBUG5
-#define NCONNECTION DEBUG5
-
-#endif
-
-#define logdebug(...) elog(N, __VA_ARGS__)
 // -------------------------------------------
-// cache handling
-// IMPORTANT: THREAD unsafe
-// I do not know what about multithreading in postgres
-// but this code (working with static variable) is NOT thread safe
-// some synchronization is needed
+// connection cache
 // -------------------------------------------
 
-static db2ConnectionCacheEntry *findConnection(const char *dsn, Oid userId)
+void _PG_init(void);
+static void extract_error(char *fn, SQLHANDLE handle, SQLSMALLINT type, SQLINTEGER *outnative,
+                          db2ConnectionCacheEntry *conn);
+static void flushStats(void);
+static void startThread(pthread_t *thread, void *(*func)(void *), void *arg);
+static void stopPrefetch(db2PrivateData *data);
+static void stopHelperScans(int level);
+static db2FdwRelationInfo *getTableOptions(Oid foreigntableid);
+
+/*
+ * Mark connections of changed server or user mapping, hashvalue 0 means all of them
+ */
+static void invalidateConnections(Datum arg, int cacheid, uint32 hashvalue)
 {
-    db2ConnectionCacheEntry *e;
+    HASH_SEQ_STATUS scan;
+    db2ConnectionCacheEntry *entry;
 
     logdebug(__func__);
-    for (e = cache; e != NULL; e = e->next)
+    pthread_mutex_lock(&connLock);
+    hash_seq_init(&scan, connectionCache);
+    while ((entry = (db2ConnectionCacheEntry *)hash_seq_search(&scan)) != NULL)
     {
-        if ((strcmp(e->dsn_name, dsn) == 0) && e->userId == userId)
+        if (entry->dbc == NULL)
         {
-            return e;
+            continue;
+        }
+        if (hashvalue == 0 ||
+            (cacheid == FOREIGNSERVEROID && entry->server_hashvalue == hashvalue) ||
+            (cacheid == USERMAPPINGOID && entry->mapping_hashvalue == hashvalue))
+        {
+            logdebug("Connection invalidated");
+            entry->invalidated = true;
         }
     }
-    return NULL;
+    pthread_mutex_unlock(&connLock);
 }
 
-static void addNewConnection(const char *dsn, Oid userId, SQLHENV env, SQLHDBC dbc)
+static void initConnectionCache(void)
 {
-    db2ConnectionCacheEntry *e;
+    HASHCTL ctl;
+    SQLRETURN ret;
 
     logdebug(__func__);
+    memset(&ctl, 0, sizeof(ctl));
+    ctl.keysize = sizeof(db2ConnectionKey);
+    ctl.entrysize = sizeof(db2ConnectionCacheEntry);
+    connectionCache = hash_create("db2odbc_fdw connections", 8, &ctl, HASH_ELEM | HASH_BLOBS);
+    CacheRegisterSyscacheCallback(FOREIGNSERVEROID, invalidateConnections, (Datum)0);
+    CacheRegisterSyscacheCallback(USERMAPPINGOID, invalidateConnections, (Datum)0);
 
-    e = malloc(sizeof(db2ConnectionCacheEntry));
-    strncpy(e->dsn_name, dsn, DSN_MAX_LEN - 1);
-    e->userId = userId;
-    e->env = env;
-    e->dbc = dbc;
-    e->next = cache;
-    cache = e;
+    ret = SQLAllocHandle(SQL_HANDLE_ENV, SQL_NULL_HANDLE, &odbcEnv);
+    if (SQL_SUCCEEDED(ret))
+    {
+        ret = SQLSetEnvAttr(odbcEnv, SQL_ATTR_ODBC_VERSION, (void *)SQL_OV_ODBC3, 0);
+    }
+    if (!SQL_SUCCEEDED(ret))
+    {
+        extract_error("SQLAllocHandle SQL_HANDLE_ENV", odbcEnv, SQL_HANDLE_ENV, NULL, NULL);
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+                 errmsg("Cannot allocate ODBC environment")));
+    }
 }
 
-static void removeConnection(SQLHDBC dbc)
+/*
+ * Cache entry of server and user mapping, new entry is not connected
+ */
+static db2ConnectionCacheEntry *lookupConnection(Oid serverid, Oid umid)
 {
-    db2ConnectionCacheEntry *prev, *e;
-    logdebug(__func__);
+    db2ConnectionKey key;
+    db2ConnectionCacheEntry *entry;
+    bool found;
 
-    logdebug("Try remove connection from cache");
-    prev = NULL;
-    for (e = cache; e != NULL; e = e->next)
+    if (connectionCache == NULL)
     {
-        if (e->dbc == dbc)
-        {
-            if (prev == NULL)
-            {
-                cache = e->next;
-            }
-            else
-            {
-                prev->next = e->next;
-            }
-            SQLFreeHandle(SQL_HANDLE_DBC, e->dbc);
-            SQLFreeHandle(SQL_HANDLE_ENV, e->env);
-            free(e);
+        initConnectionCache();
+    }
+    key.serverid = serverid;
+    key.umid = umid;
+    entry = (db2ConnectionCacheEntry *)hash_search(connectionCache, &key, HASH_ENTER, &found);
+    if (found)
+    {
+        return entry;
+    }
+    entry->dbc = NULL;
+    entry->refs = 0;
+    entry->invalidated = false;
+    entry->dsn = entry->username = entry->password = NULL;
+    entry->busy = false;
+    entry->connect_pending = false;
+    entry->last_used = entry->last_ping = 0;
+    entry->generation = entry->stmts_generation = 0;
+    entry->stmts = NULL;
+    entry->xact_depth = 0;
+    entry->xact_failed = false;
+    entry->stats_pending = false;
+    memset(&entry->stats, 0, sizeof(db2Counters));
+    memset(entry->sqlstates, 0, sizeof(entry->sqlstates));
+    // the entries do not move in the hash table, the maintenance thread gets the pointer
+    pthread_mutex_lock(&connLock);
+    if (maintainedCount == maintainedSize)
+    {
+        maintainedSize = Max(8, maintainedSize * 2);
+        maintained = maintained == NULL
+                         ? MemoryContextAlloc(TopMemoryContext, sizeof(db2ConnectionCacheEntry *) * maintainedSize)
+                         : repalloc(maintained, sizeof(db2ConnectionCacheEntry *) * maintainedSize);
+    }
+    maintained[maintainedCount++] = entry;
+    pthread_mutex_unlock(&connLock);
+    return entry;
+}
+
+/*
+ * Connection parameters are kept for reconnection by the maintenance thread
+ */
+static void setConnectionParams(db2ConnectionCacheEntry *entry, const char *dsn, const char *username,
+                                const char *password)
+{
+    char **params[3] = {&entry->dsn, &entry->username, &entry->password};
+    const char *values[3] = {dsn, username, password};
+    int i;
 
-            logdebug("Connection removed from cache succesfully");
+    for (i = 0; i < 3; i++)
+    {
+        if (*params[i] != NULL)
+        {
+            pfree(*params[i]);
         }
+        *params[i] = values[i] == NULL ? NULL : MemoryContextStrdup(TopMemoryContext, values[i]);
     }
+    entry->server_hashvalue = GetSysCacheHashValue1(FOREIGNSERVEROID, ObjectIdGetDatum(entry->key.serverid));
+    entry->mapping_hashvalue = GetSysCacheHashValue1(USERMAPPINGOID, ObjectIdGetDatum(entry->key.umid));
 }
 
 /*
- * SQL functions*/
-extern Datum db2odbc_fdw_handler(PG_FUNCTION_ARGS);
-extern Datum db2odbc_fdw_validator(PG_FUNCTION_ARGS);
+ * Lock the cache when the maintenance thread does not work with the entry
+ */
+static void lockConnection(db2ConnectionCacheEntry *entry)
+{
+    pthread_mutex_lock(&connLock);
+    while (entry->busy)
+    {
+        struct timespec ts;
 
-PG_FUNCTION_INFO_V1(db2odbc_fdw_handler);
-PG_FUNCTION_INFO_V1(db2odbc_fdw_validator);
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += 100 * 1000 * 1000;
+        if (ts.tv_nsec >= 1000 * 1000 * 1000)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000 * 1000 * 1000;
+        }
+        pthread_cond_timedwait(&connChanged, &connLock, &ts);
+        if (entry->busy)
+        {
+            pthread_mutex_unlock(&connLock);
+            CHECK_FOR_INTERRUPTS();
+            pthread_mutex_lock(&connLock);
+        }
+    }
+}
 
 /*
- * FDW callback routines
+ * Driver reports the connection as lost, checked without a round trip to DB2
+ * The connection is assumed alive if the driver does not support the attribute
  */
-static void db2_ExplainForeignScan(ForeignScanState *node,
-                                   ExplainState *es);
-static void db2_BeginForeignScan(ForeignScanState *node,
-                                 int eflags);
-static TupleTableSlot *db2_IterateForeignScan(
-    ForeignScanState *node);
-static void db2_ReScanForeignScan(ForeignScanState *node);
-static void db2_EndForeignScan(ForeignScanState *node);
-static void db2_GetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid);
-static void db2_GetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid);
-static bool db2_AnalyzeForeignTable(Relation relation, AcquireSampleRowsFunc *func, BlockNumber *totalpages);
-static ForeignScan *db2_GetForeignPlan(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid, ForeignPath *best_path, List *tlist, List *scan_clauses, Plan *outer_plan);
+static bool isConnectionDead(SQLHDBC dbc)
+{
+    SQLUINTEGER dead = SQL_CD_FALSE;
+    SQLRETURN ret;
+
+    ret = SQLGetConnectAttr(dbc, SQL_ATTR_CONNECTION_DEAD, &dead, 0, NULL);
+    return SQL_SUCCEEDED(ret) && dead == SQL_CD_TRUE;
+}
 
 /*
- * Foreign-data wrapper handler function: return a struct with pointers
- * to my callback routines.
+ * ODBC part of connecting, called also by the maintenance thread
  */
-Datum
-    db2odbc_fdw_handler(PG_FUNCTION_ARGS)
+static SQLRETURN odbcConnect(SQLHDBC *dbc, const char *dsn, const char *username, const char *password)
 {
-    FdwRoutine *fdwroutine;
-
-    logdebug(__func__);
-    fdwroutine = makeNode(FdwRoutine);
+    SQLRETURN ret;
 
-    fdwroutine->ExplainForeignScan = db2_ExplainForeignScan;
-    fdwroutine->BeginForeignScan = db2_BeginForeignScan;
-    fdwroutine->IterateForeignScan = db2_IterateForeignScan;
-    fdwroutine->ReScanForeignScan = db2_ReScanForeignScan;
-    fdwroutine->EndForeignScan = db2_EndForeignScan;
-    fdwroutine->AnalyzeForeignTable = db2_AnalyzeForeignTable;
+    ret = SQLAllocHandle(SQL_HANDLE_DBC, odbcEnv, dbc);
+    if (!SQL_SUCCEEDED(ret))
+    {
+        *dbc = NULL;
+        return ret;
+    }
+    ret = SQLConnect(*dbc, (SQLCHAR *)dsn, SQL_NTS, (SQLCHAR *)username, SQL_NTS, (SQLCHAR *)password, SQL_NTS);
+    return ret;
+}
 
-    fdwroutine->GetForeignRelSize = db2_GetForeignRelSize;
-    fdwroutine->GetForeignPaths = db2_GetForeignPaths;
-    fdwroutine->GetForeignPlan = db2_GetForeignPlan;
+static void odbcDisconnect(SQLHDBC dbc)
+{
+    SQLDisconnect(dbc);
+    SQLFreeHandle(SQL_HANDLE_DBC, dbc);
+}
 
-    logdebug("Returning %s", __func__);
-    PG_RETURN_POINTER(fdwroutine);
+static void disconnectEntry(db2ConnectionCacheEntry *entry)
+{
+    logdebug("Disconnect");
+    odbcDisconnect(entry->dbc);
+    entry->dbc = NULL;
+    entry->invalidated = false;
+    entry->generation++;
 }
 
-static const char *get_name(Oid catalog)
+static void connectEntry(db2ConnectionCacheEntry *entry, const char *dsn, const char *username,
+                         const char *password)
 {
-    logdebug(__func__);
+    SQLHDBC dbc;
+    SQLRETURN ret;
 
-    switch (catalog)
+    ret = odbcConnect(&dbc, dsn, username, password);
+    if (dbc == NULL)
     {
-    case ForeignTableRelationId:
-        return "foreign table";
-    case ForeignServerRelationId:
-        return "foreign data server";
-    case UserMappingRelationId:
-        return "foreing user mapping";
+        extract_error("SQLAllocHandle SQL_HANDLE_DBC", odbcEnv, SQL_HANDLE_ENV, NULL, NULL);
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+                 errmsg("Cannot allocate SQL_HANDLE_DBC")));
     }
-    return "unrecognized";
+    if (!SQL_SUCCEEDED(ret))
+    {
+        extract_error("SQLConnect", dbc, SQL_HANDLE_DBC, NULL, entry);
+        SQLFreeHandle(SQL_HANDLE_DBC, dbc);
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
+                 errmsg("cannot connect to odbc dsn %s", dsn),
+                 errhint("Check connection data or make sure that target database is online")));
+    }
+    logdebug("Successfully connected to driver");
+    entry->dbc = dbc;
+    entry->invalidated = false;
+    entry->generation++;
+    setConnectionParams(entry, dsn, username, password);
 }
 
-static void createValidOptions(StringInfoData *buf, Oid context)
+// -------------------------------------------
+// prepared statements of cached connections
+// -------------------------------------------
+
+static uint64 statementClock = 0;
+
+/*
+ * Cursor of the previous execution is closed and its buffers are unbound, the statement stays prepared
+ */
+static void resetStatement(SQLHSTMT stmt)
 {
-    db2FdwOption *opt1;
+    SQLFreeStmt(stmt, SQL_CLOSE);
+    SQLFreeStmt(stmt, SQL_UNBIND);
+    SQLFreeStmt(stmt, SQL_RESET_PARAMS);
+    SQLSetStmtAttr(stmt, SQL_ATTR_ROW_ARRAY_SIZE, (SQLPOINTER)1, 0);
+    SQLSetStmtAttr(stmt, SQL_ATTR_ROWS_FETCHED_PTR, NULL, 0);
+}
 
-    logdebug(__func__);
+static void forgetStatement(db2CachedStatement *cs, bool free_handle)
+{
+    int i;
 
-    initStringInfo(buf);
-    for (opt1 = valid_options; opt1->optname; opt1++)
+    if (cs->query == NULL)
     {
-        if (context == opt1->optcontext)
-            appendStringInfo(buf, "%s%s", (buf->len > 0) ? ", " : "",
-                             opt1->optname);
+        return;
+    }
+    if (free_handle)
+    {
+        SQLFreeHandle(SQL_HANDLE_STMT, cs->stmt);
+    }
+    pfree(cs->query);
+    if (cs->columns != NULL)
+    {
+        for (i = 0; i < cs->no_columns; i++)
+        {
+            pfree(cs->columns[i].name);
+        }
+        pfree(cs->columns);
     }
+    memset(cs, 0, sizeof(db2CachedStatement));
+    cs->no_columns = -1;
 }
 
 /*
- * Validate the generic options given to a FOREIGN DATA WRAPPER, SERVER,
- * USER MAPPING or FOREIGN TABLE that uses file_fdw.
- *
- * Raise an ERROR if the option or its value is considered invalid.
+ * Statement cache of the connection, emptied if the connection was opened again since
  */
-Datum
-    db2odbc_fdw_validator(PG_FUNCTION_ARGS)
+static db2CachedStatement *connectionStatements(db2ConnectionCacheEntry *entry)
 {
-    List *options_list;
-    Oid context;
-    ListCell *cell;
-    StringInfoData buf;
-    db2FdwOption *opt1;
-    bool found;
-
-    options_list = untransformRelOptions(PG_GETARG_DATUM(0));
-    context = PG_GETARG_OID(1);
-    logdebug("db2_fdw_validator : %s ", get_name(context));
+    int i;
 
-    foreach (cell, options_list)
+    if (entry->stmts == NULL)
     {
-        DefElem *def;
-        const char *option;
-        db2FdwOption *opt;
-        bool valid;
-
-        def = (DefElem *)lfirst(cell);
-        option = defGetString(def);
-        logdebug("%s : %s", def->defname, option);
-        valid = false;
-        for (opt = valid_options; opt->optname; opt++)
+        entry->stmts = MemoryContextAllocZero(TopMemoryContext, sizeof(db2CachedStatement) * STATEMENT_CACHE_SIZE);
+        entry->stmts_generation = entry->generation;
+    }
+    if (entry->stmts_generation != entry->generation)
+    {
+        logdebug("Connection reopened, prepared statements forgotten");
+        for (i = 0; i < STATEMENT_CACHE_SIZE; i++)
         {
-            logdebug(opt->optname);
-            if (strcmp(opt->optname, def->defname) == 0)
-            {
-                logdebug("recognized");
-                if (context == opt->optcontext)
-                {
-                    valid = true;
-                }
-                break;
-            }
-        }
-        if (!valid)
-        {
-            createValidOptions(&buf, context);
-            ereport(ERROR,
-                    (errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
-                     errmsg("invalid option \"%s\" %s", def->defname,
-                            opt->optname == NULL ? "" : "(option name is recognized but is invalid in this context)"),
-                     errhint("Valid options in this context are: %s", buf.len ? buf.data : "<none>")));
+            forgetStatement(&entry->stmts[i], false);
         }
+        entry->stmts_generation = entry->generation;
     }
+    return entry->stmts;
+}
 
-    // second phase, check required
-    for (opt1 = valid_options; opt1->optname; opt1++)
+/*
+ * Allocate statement not kept in the cache, the reference of data frees it if the statement fails
+ */
+static void allocStatement(db2PrivateData *data)
+{
+    SQLAllocHandle(SQL_HANDLE_STMT, data->dbc, &data->stmt);
+    data->ref->stmt = data->stmt;
+    data->ref->generation = data->conn->generation;
+}
+
+/*
+ * Prepare data->query on the connection of data
+ * Statement with the same SQL text prepared before on the connection and not used now is taken
+ * from the cache without SQLPrepare, new statement replaces the least recently used one
+ */
+static SQLRETURN prepareStatement(db2PrivateData *data)
+{
+    db2CachedStatement *stmts = connectionStatements(data->conn);
+    db2CachedStatement *victim = NULL;
+    uint32 hash = DatumGetUInt32(hash_any((const unsigned char *)data->query, strlen(data->query)));
+    SQLRETURN ret;
+    int i;
+
+    for (i = 0; i < STATEMENT_CACHE_SIZE; i++)
     {
-        if (!opt1->required)
-        {
-            continue;
-        }
-        if (context != opt1->optcontext)
+        db2CachedStatement *cs = &stmts[i];
+
+        if (cs->in_use)
         {
             continue;
         }
-        logdebug("validate required option %s", opt1->optname);
-        found = false;
-
-        foreach (cell, options_list)
+        if (cs->query != NULL && cs->hash == hash && strcmp(cs->query, data->query) == 0)
         {
-            DefElem *def;
-
-            def = (DefElem *)lfirst(cell);
-            if (strcmp(opt1->optname, def->defname) == 0)
-            {
-                found = true;
-                break;
-            }
+            logdebug("Prepared statement taken from cache");
+            resetStatement(cs->stmt);
+            cs->in_use = true;
+            cs->last_used = ++statementClock;
+            data->stmt = cs->stmt;
+            data->prepared = cs;
+            data->ref->prepared = cs;
+            return SQL_SUCCESS;
         }
-        if (!found)
+        // empty slot first, then the least recently used one
+        if (victim == NULL || (victim->query != NULL && (cs->query == NULL || cs->last_used < victim->last_used)))
         {
-            createValidOptions(&buf, context);
-            ereport(ERROR,
-                    (errcode(ERRCODE_FDW_OPTION_NAME_NOT_FOUND),
-                     errmsg("option is required: %s", opt1->optname),
-                     errhint("Valid options in this context are: %s", buf.len ? buf.data : "<none>")));
+            victim = cs;
         }
     }
+    allocStatement(data);
+    ret = SQLPrepare(data->stmt, (SQLCHAR *)data->query, SQL_NTS);
+    // all slots in use, the statement is freed after use
+    if (!SQL_SUCCEEDED(ret) || victim == NULL)
+    {
+        return ret;
+    }
+    data->ref->stmt = SQL_NULL_HSTMT;
+    forgetStatement(victim, true);
+    victim->query = MemoryContextStrdup(TopMemoryContext, data->query);
+    victim->hash = hash;
+    victim->stmt = data->stmt;
+    victim->in_use = true;
+    victim->last_used = ++statementClock;
+    victim->no_columns = -1;
+    victim->columns = NULL;
+    data->prepared = victim;
+    data->ref->prepared = victim;
+    return ret;
+}
 
-    PG_RETURN_VOID();
+/*
+ * Statement of data is finished, cached statement stays prepared for the next use
+ */
+static void releaseStatement(db2PrivateData *data)
+{
+    if (data->stmt == SQL_NULL_HSTMT)
+    {
+        return;
+    }
+    if (data->prepared != NULL)
+    {
+        resetStatement(data->stmt);
+        data->prepared->in_use = false;
+        data->prepared = NULL;
+        data->ref->prepared = NULL;
+    }
+    else if (data->ref->stmt != SQL_NULL_HSTMT)
+    {
+        // the statement was not freed by abort of subtransaction
+        SQLFreeHandle(SQL_HANDLE_STMT, data->stmt);
+        data->ref->stmt = SQL_NULL_HSTMT;
+    }
+    data->stmt = SQL_NULL_HSTMT;
 }
 
-static void list_drivers()
+/*
+ * Free the statement not kept in the cache of a statement interrupted by error
+ * SQLDisconnect freed it already if the connection was opened again since
+ */
+static void freeRefStatement(db2ConnectionRef *ref)
 {
-    SQLRETURN ret;
-    SQLHENV env;
-    char dsn[256];
-    char desc[256];
-    SQLSMALLINT dsn_ret;
-    SQLSMALLINT desc_ret;
-    SQLUSMALLINT direction;
+    if (ref->stmt != SQL_NULL_HSTMT && ref->entry->dbc != NULL && ref->generation == ref->entry->generation)
+    {
+        SQLFreeHandle(SQL_HANDLE_STMT, ref->stmt);
+    }
+    ref->stmt = SQL_NULL_HSTMT;
+}
 
-    logdebug(__func__);
-    ret = SQLAllocHandle(SQL_HANDLE_ENV, SQL_NULL_HANDLE, &env);
-    if (!SQL_SUCCEEDED(ret))
+// -------------------------------------------
+// maintenance of idle connections
+// -------------------------------------------
+
+/*
+ * Work of the maintenance thread on idle connection
+ */
+typedef enum db2MaintenanceAction
+{
+    MAINTENANCE_NONE,
+    MAINTENANCE_CONNECT,
+    MAINTENANCE_DISCONNECT,
+    MAINTENANCE_PING
+} db2MaintenanceAction;
+
+/*
+ * Called with connLock held, connection used by a statement is never touched
+ */
+static db2MaintenanceAction maintenanceAction(db2ConnectionCacheEntry *entry, time_t now)
+{
+    if (entry->refs > 0)
     {
-        lognotice("Cannot allocate SQL_HANDLE_ENV");
+        return MAINTENANCE_NONE;
     }
-    SQLSetEnvAttr(env, SQL_ATTR_ODBC_VERSION, (void *)SQL_OV_ODBC3, 0);
-    direction = SQL_FETCH_FIRST;
-    while (SQL_SUCCEEDED(ret = SQLDataSources(env, direction,
-                                              (SQLCHAR *)dsn, sizeof(dsn), &dsn_ret,
-                                              (SQLCHAR *)desc, sizeof(desc), &desc_ret)))
+    if (entry->dbc == NULL)
     {
-        direction = SQL_FETCH_NEXT;
-        logdebug("%s - %s", dsn, desc);
+        return entry->connect_pending ? MAINTENANCE_CONNECT : MAINTENANCE_NONE;
+    }
+    if (entry->invalidated || (maintenanceIdleTimeout > 0 && now - entry->last_used >= maintenanceIdleTimeout))
+    {
+        return MAINTENANCE_DISCONNECT;
     }
-    SQLFreeHandle(SQL_HANDLE_ENV, env);
-    logdebug("End of list drivers");
+    if (maintenanceKeepalive > 0 && now - Max(entry->last_used, entry->last_ping) >= maintenanceKeepalive)
+    {
+        return MAINTENANCE_PING;
+    }
+    return MAINTENANCE_NONE;
 }
 
-static void extract_error(char *fn,
-                          SQLHANDLE handle,
-                          SQLSMALLINT type,
-                          SQLINTEGER *outnative)
+/*
+ * Trivial statement keeping the connection alive, false if DB2 cannot be reached
+ */
+static bool pingConnection(SQLHDBC dbc)
 {
-    SQLINTEGER i = 0;
-    SQLINTEGER native;
-    SQLCHAR state[7];
-    SQLCHAR text[256];
-    SQLSMALLINT len;
+    SQLHSTMT stmt;
     SQLRETURN ret;
 
-    logdebug(__func__);
-    elog(NOTICE,
-         "\n"
-         "The driver reported the following diagnostics while running "
-         "%s\n",
-         fn);
-
-    if (outnative != NULL)
+    ret = SQLAllocHandle(SQL_HANDLE_STMT, dbc, &stmt);
+    if (!SQL_SUCCEEDED(ret))
     {
-        *outnative = ANYERROR;
+        return false;
     }
-    do
+    ret = SQLExecDirect(stmt, (SQLCHAR *)"VALUES 1", SQL_NTS);
+    SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+    return SQL_SUCCEEDED(ret);
+}
+
+/*
+ * Opens pending connections, pings idle connections every keepalive_interval and closes connections
+ * idle longer than idle_timeout. Broken connection is opened again, so the next statement does not wait.
+ * The entry is marked busy while the thread works with it without connLock
+ */
+static void *maintenanceThread(void *arg)
+{
+    pthread_mutex_lock(&connLock);
+    while (!maintenanceStop)
     {
-        ret = SQLGetDiagRec(type, handle, ++i, state, &native, text,
-                            sizeof(text), &len);
-        if (SQL_SUCCEEDED(ret))
+        struct timespec ts;
+        int i;
+
+        for (i = 0; i < maintainedCount && !maintenanceStop; i++)
         {
-            elog(NOTICE, "SQLSTATE:%s : %ld : %ld : %s\n", state, (long int)i, (long int)native, text);
-            if (outnative != NULL && *outnative == ANYERROR)
+            db2ConnectionCacheEntry *entry = maintained[i];
+            db2MaintenanceAction action = maintenanceAction(entry, time(NULL));
+            SQLHDBC dbc = entry->dbc;
+
+            if (action == MAINTENANCE_NONE)
             {
-                *outnative = native;
+                continue;
+            }
+            entry->busy = true;
+            pthread_mutex_unlock(&connLock);
+            if (action == MAINTENANCE_DISCONNECT)
+            {
+                odbcDisconnect(dbc);
+                dbc = NULL;
+            }
+            if (action == MAINTENANCE_PING && !pingConnection(dbc))
+            {
+                odbcDisconnect(dbc);
+                action = MAINTENANCE_CONNECT;
+            }
+            if (action == MAINTENANCE_CONNECT && !SQL_SUCCEEDED(odbcConnect(&dbc, entry->dsn, entry->username, entry->password)))
+            {
+                // the next statement connects and reports the error
+                if (dbc != NULL)
+                {
+                    SQLFreeHandle(SQL_HANDLE_DBC, dbc);
+                }
+                dbc = NULL;
+            }
+            pthread_mutex_lock(&connLock);
+            if (action == MAINTENANCE_DISCONNECT)
+            {
+                entry->invalidated = false;
             }
+            if (action != MAINTENANCE_PING)
+            {
+                entry->generation++;
+            }
+            entry->dbc = dbc;
+            entry->connect_pending = false;
+            entry->last_ping = time(NULL);
+            if (action == MAINTENANCE_CONNECT)
+            {
+                entry->last_used = entry->last_ping;
+            }
+            if (action == MAINTENANCE_CONNECT && dbc != NULL)
+            {
+                entry->stats.connects++;
+                entry->stats_pending = true;
+            }
+            entry->busy = false;
+            pthread_cond_broadcast(&connChanged);
         }
-    } while (ret == SQL_SUCCESS);
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec++;
+        pthread_cond_timedwait(&maintenanceWake, &connLock, &ts);
+    }
+    pthread_mutex_unlock(&connLock);
+    return NULL;
 }
 
-static void getConnection(db2PrivateData *data, Oid foreigntableid, char **query)
+static void stopMaintenance(int code, Datum arg)
 {
-    ForeignTable *table;
-    ForeignServer *server;
-    UserMapping *mapping;
-    List *options;
-    ListCell *lc;
-    SQLRETURN ret;
+    pthread_mutex_lock(&connLock);
+    maintenanceStop = true;
+    pthread_cond_broadcast(&maintenanceWake);
+    pthread_mutex_unlock(&connLock);
+    pthread_join(maintenanceThreadId, NULL);
+}
 
-    char *dsn;
-    char *username;
-    char *password;
-    char *cached;
-    db2ConnectionCacheEntry *e;
+/*
+ * Start the thread when there is some work for it, settings are copied for the thread
+ */
+static void wakeMaintenance(bool preconnect)
+{
+    // the settings are written only by the backend
+    if (preconnect || maintenanceKeepalive != keepaliveInterval || maintenanceIdleTimeout != idleTimeout)
+    {
+        pthread_mutex_lock(&connLock);
+        maintenanceKeepalive = keepaliveInterval;
+        maintenanceIdleTimeout = idleTimeout;
+        pthread_cond_broadcast(&maintenanceWake);
+        pthread_mutex_unlock(&connLock);
+    }
+    if (maintenanceRunning || (!preconnect && keepaliveInterval == 0 && idleTimeout == 0))
+    {
+        return;
+    }
+    startThread(&maintenanceThreadId, maintenanceThread, NULL);
+    maintenanceRunning = true;
+    on_proc_exit(stopMaintenance, (Datum)0);
+}
 
-    cached = NULL;
-    dsn = username = password = cached = NULL;
+/*
+ * Schedule connections to servers of preconnect_servers, they are opened by the maintenance thread
+ * Servers without dsn or without user mapping are skipped
+ */
+static void preconnectServers(void)
+{
+    char *rawstring;
+    List *names;
+    ListCell *lc;
+    bool scheduled = false;
 
     logdebug(__func__);
-
-    table = GetForeignTable(foreigntableid);
-    server = GetForeignServer(table->serverid);
-    mapping = GetUserMapping(GetUserId(), table->serverid);
-
-    options = NIL;
-    options = list_concat(options, table->options);
-    options = list_concat(options, server->options);
-    options = list_concat(options, mapping->options);
-
-    foreach (lc, options)
+    rawstring = pstrdup(preconnectList);
+    if (!SplitIdentifierString(rawstring, ',', &names))
     {
-        DefElem *def = (DefElem *)lfirst(lc);
-        if (strcmp(def->defname, DSN) == 0)
-        {
-            dsn = defGetString(def);
-            logdebug("DSN: %s", dsn);
-            continue;
-        }
-        if (strcmp(def->defname, CACHED) == 0)
+        elog(WARNING, "invalid list syntax in parameter \"db2odbc_fdw.preconnect_servers\"");
+        return;
+    }
+    foreach (lc, names)
+    {
+        ForeignServer *server = GetForeignServerByName((char *)lfirst(lc), true);
+        UserMapping *mapping;
+        db2ConnectionCacheEntry *entry;
+        List *options;
+        ListCell *lo;
+        char *dsn = NULL;
+        char *username = NULL;
+        char *password = NULL;
+
+        if (server == NULL ||
+            (!SearchSysCacheExists2(USERMAPPINGUSERSERVER, ObjectIdGetDatum(GetUserId()), ObjectIdGetDatum(server->serverid)) &&
+             !SearchSysCacheExists2(USERMAPPINGUSERSERVER, ObjectIdGetDatum(InvalidOid), ObjectIdGetDatum(server->serverid))))
         {
-            cached = defGetString(def);
-            logdebug("CACHED: %s", cached);
             continue;
         }
-        if (strcmp(def->defname, PASSWORD) == 0)
+        mapping = GetUserMapping(GetUserId(), server->serverid);
+        options = list_concat(list_copy(server->options), mapping->options);
+        foreach (lo, options)
         {
-            password = defGetString(def);
-            logdebug("PASSWORD: %s", password);
-            continue;
+            DefElem *def = (DefElem *)lfirst(lo);
+            if (strcmp(def->defname, DSN) == 0)
+            {
+                dsn = defGetString(def);
+            }
+            if (strcmp(def->defname, USERNAME) == 0)
+            {
+                username = defGetString(def);
+            }
+            if (strcmp(def->defname, PASSWORD) == 0)
+            {
+                password = defGetString(def);
+            }
         }
-        if (strcmp(def->defname, USERNAME) == 0)
+        if (dsn == NULL)
         {
-            username = defGetString(def);
-            logdebug("USERNAME: %s", username);
             continue;
         }
-        if (strcmp(def->defname, QUERY) == 0)
+        entry = lookupConnection(server->serverid, mapping->umid);
+        lockConnection(entry);
+        if (entry->dbc == NULL && entry->refs == 0)
         {
-            *query = defGetString(def);
-            logdebug("QUERY: %s", *query);
-            continue;
+            setConnectionParams(entry, dsn, username, password);
+            entry->connect_pending = true;
+            scheduled = true;
         }
+        pthread_mutex_unlock(&connLock);
+    }
+    if (scheduled)
+    {
+        wakeMaintenance(true);
     }
+}
+
+// -------------------------------------------
+// remote transactions
+// -------------------------------------------
 
-    data->cached = cached;
-    e = findConnection(dsn, GetUserId());
-    if (e != NULL)
+/*
+ * Execute SQL statement without result on the connection, diagnostics are reported as notices
+ */
+static bool execRemoteCommand(db2ConnectionCacheEntry *entry, const char *sql)
+{
+    SQLHSTMT stmt;
+    SQLRETURN ret;
+
+    logdebug("%s: %s", __func__, sql);
+    ret = SQLAllocHandle(SQL_HANDLE_STMT, entry->dbc, &stmt);
+    if (!SQL_SUCCEEDED(ret))
     {
-        logdebug("Connection data received from cache");
-        data->env = e->env;
-        data->dbc = e->dbc;
+        extract_error("SQLAllocHandle SQL_HANDLE_STMT", entry->dbc, SQL_HANDLE_DBC, NULL, entry);
+        return false;
     }
-    else
+    ret = SQLExecDirect(stmt, (SQLCHAR *)sql, SQL_NTS);
+    if (!SQL_SUCCEEDED(ret) && ret != SQL_NO_DATA)
     {
-        /* Allocate an environment handle */
-        ret = SQLAllocHandle(SQL_HANDLE_ENV, SQL_NULL_HANDLE, &data->env);
-        if (!SQL_SUCCEEDED(ret))
-        {
-            lognotice("Cannot allocate SQL_HANDLE_ENV");
-        }
-        ret = SQLSetEnvAttr(data->env, SQL_ATTR_ODBC_VERSION, (void *)SQL_OV_ODBC3, 0);
-        if (!SQL_SUCCEEDED(ret))
+        extract_error("SQLExecDirect", stmt, SQL_HANDLE_STMT, NULL, entry);
+    }
+    SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+    return SQL_SUCCEEDED(ret) || ret == SQL_NO_DATA;
+}
+
+/*
+ * Write of data joins DB2 transaction, autocommit is switched off by the first write of the local
+ * transaction and a savepoint is set for every subtransaction level not covered yet
+ * Nothing is done if the server has autocommit option set
+ */
+static void beginRemoteXact(db2PrivateData *data)
+{
+    db2ConnectionCacheEntry *entry = data->conn;
+    int level = GetCurrentTransactionNestLevel();
+    ListCell *lc;
+
+    if (entry->xact_depth == 0)
+    {
+        SQLRETURN ret;
+
+        foreach (lc, GetForeignServer(data->serverid)->options)
         {
-            lognotice("Cannot set SQL_ATTR_ODBC_VERSION");
-            extract_error("SQL_ATTR_ODBC_VERSION", data->env, SQL_HANDLE_ENV, NULL);
+            DefElem *def = (DefElem *)lfirst(lc);
+            if (strcmp(def->defname, AUTOCOMMIT) == 0 && defGetBoolean(def))
+            {
+                return;
+            }
         }
-        ret = SQLAllocHandle(SQL_HANDLE_DBC, data->env, &data->dbc);
+        ret = SQLSetConnectAttr(entry->dbc, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER)SQL_AUTOCOMMIT_OFF, SQL_IS_UINTEGER);
         if (!SQL_SUCCEEDED(ret))
         {
-            lognotice("Cannot allocate SQL_HANDLE_DBC");
-            extract_error("SQLAllocHandle SQL_HANDLE_DBC", data->env, SQL_HANDLE_ENV, NULL);
-        }
-        ret = SQLConnect(data->dbc, (SQLCHAR *)dsn, SQL_NTS, (SQLCHAR *)username, SQL_NTS, (SQLCHAR *)password, SQL_NTS);
-        if (SQL_SUCCEEDED(ret))
-        {
-            logdebug("Successfully connected to driver");
-        }
-        else
-        {
-            extract_error("SQLDriverConnect", data->dbc, SQL_HANDLE_DBC, NULL);
+            extract_error("SQLSetConnectAttr", entry->dbc, SQL_HANDLE_DBC, NULL, entry);
             ereport(ERROR,
-                    (errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
-                     errmsg("cannot connect to odbc dsn %s", dsn),
-                     errhint("Check connection data or make sure that target database is online")));
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("Cannot start DB2 transaction")));
         }
-        if (cached != NULL)
+        pthread_mutex_lock(&connLock);
+        entry->refs++;
+        pthread_mutex_unlock(&connLock);
+        entry->xact_depth = 1;
+        entry->xact_failed = false;
+    }
+    while (entry->xact_depth < level)
+    {
+        char sql[64];
+
+        snprintf(sql, sizeof(sql), "SAVEPOINT S%d ON ROLLBACK RETAIN CURSORS", entry->xact_depth + 1);
+        if (!execRemoteCommand(entry, sql))
         {
-            logdebug("Add connection data to cache");
-            addNewConnection(dsn, GetUserId(), data->env, data->dbc);
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("Cannot set DB2 savepoint for subtransaction")));
         }
+        entry->xact_depth++;
     }
 }
 
-static void closeConnection(db2PrivateData *data)
+/*
+ * Commit or roll back DB2 transaction and return the connection to autocommit mode
+ * Returns false if SQLEndTran failed, the transaction is left open then
+ */
+static bool endRemoteXact(db2ConnectionCacheEntry *entry, SQLSMALLINT completion)
 {
-    if (data->cached == NULL)
-    {
-        logdebug("Disconnect");
-        SQLDisconnect(data->dbc);
-        SQLFreeHandle(SQL_HANDLE_DBC, data->dbc);
-        SQLFreeHandle(SQL_HANDLE_ENV, data->env);
-    }
-    else
+    SQLRETURN ret;
+
+    ret = SQLEndTran(SQL_HANDLE_DBC, entry->dbc, completion);
+    if (!SQL_SUCCEEDED(ret))
     {
-        logdebug("Do not disconnect, hashed");
+        extract_error("SQLEndTran", entry->dbc, SQL_HANDLE_DBC, NULL, entry);
+        return false;
     }
+    SQLSetConnectAttr(entry->dbc, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER)SQL_AUTOCOMMIT_ON, SQL_IS_UINTEGER);
+    entry->xact_depth = 0;
+    entry->xact_failed = false;
+    return true;
 }
 
 /*
- * fileExplainForeignScan
- *		Produce extra output for EXPLAIN
+ * DB2 transactions are committed before the local commit, so a failed commit aborts the local one
+ * There is no two-phase commit: if the commit of the second server fails, the first one stays committed
  */
-static void
-db2_ExplainForeignScan(ForeignScanState *node, ExplainState *es)
+static void commitRemoteXacts(void)
 {
-    logdebug(__func__);
+    HASH_SEQ_STATUS scan;
+    db2ConnectionCacheEntry *entry;
+
+    hash_seq_init(&scan, connectionCache);
+    while ((entry = (db2ConnectionCacheEntry *)hash_seq_search(&scan)) != NULL)
+    {
+        if (entry->xact_depth == 0)
+        {
+            continue;
+        }
+        if (entry->xact_failed || !endRemoteXact(entry, SQL_COMMIT))
+        {
+            hash_seq_term(&scan);
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("Cannot commit DB2 transaction")));
+        }
+        pthread_mutex_lock(&connLock);
+        if (entry->refs > 0 && --entry->refs == 0)
+        {
+            entry->last_used = time(NULL);
+        }
+        pthread_mutex_unlock(&connLock);
+    }
 }
 
-#define RETRYNUMB 2
+/*
+ * Called after error, references are reset by the caller. Connection which cannot roll back is reopened
+ */
+static void rollbackRemoteXacts(void)
+{
+    HASH_SEQ_STATUS scan;
+    db2ConnectionCacheEntry *entry;
+
+    hash_seq_init(&scan, connectionCache);
+    while ((entry = (db2ConnectionCacheEntry *)hash_seq_search(&scan)) != NULL)
+    {
+        if (entry->xact_depth == 0)
+        {
+            continue;
+        }
+        if (entry->dbc == NULL || !endRemoteXact(entry, SQL_ROLLBACK))
+        {
+            entry->xact_depth = 0;
+            entry->xact_failed = false;
+            pthread_mutex_lock(&connLock);
+            entry->invalidated = true;
+            pthread_mutex_unlock(&connLock);
+        }
+    }
+}
 
 /*
- * file_fixed_lengthBeginForeignScan
- *		Initiate access to the file
+ * Savepoint of the subtransaction is released on commit, on abort the writes done since it are undone
+ * Connection which cannot roll back to the savepoint cannot commit the transaction any longer
  */
-static void
-db2_BeginForeignScan(ForeignScanState *node, int eflags)
+static void connectionSubXactCallback(SubXactEvent event, SubTransactionId mySubid, SubTransactionId parentSubid,
+                                      void *arg)
 {
-    db2PrivateData *data;
-    char *query = NULL;
-    int retry = 0;
-    SQLRETURN ret;
-    SQLINTEGER native;
-    long int lcached;
-    int i, failure,size;
+    HASH_SEQ_STATUS scan;
+    db2ConnectionCacheEntry *entry;
+    db2ConnectionRef **prev;
+    int level;
 
-    logdebug(__func__);
-    list_drivers();
-    data = (db2PrivateData *)palloc(sizeof(db2PrivateData));
+    if ((event != SUBXACT_EVENT_PRE_COMMIT_SUB && event != SUBXACT_EVENT_COMMIT_SUB &&
+         event != SUBXACT_EVENT_ABORT_SUB) ||
+        connectionCache == NULL)
+    {
+        return;
+    }
+    level = GetCurrentTransactionNestLevel();
+    // threads of aborted scans could still use the connections
+    if (event == SUBXACT_EVENT_ABORT_SUB)
+    {
+        stopHelperScans(level);
+    }
 
-    failure = 1;
-    // it is
-    while (retry < RETRYNUMB)
+    // references of committed subtransaction belong to the parent, those of aborted one are released
+    prev = &connectionRefs;
+    while (*prev != NULL)
     {
-        getConnection(data, RelationGetRelid(node->ss.ss_currentRelation), &query);
-        SQLAllocHandle(SQL_HANDLE_STMT, data->dbc, &data->stmt);
-        /* Retrieve a list of rows */
-        ret = SQLExecDirect(data->stmt, (SQLCHAR *)query, SQL_NTS);
-        if (SQL_SUCCEEDED(ret))
+        db2ConnectionRef *ref = *prev;
+
+        if (ref->level < level || event == SUBXACT_EVENT_PRE_COMMIT_SUB)
         {
-            logdebug("SQLExecDirect");
-            // OK
-            failure = 0;
-            break;
+            prev = &ref->next;
+            continue;
         }
-        else
+        if (event == SUBXACT_EVENT_COMMIT_SUB)
         {
-            retry++;
-            extract_error("Error while executing query", data->stmt, SQL_HANDLE_STMT, &native);
-            if (data->cached == NULL)
+            ref->level = level - 1;
+            prev = &ref->next;
+            continue;
+        }
+        *prev = ref->next;
+        freeRefStatement(ref);
+        pthread_mutex_lock(&connLock);
+        if (ref->entry->refs > 0 && --ref->entry->refs == 0)
+        {
+            ref->entry->last_used = time(NULL);
+        }
+        if (ref->prepared != NULL)
+        {
+            ref->prepared->in_use = false;
+        }
+        pthread_mutex_unlock(&connLock);
+        ref->entry = NULL;
+        ref->prepared = NULL;
+    }
+    if (event == SUBXACT_EVENT_COMMIT_SUB)
+    {
+        return;
+    }
+
+    hash_seq_init(&scan, connectionCache);
+    while ((entry = (db2ConnectionCacheEntry *)hash_seq_search(&scan)) != NULL)
+    {
+        char sql[64];
+
+        if (entry->xact_depth < level)
+        {
+            continue;
+        }
+        entry->xact_depth = level - 1;
+        if (event == SUBXACT_EVENT_PRE_COMMIT_SUB)
+        {
+            snprintf(sql, sizeof(sql), "RELEASE SAVEPOINT S%d", level);
+            if (!execRemoteCommand(entry, sql))
             {
-                logdebug("Not cached, failed");
-                break;
+                hash_seq_term(&scan);
+                ereport(ERROR,
+                        (errcode(ERRCODE_FDW_ERROR),
+                         errmsg("Cannot release DB2 savepoint")));
             }
-            logdebug("Error native code: %u", native);
-            // remove from cache
-            removeConnection(data->dbc);
-            // try retry
-            lcached = atol(data->cached);
+            continue;
+        }
+        snprintf(sql, sizeof(sql), "ROLLBACK TO SAVEPOINT S%d", level);
+        if (entry->dbc == NULL || !execRemoteCommand(entry, sql))
+        {
+            entry->xact_failed = true;
+            continue;
+        }
+        snprintf(sql, sizeof(sql), "RELEASE SAVEPOINT S%d", level);
+        execRemoteCommand(entry, sql);
+    }
+}
 
-            if (lcached == 0)
+/*
+ * Statements interrupted by error do not release their connections and prepared statements
+ * Connections of preconnect_servers are scheduled at the end of the first transaction of the session,
+ * catalog is not accessible sooner. Statistics are flushed at the end of every transaction
+ */
+static void connectionXactCallback(XactEvent event, void *arg)
+{
+    HASH_SEQ_STATUS scan;
+    db2ConnectionCacheEntry *entry;
+
+    if (event == XACT_EVENT_PRE_COMMIT && !preconnectDone)
+    {
+        preconnectDone = true;
+        // autovacuum, background and parallel workers load the library too, only sessions use the connections
+#if PG_VERSION_NUM >= 130000
+        if (MyBackendType == B_BACKEND && preconnectList != NULL && *preconnectList != '\0')
+#else
+        if (!IsBackgroundWorker && !IsAutoVacuumLauncherProcess() && !IsAutoVacuumWorkerProcess() && !am_walsender &&
+            preconnectList != NULL && *preconnectList != '\0')
+#endif
+        {
+            preconnectServers();
+        }
+    }
+    if (event == XACT_EVENT_PRE_COMMIT && connectionCache != NULL)
+    {
+        commitRemoteXacts();
+    }
+    if (event == XACT_EVENT_PRE_PREPARE && connectionCache != NULL)
+    {
+        hash_seq_init(&scan, connectionCache);
+        while ((entry = (db2ConnectionCacheEntry *)hash_seq_search(&scan)) != NULL)
+        {
+            if (entry->xact_depth > 0)
             {
-                lcached = ANYERROR;
-                logdebug("Cached is 0 (may an error), ANYERROR is assumed");
+                hash_seq_term(&scan);
+                ereport(ERROR,
+                        (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                         errmsg("cannot PREPARE a transaction that has written to DB2")));
             }
-            if (lcached == ANYERROR)
+        }
+    }
+    if (event == XACT_EVENT_ABORT || event == XACT_EVENT_PARALLEL_ABORT)
+    {
+        db2ConnectionRef *ref;
+
+        // threads of aborted scans could still use the connections
+        stopHelperScans(0);
+        for (ref = connectionRefs; ref != NULL; ref = ref->next)
+        {
+            freeRefStatement(ref);
+        }
+    }
+    if (event == XACT_EVENT_COMMIT || event == XACT_EVENT_PARALLEL_COMMIT || event == XACT_EVENT_PREPARE ||
+        event == XACT_EVENT_ABORT || event == XACT_EVENT_PARALLEL_ABORT)
+    {
+        flushStats();
+        // TopTransactionContext is freed
+        connectionRefs = NULL;
+    }
+    if ((event != XACT_EVENT_ABORT && event != XACT_EVENT_PARALLEL_ABORT) || connectionCache == NULL)
+    {
+        return;
+    }
+    rollbackRemoteXacts();
+    pthread_mutex_lock(&connLock);
+    hash_seq_init(&scan, connectionCache);
+    while ((entry = (db2ConnectionCacheEntry *)hash_seq_search(&scan)) != NULL)
+    {
+        int i;
+
+        if (entry->refs > 0)
+        {
+            entry->refs = 0;
+            entry->last_used = time(NULL);
+        }
+        for (i = 0; entry->stmts != NULL && i < STATEMENT_CACHE_SIZE; i++)
+        {
+            entry->stmts[i].in_use = false;
+        }
+    }
+    pthread_mutex_unlock(&connLock);
+}
+
+// -------------------------------------------
+// shared result cache
+// -------------------------------------------
+
+// results kept in the cache and foreign tables of one result
+#define RESULT_CACHE_ENTRIES 1024
+#define RESULT_CACHE_MAX_RELS 8
+
+/*
+ * Result of a scan with cache_ttl kept in shared memory, the key and the rows are allocated in DSA
+ * The rows are heap tuples of the scan tuple descriptor, each MAXALIGNed and preceded by its length
+ */
+typedef struct db2ResultCacheEntry
+{
+    bool used;
+    uint32 hash;
+    Oid dbid;
+    // foreign tables the result is read from
+    int nrels;
+    Oid relids[RESULT_CACHE_MAX_RELS];
+    TimestampTz expires;
+    dsa_pointer key;
+    dsa_pointer rows;
+    Size size;
+} db2ResultCacheEntry;
+
+// servers and user mappings with statistics, all databases together
+#define STAT_ENTRIES 256
+
+/*
+ * Statistics of server and user mapping summed over all backends
+ */
+typedef struct db2StatEntry
+{
+    bool used;
+    Oid dbid;
+    Oid serverid;
+    Oid umid;
+    db2Counters counters;
+    db2SqlStateCount sqlstates[STAT_SQLSTATES];
+} db2StatEntry;
+
+/*
+ * Shared memory of the module, exists only if it is loaded by shared_preload_libraries
+ * The entries and cache_used are protected by lock, the DSA area is created by the first backend
+ * which stores a result. Statistics are protected by stats_lock
+ */
+typedef struct db2SharedState
+{
+    LWLock *lock;
+    int tranche_id;
+    dsa_handle area;
+    Size cache_used;
+    db2ResultCacheEntry entries[RESULT_CACHE_ENTRIES];
+    LWLock *stats_lock;
+    db2StatEntry stats[STAT_ENTRIES];
+} db2SharedState;
+
+static db2SharedState *sharedState = NULL;
+static dsa_area *resultArea = NULL;
+static shmem_startup_hook_type prevShmemStartupHook = NULL;
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prevShmemRequestHook = NULL;
+#endif
+
+static void requestSharedState(void)
+{
+#if PG_VERSION_NUM >= 150000
+    if (prevShmemRequestHook != NULL)
+    {
+        prevShmemRequestHook();
+    }
+#endif
+    RequestAddinShmemSpace(MAXALIGN(sizeof(db2SharedState)));
+    RequestNamedLWLockTranche("db2odbc_fdw", 2);
+}
+
+static void startupSharedState(void)
+{
+    bool found;
+
+    if (prevShmemStartupHook != NULL)
+    {
+        prevShmemStartupHook();
+    }
+    LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+    sharedState = ShmemInitStruct("db2odbc_fdw", sizeof(db2SharedState), &found);
+    if (!found)
+    {
+        memset(sharedState, 0, sizeof(db2SharedState));
+        sharedState->lock = &(GetNamedLWLockTranche("db2odbc_fdw"))[0].lock;
+        sharedState->stats_lock = &(GetNamedLWLockTranche("db2odbc_fdw"))[1].lock;
+        sharedState->tranche_id = LWLockNewTrancheId();
+        sharedState->area = DSA_HANDLE_INVALID;
+    }
+    LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Attach the DSA area of the cache, create it if no backend did so far
+ * Returns false if the cache is not available
+ */
+static bool attachResultCache(bool create)
+{
+    MemoryContext oldcontext;
+
+    if (resultArea != NULL)
+    {
+        return true;
+    }
+    if (sharedState == NULL || resultCacheSize == 0)
+    {
+        return false;
+    }
+    LWLockRegisterTranche(sharedState->tranche_id, "db2odbc_fdw_results");
+    oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+    LWLockAcquire(sharedState->lock, LW_EXCLUSIVE);
+    if (sharedState->area != DSA_HANDLE_INVALID)
+    {
+        resultArea = dsa_attach(sharedState->area);
+    }
+    else if (create)
+    {
+        resultArea = dsa_create(sharedState->tranche_id);
+        // the area stays when the backend exits
+        dsa_pin(resultArea);
+        sharedState->area = dsa_get_handle(resultArea);
+    }
+    LWLockRelease(sharedState->lock);
+    MemoryContextSwitchTo(oldcontext);
+    if (resultArea == NULL)
+    {
+        return false;
+    }
+    dsa_pin_mapping(resultArea);
+    return true;
+}
+
+/*
+ * Called with the lock held in exclusive mode
+ */
+static void removeResult(db2ResultCacheEntry *entry)
+{
+    dsa_free(resultArea, entry->key);
+    dsa_free(resultArea, entry->rows);
+    sharedState->cache_used -= entry->size;
+    entry->used = false;
+}
+
+static bool resultMatches(db2ResultCacheEntry *entry, uint32 hash, const char *key)
+{
+    return entry->used && entry->hash == hash && entry->dbid == MyDatabaseId &&
+           strcmp((char *)dsa_get_address(resultArea, entry->key), key) == 0;
+}
+
+/*
+ * Key of the current execution of the scan: user, remote SQL, parameter values and the row layout
+ * Returns NULL if the result cannot be cached
+ */
+static char *resultCacheKey(db2PrivateData *data)
+{
+    TupleDesc tupdesc = data->attinmeta->tupdesc;
+    StringInfoData key;
+    int i;
+
+    initStringInfo(&key);
+    appendStringInfo(&key, "%u %u\n%s\n", data->serverid, GetUserId(), data->query);
+    for (i = 0; i < data->no_params; i++)
+    {
+        if (i == data->batch_param)
+        {
+            int j;
+
+            for (j = 0; j < data->batch_count; j++)
             {
-                logdebug("ANYERROR assuemed, try again");
-                continue;
+                appendStringInfo(&key, "%s,", data->batch_values[j]);
             }
-            if (lcached != native)
+            appendStringInfoChar(&key, '\n');
+            continue;
+        }
+        appendStringInfo(&key, "%s\n", data->param_values[i] == NULL ? "\\N" : data->param_values[i]);
+    }
+    for (i = 0; i < tupdesc->natts; i++)
+    {
+        Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+        appendStringInfo(&key, "%u:%d ", attr->atttypid, attr->atttypmod);
+    }
+    return key.data;
+}
+
+/*
+ * Look up the result of the current execution, the rows are copied to cache_rows
+ * On miss the rows of the execution are collected for the cache
+ */
+static bool lookupResult(db2PrivateData *data)
+{
+    MemoryContext oldcontext;
+    uint32 hash;
+    int i;
+
+    data->cache_hit = false;
+    data->cache_fill = false;
+    if (data->cache_ttl == 0 || sharedState == NULL || resultCacheSize == 0)
+    {
+        return false;
+    }
+    // the area does not exist until some result is stored
+    attachResultCache(false);
+    MemoryContextReset(data->cachecontext);
+    oldcontext = MemoryContextSwitchTo(data->cachecontext);
+    data->cache_key = resultCacheKey(data);
+    initStringInfo(&data->cache_rows);
+    data->cache_pos = 0;
+    hash = DatumGetUInt32(hash_any((const unsigned char *)data->cache_key, strlen(data->cache_key)));
+    if (resultArea != NULL)
+    {
+        TimestampTz now = GetCurrentTimestamp();
+
+        LWLockAcquire(sharedState->lock, LW_SHARED);
+        for (i = 0; i < RESULT_CACHE_ENTRIES; i++)
+        {
+            db2ResultCacheEntry *entry = &sharedState->entries[i];
+
+            if (resultMatches(entry, hash, data->cache_key) && entry->expires > now)
             {
-                logdebug("Native code not valid for retry, fail");
+                enlargeStringInfo(&data->cache_rows, entry->size);
+                memcpy(data->cache_rows.data, dsa_get_address(resultArea, entry->rows), entry->size);
+                data->cache_rows.len = entry->size;
+                data->cache_hit = true;
                 break;
             }
-            logdebug("Native code valid for retry, try again");
         }
-    } // while
+        LWLockRelease(sharedState->lock);
+    }
+    MemoryContextSwitchTo(oldcontext);
+    logdebug("Result cache %s", data->cache_hit ? "hit" : "miss");
+    if (data->cache_hit)
+    {
+        data->cache_hits++;
+    }
+    // a result bigger than quarter of the cache is not kept
+    data->cache_fill = !data->cache_hit;
+    data->cache_limit = (Size)resultCacheSize * 1024 / 4;
+    return data->cache_hit;
+}
 
-    if (failure == 1)
+/*
+ * Next row of the cached result, false at the end
+ */
+static bool nextCachedRow(db2PrivateData *data, Datum *values, bool *isnull)
+{
+    HeapTupleData tuple;
+    uint32 len;
+
+    if (data->cache_pos >= data->cache_rows.len)
+    {
+        return false;
+    }
+    memcpy(&len, data->cache_rows.data + data->cache_pos, sizeof(uint32));
+    data->cache_pos += MAXALIGN(sizeof(uint32));
+    tuple.t_len = len;
+    tuple.t_data = (HeapTupleHeader)(data->cache_rows.data + data->cache_pos);
+    ItemPointerSetInvalid(&tuple.t_self);
+    tuple.t_tableOid = InvalidOid;
+    data->cache_pos += MAXALIGN(len);
+    // values point to cache_rows, valid until the next lookup
+    heap_deform_tuple(&tuple, data->attinmeta->tupdesc, values, isnull);
+    return true;
+}
+
+/*
+ * Append row of the execution to the result being collected, collecting stops if it gets too big
+ */
+static void collectRow(db2PrivateData *data, Datum *values, bool *isnull)
+{
+    HeapTuple tuple;
+    MemoryContext oldcontext;
+    uint32 len;
+
+    oldcontext = MemoryContextSwitchTo(data->rowcontext);
+    tuple = heap_form_tuple(data->attinmeta->tupdesc, values, isnull);
+    MemoryContextSwitchTo(oldcontext);
+    len = tuple->t_len;
+    if (data->cache_rows.len + MAXALIGN(sizeof(uint32)) + MAXALIGN(len) > data->cache_limit)
+    {
+        logdebug("Result too big for the cache");
+        data->cache_fill = false;
+        MemoryContextReset(data->cachecontext);
+        return;
+    }
+    appendBinaryStringInfo(&data->cache_rows, (char *)&len, sizeof(uint32));
+    appendStringInfoSpaces(&data->cache_rows, MAXALIGN(sizeof(uint32)) - sizeof(uint32));
+    appendBinaryStringInfo(&data->cache_rows, (char *)tuple->t_data, len);
+    appendStringInfoSpaces(&data->cache_rows, MAXALIGN(len) - len);
+}
+
+/*
+ * Complete result of the execution is stored, replacing older result of the same key
+ * Expired results go first, then the results closest to expiration until the new one fits
+ */
+static void storeResult(db2PrivateData *data)
+{
+    Size size;
+    Size keylen;
+    uint32 hash;
+    TimestampTz now;
+    db2ResultCacheEntry *slot = NULL;
+    dsa_pointer rows;
+    dsa_pointer key;
+    ListCell *lc;
+    int i;
+
+    if (!data->cache_fill)
+    {
+        return;
+    }
+    data->cache_fill = false;
+    if (!attachResultCache(true))
+    {
+        return;
+    }
+    size = data->cache_rows.len;
+    keylen = strlen(data->cache_key) + 1;
+    hash = DatumGetUInt32(hash_any((const unsigned char *)data->cache_key, keylen - 1));
+    now = GetCurrentTimestamp();
+    // copied before the lock is taken
+    rows = dsa_allocate_extended(resultArea, Max(size, 1), DSA_ALLOC_NO_OOM);
+    key = dsa_allocate_extended(resultArea, keylen, DSA_ALLOC_NO_OOM);
+    if (!DsaPointerIsValid(rows) || !DsaPointerIsValid(key))
+    {
+        if (DsaPointerIsValid(rows))
+        {
+            dsa_free(resultArea, rows);
+        }
+        if (DsaPointerIsValid(key))
+        {
+            dsa_free(resultArea, key);
+        }
+        return;
+    }
+    memcpy(dsa_get_address(resultArea, rows), data->cache_rows.data, size);
+    memcpy(dsa_get_address(resultArea, key), data->cache_key, keylen);
+
+    LWLockAcquire(sharedState->lock, LW_EXCLUSIVE);
+    for (i = 0; i < RESULT_CACHE_ENTRIES; i++)
+    {
+        db2ResultCacheEntry *entry = &sharedState->entries[i];
+
+        if (entry->used && (entry->expires <= now || resultMatches(entry, hash, data->cache_key)))
+        {
+            removeResult(entry);
+        }
+    }
+    for (;;)
+    {
+        db2ResultCacheEntry *oldest = NULL;
+
+        slot = NULL;
+        for (i = 0; i < RESULT_CACHE_ENTRIES; i++)
+        {
+            db2ResultCacheEntry *entry = &sharedState->entries[i];
+
+            if (!entry->used)
+            {
+                slot = slot == NULL ? entry : slot;
+                continue;
+            }
+            if (oldest == NULL || entry->expires < oldest->expires)
+            {
+                oldest = entry;
+            }
+        }
+        if (slot != NULL && sharedState->cache_used + size <= (Size)resultCacheSize * 1024)
+        {
+            break;
+        }
+        // result_cache_size was lowered
+        if (oldest == NULL)
+        {
+            LWLockRelease(sharedState->lock);
+            dsa_free(resultArea, rows);
+            dsa_free(resultArea, key);
+            return;
+        }
+        removeResult(oldest);
+    }
+    slot->used = true;
+    slot->hash = hash;
+    slot->dbid = MyDatabaseId;
+    slot->nrels = 0;
+    foreach (lc, data->cache_relids)
+    {
+        slot->relids[slot->nrels++] = lfirst_oid(lc);
+    }
+    slot->expires = TimestampTzPlusMilliseconds(now, (int64)data->cache_ttl * 1000);
+    slot->key = key;
+    slot->rows = rows;
+    slot->size = size;
+    sharedState->cache_used += size;
+    LWLockRelease(sharedState->lock);
+    logdebug("Result of %d bytes stored in the cache", (int)size);
+}
+
+/*
+ * Remove cached results read from the foreign table, InvalidOid removes all results of the database
+ * Returns the number of removed results
+ */
+static int invalidateResults(Oid relid)
+{
+    int removed = 0;
+    int i, j;
+
+    if (!attachResultCache(false))
+    {
+        return 0;
+    }
+    LWLockAcquire(sharedState->lock, LW_EXCLUSIVE);
+    for (i = 0; i < RESULT_CACHE_ENTRIES; i++)
+    {
+        db2ResultCacheEntry *entry = &sharedState->entries[i];
+
+        if (!entry->used || entry->dbid != MyDatabaseId)
+        {
+            continue;
+        }
+        for (j = 0; j < entry->nrels; j++)
+        {
+            if (!OidIsValid(relid) || entry->relids[j] == relid)
+            {
+                removeResult(entry);
+                removed++;
+                break;
+            }
+        }
+    }
+    LWLockRelease(sharedState->lock);
+    return removed;
+}
+
+// -------------------------------------------
+// statistics
+// -------------------------------------------
+
+/*
+ * dst += src - since, since can be NULL
+ */
+static void addCounters(db2Counters *dst, const db2Counters *src, const db2Counters *since)
+{
+    dst->connects += src->connects;
+    dst->connection_hits += src->connection_hits;
+    dst->retries += src->retries;
+    dst->queries += src->queries;
+    dst->fetches += src->fetches;
+    dst->rows += src->rows;
+    dst->bytes += src->bytes;
+    dst->errors += src->errors;
+    INSTR_TIME_ADD(dst->connect_time, src->connect_time);
+    INSTR_TIME_ADD(dst->execute_time, src->execute_time);
+    INSTR_TIME_ADD(dst->fetch_time, src->fetch_time);
+    if (since == NULL)
+    {
+        return;
+    }
+    dst->connects -= since->connects;
+    dst->connection_hits -= since->connection_hits;
+    dst->retries -= since->retries;
+    dst->queries -= since->queries;
+    dst->fetches -= since->fetches;
+    dst->rows -= since->rows;
+    dst->bytes -= since->bytes;
+    dst->errors -= since->errors;
+    INSTR_TIME_SUBTRACT(dst->connect_time, since->connect_time);
+    INSTR_TIME_SUBTRACT(dst->execute_time, since->execute_time);
+    INSTR_TIME_SUBTRACT(dst->fetch_time, since->fetch_time);
+}
+
+/*
+ * Add count to the SQLSTATE in the array, the error stays counted only in the total if the array is full
+ */
+static void addSqlState(db2SqlStateCount *sqlstates, const char *sqlstate, int64 count)
+{
+    int i;
+
+    for (i = 0; i < STAT_SQLSTATES; i++)
+    {
+        if (sqlstates[i].count == 0)
+        {
+            strlcpy(sqlstates[i].sqlstate, sqlstate, sizeof(sqlstates[i].sqlstate));
+        }
+        if (strcmp(sqlstates[i].sqlstate, sqlstate) == 0)
+        {
+            sqlstates[i].count += count;
+            return;
+        }
+    }
+}
+
+/*
+ * Failed ODBC call, the SQLSTATE is empty if the driver did not report any
+ */
+static void countError(db2ConnectionCacheEntry *conn, const char *sqlstate)
+{
+    pthread_mutex_lock(&connLock);
+    conn->stats.errors++;
+    if (*sqlstate != '\0')
+    {
+        addSqlState(conn->sqlstates, sqlstate, 1);
+    }
+    conn->stats_pending = true;
+    pthread_mutex_unlock(&connLock);
+}
+
+/*
+ * Work of the statement since the last report is added to the statistics of its connection
+ */
+static void reportCounters(db2PrivateData *data)
+{
+    pthread_mutex_lock(&connLock);
+    addCounters(&data->conn->stats, &data->counters, &data->reported);
+    data->conn->stats_pending = true;
+    pthread_mutex_unlock(&connLock);
+    data->reported = data->counters;
+}
+
+/*
+ * Entry of server and user mapping of the current database, a new one is created if there is room
+ * stats_lock is held exclusively
+ */
+static db2StatEntry *statEntry(Oid serverid, Oid umid)
+{
+    db2StatEntry *unused = NULL;
+    int i;
+
+    for (i = 0; i < STAT_ENTRIES; i++)
+    {
+        db2StatEntry *se = &sharedState->stats[i];
+
+        if (!se->used)
+        {
+            unused = unused == NULL ? se : unused;
+            continue;
+        }
+        if (se->dbid == MyDatabaseId && se->serverid == serverid && se->umid == umid)
+        {
+            return se;
+        }
+    }
+    if (unused != NULL)
+    {
+        memset(unused, 0, sizeof(db2StatEntry));
+        unused->used = true;
+        unused->dbid = MyDatabaseId;
+        unused->serverid = serverid;
+        unused->umid = umid;
+    }
+    return unused;
+}
+
+/*
+ * Statistics of the backend are added to shared memory at the end of transaction, the catalog
+ * is not read, so it is done after abort as well
+ * Without shared_preload_libraries the statistics are discarded
+ */
+static void flushStats(void)
+{
+    HASH_SEQ_STATUS scan;
+    db2ConnectionCacheEntry *entry;
+
+    if (connectionCache == NULL)
+    {
+        return;
+    }
+    // entries are added only by the backend, the thread changes their fields under connLock
+    hash_seq_init(&scan, connectionCache);
+    while ((entry = (db2ConnectionCacheEntry *)hash_seq_search(&scan)) != NULL)
+    {
+        db2Counters stats;
+        db2SqlStateCount sqlstates[STAT_SQLSTATES];
+        db2StatEntry *se;
+        int i;
+
+        pthread_mutex_lock(&connLock);
+        if (!entry->stats_pending)
+        {
+            pthread_mutex_unlock(&connLock);
+            continue;
+        }
+        stats = entry->stats;
+        memcpy(sqlstates, entry->sqlstates, sizeof(sqlstates));
+        memset(&entry->stats, 0, sizeof(db2Counters));
+        memset(entry->sqlstates, 0, sizeof(entry->sqlstates));
+        entry->stats_pending = false;
+        pthread_mutex_unlock(&connLock);
+
+        if (sharedState == NULL)
+        {
+            continue;
+        }
+        LWLockAcquire(sharedState->stats_lock, LW_EXCLUSIVE);
+        se = statEntry(entry->key.serverid, entry->key.umid);
+        if (se != NULL)
+        {
+            addCounters(&se->counters, &stats, NULL);
+            for (i = 0; i < STAT_SQLSTATES && sqlstates[i].count > 0; i++)
+            {
+                addSqlState(se->sqlstates, sqlstates[i].sqlstate, sqlstates[i].count);
+            }
+        }
+        LWLockRelease(sharedState->stats_lock);
+    }
+}
+
+void _PG_init(void)
+{
+    DefineCustomStringVariable("db2odbc_fdw.preconnect_servers",
+                               "Foreign servers connected in background when the session starts.",
+                               "Comma separated list of server names, connections are opened after the first transaction.",
+                               &preconnectList,
+                               "",
+                               PGC_USERSET,
+                               GUC_LIST_INPUT,
+                               NULL, NULL, NULL);
+    DefineCustomIntVariable("db2odbc_fdw.keepalive_interval",
+                            "Idle DB2 connections are pinged at this interval, broken ones are reopened.",
+                            "Zero disables keepalive.",
+                            &keepaliveInterval,
+                            0, 0, INT_MAX,
+                            PGC_USERSET,
+                            GUC_UNIT_S,
+                            NULL, NULL, NULL);
+    DefineCustomIntVariable("db2odbc_fdw.idle_timeout",
+                            "DB2 connections idle longer than this are closed.",
+                            "Zero keeps the connections open for the whole session.",
+                            &idleTimeout,
+                            0, 0, INT_MAX,
+                            PGC_USERSET,
+                            GUC_UNIT_S,
+                            NULL, NULL, NULL);
+    DefineCustomIntVariable("db2odbc_fdw.result_cache_size",
+                            "Shared memory for results of foreign tables with cache_ttl.",
+                            "Zero disables the cache, it needs the library in shared_preload_libraries.",
+                            &resultCacheSize,
+                            65536, 0, MAX_KILOBYTES,
+                            PGC_SIGHUP,
+                            GUC_UNIT_KB,
+                            NULL, NULL, NULL);
+#if PG_VERSION_NUM >= 150000
+    MarkGUCPrefixReserved("db2odbc_fdw");
+#else
+    EmitWarningsOnPlaceholders("db2odbc_fdw");
+#endif
+    RegisterXactCallback(connectionXactCallback, NULL);
+    RegisterSubXactCallback(connectionSubXactCallback, NULL);
+
+    if (process_shared_preload_libraries_in_progress)
+    {
+#if PG_VERSION_NUM >= 150000
+        prevShmemRequestHook = shmem_request_hook;
+        shmem_request_hook = requestSharedState;
+#else
+        requestSharedState();
+#endif
+        prevShmemStartupHook = shmem_startup_hook;
+        shmem_startup_hook = startupSharedState;
+    }
+}
+
+/*
+ * SQL functions*/
+extern Datum db2odbc_fdw_handler(PG_FUNCTION_ARGS);
+extern Datum db2odbc_fdw_validator(PG_FUNCTION_ARGS);
+extern Datum db2odbc_list_dsns(PG_FUNCTION_ARGS);
+extern Datum db2odbc_cache_invalidate(PG_FUNCTION_ARGS);
+extern Datum db2odbc_stat_servers(PG_FUNCTION_ARGS);
+extern Datum db2odbc_stat_connections(PG_FUNCTION_ARGS);
+extern Datum db2odbc_stat_errors(PG_FUNCTION_ARGS);
+extern Datum db2odbc_stat_reset(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(db2odbc_fdw_handler);
+PG_FUNCTION_INFO_V1(db2odbc_fdw_validator);
+PG_FUNCTION_INFO_V1(db2odbc_list_dsns);
+PG_FUNCTION_INFO_V1(db2odbc_cache_invalidate);
+PG_FUNCTION_INFO_V1(db2odbc_stat_servers);
+PG_FUNCTION_INFO_V1(db2odbc_stat_connections);
+PG_FUNCTION_INFO_V1(db2odbc_stat_errors);
+PG_FUNCTION_INFO_V1(db2odbc_stat_reset);
+
+/*
+ * FDW callback routines
+ */
+static void db2_ExplainForeignScan(ForeignScanState *node,
+                                   ExplainState *es);
+static void db2_BeginForeignScan(ForeignScanState *node,
+                                 int eflags);
+static TupleTableSlot *db2_IterateForeignScan(
+    ForeignScanState *node);
+static void db2_ReScanForeignScan(ForeignScanState *node);
+static void db2_EndForeignScan(ForeignScanState *node);
+static void db2_GetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid);
+static void db2_GetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid);
+static bool db2_AnalyzeForeignTable(Relation relation, AcquireSampleRowsFunc *func, BlockNumber *totalpages);
+static ForeignScan *db2_GetForeignPlan(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid, ForeignPath *best_path, List *tlist, List *scan_clauses, Plan *outer_plan);
+#if PG_VERSION_NUM >= 120000
+static void db2_GetForeignUpperPaths(PlannerInfo *root, UpperRelationKind stage, RelOptInfo *input_rel, RelOptInfo *output_rel, void *extra);
+static void db2_GetForeignJoinPaths(PlannerInfo *root, RelOptInfo *joinrel, RelOptInfo *outerrel, RelOptInfo *innerrel, JoinType jointype, JoinPathExtraData *extra);
+#endif
+static bool db2_IsForeignScanParallelSafe(PlannerInfo *root, RelOptInfo *rel, RangeTblEntry *rte);
+static Size db2_EstimateDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt);
+static void db2_InitializeDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt, void *coordinate);
+static void db2_ReInitializeDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt, void *coordinate);
+static void db2_InitializeWorkerForeignScan(ForeignScanState *node, shm_toc *toc, void *coordinate);
+static int db2_IsForeignRelUpdatable(Relation rel);
+static List *db2_PlanForeignModify(PlannerInfo *root, ModifyTable *plan, Index resultRelation, int subplan_index);
+static void db2_BeginForeignModify(ModifyTableState *mtstate, ResultRelInfo *rinfo, List *fdw_private, int subplan_index, int eflags);
+static TupleTableSlot *db2_ExecForeignInsert(EState *estate, ResultRelInfo *rinfo, TupleTableSlot *slot, TupleTableSlot *planSlot);
+static void db2_EndForeignModify(EState *estate, ResultRelInfo *rinfo);
+static void db2_ExplainForeignModify(ModifyTableState *mtstate, ResultRelInfo *rinfo, List *fdw_private, int subplan_index, ExplainState *es);
+static TupleTableSlot *db2_ExecForeignUpdate(EState *estate, ResultRelInfo *rinfo, TupleTableSlot *slot, TupleTableSlot *planSlot);
+static TupleTableSlot *db2_ExecForeignDelete(EState *estate, ResultRelInfo *rinfo, TupleTableSlot *slot, TupleTableSlot *planSlot);
+static bool db2_PlanDirectModify(PlannerInfo *root, ModifyTable *plan, Index resultRelation, int subplan_index);
+static void db2_BeginDirectModify(ForeignScanState *node, int eflags);
+static TupleTableSlot *db2_IterateDirectModify(ForeignScanState *node);
+static void db2_EndDirectModify(ForeignScanState *node);
+static void db2_ExplainDirectModify(ForeignScanState *node, ExplainState *es);
+#if PG_VERSION_NUM >= 110000
+static void db2_BeginForeignInsert(ModifyTableState *mtstate, ResultRelInfo *rinfo);
+static void db2_EndForeignInsert(EState *estate, ResultRelInfo *rinfo);
+#endif
+#if PG_VERSION_NUM >= 140000
+static int db2_GetForeignModifyBatchSize(ResultRelInfo *rinfo);
+static TupleTableSlot **db2_ExecForeignBatchInsert(EState *estate, ResultRelInfo *rinfo, TupleTableSlot **slots, TupleTableSlot **planSlots, int *numSlots);
+static bool db2_IsForeignPathAsyncCapable(ForeignPath *path);
+static void db2_ForeignAsyncRequest(AsyncRequest *areq);
+static void db2_ForeignAsyncConfigureWait(AsyncRequest *areq);
+static void db2_ForeignAsyncNotify(AsyncRequest *areq);
+#endif
+
+/*
+ * Foreign-data wrapper handler function: return a struct with pointers
+ * to my callback routines.
+ */
+Datum
+    db2odbc_fdw_handler(PG_FUNCTION_ARGS)
+{
+    FdwRoutine *fdwroutine;
+
+    logdebug(__func__);
+    fdwroutine = makeNode(FdwRoutine);
+
+    fdwroutine->ExplainForeignScan = db2_ExplainForeignScan;
+    fdwroutine->BeginForeignScan = db2_BeginForeignScan;
+    fdwroutine->IterateForeignScan = db2_IterateForeignScan;
+    fdwroutine->ReScanForeignScan = db2_ReScanForeignScan;
+    fdwroutine->EndForeignScan = db2_EndForeignScan;
+    fdwroutine->AnalyzeForeignTable = db2_AnalyzeForeignTable;
+
+    fdwroutine->GetForeignRelSize = db2_GetForeignRelSize;
+    fdwroutine->GetForeignPaths = db2_GetForeignPaths;
+    fdwroutine->GetForeignPlan = db2_GetForeignPlan;
+#if PG_VERSION_NUM >= 120000
+    fdwroutine->GetForeignUpperPaths = db2_GetForeignUpperPaths;
+    fdwroutine->GetForeignJoinPaths = db2_GetForeignJoinPaths;
+#endif
+    fdwroutine->IsForeignScanParallelSafe = db2_IsForeignScanParallelSafe;
+    fdwroutine->EstimateDSMForeignScan = db2_EstimateDSMForeignScan;
+    fdwroutine->InitializeDSMForeignScan = db2_InitializeDSMForeignScan;
+    fdwroutine->ReInitializeDSMForeignScan = db2_ReInitializeDSMForeignScan;
+    fdwroutine->InitializeWorkerForeignScan = db2_InitializeWorkerForeignScan;
+    fdwroutine->IsForeignRelUpdatable = db2_IsForeignRelUpdatable;
+    fdwroutine->PlanForeignModify = db2_PlanForeignModify;
+    fdwroutine->BeginForeignModify = db2_BeginForeignModify;
+    fdwroutine->ExecForeignInsert = db2_ExecForeignInsert;
+    fdwroutine->EndForeignModify = db2_EndForeignModify;
+    fdwroutine->ExplainForeignModify = db2_ExplainForeignModify;
+    fdwroutine->ExecForeignUpdate = db2_ExecForeignUpdate;
+    fdwroutine->ExecForeignDelete = db2_ExecForeignDelete;
+    fdwroutine->PlanDirectModify = db2_PlanDirectModify;
+    fdwroutine->BeginDirectModify = db2_BeginDirectModify;
+    fdwroutine->IterateDirectModify = db2_IterateDirectModify;
+    fdwroutine->EndDirectModify = db2_EndDirectModify;
+    fdwroutine->ExplainDirectModify = db2_ExplainDirectModify;
+#if PG_VERSION_NUM >= 110000
+    fdwroutine->BeginForeignInsert = db2_BeginForeignInsert;
+    fdwroutine->EndForeignInsert = db2_EndForeignInsert;
+#endif
+#if PG_VERSION_NUM >= 140000
+    fdwroutine->GetForeignModifyBatchSize = db2_GetForeignModifyBatchSize;
+    fdwroutine->ExecForeignBatchInsert = db2_ExecForeignBatchInsert;
+    fdwroutine->IsForeignPathAsyncCapable = db2_IsForeignPathAsyncCapable;
+    fdwroutine->ForeignAsyncRequest = db2_ForeignAsyncRequest;
+    fdwroutine->ForeignAsyncConfigureWait = db2_ForeignAsyncConfigureWait;
+    fdwroutine->ForeignAsyncNotify = db2_ForeignAsyncNotify;
+#endif
+
+    logdebug("Returning %s", __func__);
+    PG_RETURN_POINTER(fdwroutine);
+}
+
+static const char *get_name(Oid catalog)
+{
+    logdebug(__func__);
+
+    switch (catalog)
+    {
+    case ForeignTableRelationId:
+        return "foreign table";
+    case ForeignServerRelationId:
+        return "foreign data server";
+    case UserMappingRelationId:
+        return "foreing user mapping";
+    case AttributeRelationId:
+        return "foreign table column";
+    }
+    return "unrecognized";
+}
+
+static void createValidOptions(StringInfoData *buf, Oid context)
+{
+    db2FdwOption *opt1;
+
+    logdebug(__func__);
+
+    initStringInfo(buf);
+    for (opt1 = valid_options; opt1->optname; opt1++)
+    {
+        if (context == opt1->optcontext)
+            appendStringInfo(buf, "%s%s", (buf->len > 0) ? ", " : "",
+                             opt1->optname);
+    }
+}
+
+static bool hasOption(List *options_list, const char *name)
+{
+    ListCell *cell;
+
+    foreach (cell, options_list)
+    {
+        if (strcmp(((DefElem *)lfirst(cell))->defname, name) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static long checkPositiveInt(DefElem *def)
+{
+    char *value;
+    char *endp;
+    long l;
+
+    value = defGetString(def);
+    l = strtol(value, &endp, 10);
+    if (*value == '\0' || *endp != '\0' || l <= 0)
+    {
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+                 errmsg("invalid value for option \"%s\": %s", def->defname, value),
+                 errhint("Positive integer value expected")));
+    }
+    return l;
+}
+
+static double checkNonNegativeReal(DefElem *def)
+{
+    char *value;
+    char *endp;
+    double d;
+
+    value = defGetString(def);
+    d = strtod(value, &endp);
+    if (*value == '\0' || *endp != '\0' || d < 0)
+    {
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+                 errmsg("invalid value for option \"%s\": %s", def->defname, value),
+                 errhint("Non-negative number expected")));
+    }
+    return d;
+}
+
+/*
+ * Validate the generic options given to a FOREIGN DATA WRAPPER, SERVER,
+ * USER MAPPING or FOREIGN TABLE that uses file_fdw.
+ *
+ * Raise an ERROR if the option or its value is considered invalid.
+ */
+Datum
+    db2odbc_fdw_validator(PG_FUNCTION_ARGS)
+{
+    List *options_list;
+    Oid context;
+    ListCell *cell;
+    StringInfoData buf;
+    db2FdwOption *opt1;
+    bool found;
+    bool recognized;
+
+    options_list = untransformRelOptions(PG_GETARG_DATUM(0));
+    context = PG_GETARG_OID(1);
+    logdebug("db2_fdw_validator : %s ", get_name(context));
+
+    foreach (cell, options_list)
+    {
+        DefElem *def;
+        const char *option;
+        db2FdwOption *opt;
+        bool valid;
+
+        def = (DefElem *)lfirst(cell);
+        option = defGetString(def);
+        logdebug("%s : %s", def->defname, option);
+        valid = false;
+        recognized = false;
+        // the same option can be valid in more than one context
+        for (opt = valid_options; opt->optname; opt++)
+        {
+            logdebug(opt->optname);
+            if (strcmp(opt->optname, def->defname) == 0)
+            {
+                logdebug("recognized");
+                recognized = true;
+                if (context == opt->optcontext)
+                {
+                    valid = true;
+                    break;
+                }
+            }
+        }
+        if (!valid)
+        {
+            createValidOptions(&buf, context);
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+                     errmsg("invalid option \"%s\" %s", def->defname,
+                            recognized ? "(option name is recognized but is invalid in this context)" : ""),
+                     errhint("Valid options in this context are: %s", buf.len ? buf.data : "<none>")));
+        }
+        if (strcmp(def->defname, FETCHSIZE) == 0 || strcmp(def->defname, LOOKUPBATCHSIZE) == 0 ||
+            strcmp(def->defname, PREFETCH) == 0 || strcmp(def->defname, PARTITIONS) == 0 ||
+            strcmp(def->defname, BATCHSIZE) == 0 || strcmp(def->defname, CACHETTL) == 0)
+        {
+            checkPositiveInt(def);
+        }
+        if (strcmp(def->defname, FDWSTARTUPCOST) == 0 || strcmp(def->defname, FDWTUPLECOST) == 0)
+        {
+            checkNonNegativeReal(def);
+        }
+        if (strcmp(def->defname, USEREMOTEESTIMATE) == 0 || strcmp(def->defname, ASYNCCAPABLE) == 0 ||
+            strcmp(def->defname, AUTOCOMMIT) == 0)
+        {
+            // raises error if not a boolean value
+            defGetBoolean(def);
+        }
+    }
+
+    // second phase, check required
+    for (opt1 = valid_options; opt1->optname; opt1++)
+    {
+        if (!opt1->required)
+        {
+            continue;
+        }
+        if (context != opt1->optcontext)
+        {
+            continue;
+        }
+        logdebug("validate required option %s", opt1->optname);
+        found = false;
+
+        foreach (cell, options_list)
+        {
+            DefElem *def;
+
+            def = (DefElem *)lfirst(cell);
+            if (strcmp(opt1->optname, def->defname) == 0)
+            {
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+        {
+            createValidOptions(&buf, context);
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_OPTION_NAME_NOT_FOUND),
+                     errmsg("option is required: %s", opt1->optname),
+                     errhint("Valid options in this context are: %s", buf.len ? buf.data : "<none>")));
+        }
+    }
+
+    // third phase, source of foreign table rows
+    if (context == ForeignTableRelationId)
+    {
+        bool isquery = hasOption(options_list, QUERY);
+        bool istable = hasOption(options_list, TABLE);
+
+        if (isquery == istable)
+        {
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_OPTION_NAME_NOT_FOUND),
+                     errmsg("either %s or %s option is required", QUERY, TABLE)));
+        }
+        if (isquery && hasOption(options_list, SCHEMA))
+        {
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+                     errmsg("option %s can be used only together with %s", SCHEMA, TABLE)));
+        }
+    }
+
+    PG_RETURN_VOID();
+}
+
+/*
+ * Tuplestore returned by set-returning function in materialize mode
+ */
+static Tuplestorestate *materializeResult(FunctionCallInfo fcinfo, TupleDesc *tupdesc)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+    Tuplestorestate *tupstore;
+    MemoryContext oldcontext;
+
+    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) || !(rsinfo->allowedModes & SFRM_Materialize))
+    {
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("set-valued function called in context that cannot accept a set")));
+    }
+    oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    if (get_call_result_type(fcinfo, NULL, tupdesc) != TYPEFUNC_COMPOSITE)
+    {
+        elog(ERROR, "return type must be a row type");
+    }
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = *tupdesc;
+    MemoryContextSwitchTo(oldcontext);
+    return tupstore;
+}
+
+/*
+ * ODBC data sources known to the driver manager (odbc.ini), for diagnostics
+ */
+Datum
+    db2odbc_list_dsns(PG_FUNCTION_ARGS)
+{
+    TupleDesc tupdesc;
+    Tuplestorestate *tupstore;
+    SQLRETURN ret;
+    char dsn[256];
+    char desc[256];
+    SQLSMALLINT dsn_ret;
+    SQLSMALLINT desc_ret;
+    SQLUSMALLINT direction;
+
+    logdebug(__func__);
+    tupstore = materializeResult(fcinfo, &tupdesc);
+
+    if (connectionCache == NULL)
+    {
+        initConnectionCache();
+    }
+    direction = SQL_FETCH_FIRST;
+    while (SQL_SUCCEEDED(ret = SQLDataSources(odbcEnv, direction,
+                                              (SQLCHAR *)dsn, sizeof(dsn), &dsn_ret,
+                                              (SQLCHAR *)desc, sizeof(desc), &desc_ret)))
+    {
+        Datum values[2];
+        bool nulls[2] = {false, false};
+
+        direction = SQL_FETCH_NEXT;
+        values[0] = CStringGetTextDatum(dsn);
+        values[1] = CStringGetTextDatum(desc);
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+    if (ret != SQL_NO_DATA)
+    {
+        extract_error("SQLDataSources", odbcEnv, SQL_HANDLE_ENV, NULL, NULL);
+    }
+    return (Datum)0;
+}
+
+/*
+ * Remove results of the foreign table from the shared result cache, all results of the database
+ * without argument. Returns the number of removed results
+ */
+Datum
+    db2odbc_cache_invalidate(PG_FUNCTION_ARGS)
+{
+    Oid relid = PG_NARGS() > 0 ? PG_GETARG_OID(0) : InvalidOid;
+
+    logdebug(__func__);
+    PG_RETURN_INT32(invalidateResults(relid));
+}
+
+/*
+ * Copy of statistics entries of the current database, returns their number
+ */
+static int statSnapshot(db2StatEntry **entries)
+{
+    int n = 0;
+    int i;
+
+    if (sharedState == NULL)
+    {
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("db2odbc_fdw statistics are not available"),
+                 errhint("Add db2odbc_fdw to shared_preload_libraries.")));
+    }
+    *entries = (db2StatEntry *)palloc(sizeof(db2StatEntry) * STAT_ENTRIES);
+    LWLockAcquire(sharedState->stats_lock, LW_SHARED);
+    for (i = 0; i < STAT_ENTRIES; i++)
+    {
+        if (sharedState->stats[i].used && sharedState->stats[i].dbid == MyDatabaseId)
+        {
+            (*entries)[n++] = sharedState->stats[i];
+        }
+    }
+    LWLockRelease(sharedState->stats_lock);
+    return n;
+}
+
+/*
+ * Names of the server and of the user of the mapping, NULL if they were dropped
+ * Mapping of another user is NULL too unless all_users is set (superuser or pg_read_all_stats),
+ * the callers skip such entries
+ */
+static char *statServerName(Oid serverid)
+{
+    HeapTuple tuple;
+    char *name;
+
+    tuple = SearchSysCache1(FOREIGNSERVEROID, ObjectIdGetDatum(serverid));
+    if (!HeapTupleIsValid(tuple))
+    {
+        return NULL;
+    }
+    name = pstrdup(NameStr(((Form_pg_foreign_server)GETSTRUCT(tuple))->srvname));
+    ReleaseSysCache(tuple);
+    return name;
+}
+
+static char *statUserName(Oid umid, bool all_users)
+{
+    HeapTuple tuple;
+    Oid userid;
+
+    tuple = SearchSysCache1(USERMAPPINGOID, ObjectIdGetDatum(umid));
+    if (!HeapTupleIsValid(tuple))
+    {
+        return NULL;
+    }
+    userid = ((Form_pg_user_mapping)GETSTRUCT(tuple))->umuser;
+    ReleaseSysCache(tuple);
+    if (!all_users && OidIsValid(userid) && userid != GetUserId())
+    {
+        return NULL;
+    }
+    return OidIsValid(userid) ? GetUserNameFromId(userid, true) : "public";
+}
+
+// counters in the order of output columns of db2odbc_stat_servers() and db2odbc_stat_connections()
+#define STAT_COUNTER_COLUMNS 11
+
+static void statCounterValues(db2Counters *c, Datum *values)
+{
+    values[0] = Int64GetDatum(c->connects);
+    values[1] = Int64GetDatum(c->connection_hits);
+    values[2] = Int64GetDatum(c->retries);
+    values[3] = Int64GetDatum(c->queries);
+    values[4] = Int64GetDatum(c->fetches);
+    values[5] = Int64GetDatum(c->rows);
+    values[6] = Int64GetDatum(c->bytes);
+    values[7] = Int64GetDatum(c->errors);
+    values[8] = Float8GetDatum(INSTR_TIME_GET_MILLISEC(c->connect_time));
+    values[9] = Float8GetDatum(INSTR_TIME_GET_MILLISEC(c->execute_time));
+    values[10] = Float8GetDatum(INSTR_TIME_GET_MILLISEC(c->fetch_time));
+}
+
+/*
+ * Statistics of foreign servers of the current database summed over the user mappings
+ * visible to the caller, the same as in db2odbc_stat_connections()
+ */
+Datum
+    db2odbc_stat_servers(PG_FUNCTION_ARGS)
+{
+    TupleDesc tupdesc;
+    Tuplestorestate *tupstore;
+    db2StatEntry *entries;
+    bool all_users = has_privs_of_role(GetUserId(), ROLE_PG_READ_ALL_STATS);
+    int n;
+    int i;
+    int j;
+
+    logdebug(__func__);
+    tupstore = materializeResult(fcinfo, &tupdesc);
+    n = statSnapshot(&entries);
+    for (i = 0; i < n; i++)
+    {
+        if (statUserName(entries[i].umid, all_users) == NULL)
+        {
+            entries[i].used = false;
+        }
+    }
+    // the first entry of the server gets counters of the others
+    for (i = 0; i < n; i++)
+    {
+        Datum values[STAT_COUNTER_COLUMNS + 1];
+        bool nulls[STAT_COUNTER_COLUMNS + 1] = {false};
+        char *server;
+
+        if (!entries[i].used)
+        {
+            continue;
+        }
+        for (j = i + 1; j < n; j++)
+        {
+            if (entries[j].used && entries[j].serverid == entries[i].serverid)
+            {
+                addCounters(&entries[i].counters, &entries[j].counters, NULL);
+                entries[j].used = false;
+            }
+        }
+        server = statServerName(entries[i].serverid);
+        if (server == NULL)
+        {
+            continue;
+        }
+        values[0] = CStringGetTextDatum(server);
+        statCounterValues(&entries[i].counters, values + 1);
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+    return (Datum)0;
+}
+
+/*
+ * Statistics of every server and user mapping of the current database
+ * Other users see only their own and PUBLIC mappings
+ */
+Datum
+    db2odbc_stat_connections(PG_FUNCTION_ARGS)
+{
+    TupleDesc tupdesc;
+    Tuplestorestate *tupstore;
+    db2StatEntry *entries;
+    bool all_users = has_privs_of_role(GetUserId(), ROLE_PG_READ_ALL_STATS);
+    int n;
+    int i;
+
+    logdebug(__func__);
+    tupstore = materializeResult(fcinfo, &tupdesc);
+    n = statSnapshot(&entries);
+    for (i = 0; i < n; i++)
+    {
+        Datum values[STAT_COUNTER_COLUMNS + 2];
+        bool nulls[STAT_COUNTER_COLUMNS + 2] = {false};
+        char *server = statServerName(entries[i].serverid);
+        char *user = statUserName(entries[i].umid, all_users);
+
+        if (server == NULL || user == NULL)
+        {
+            continue;
+        }
+        values[0] = CStringGetTextDatum(server);
+        values[1] = CStringGetTextDatum(user);
+        statCounterValues(&entries[i].counters, values + 2);
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+    return (Datum)0;
+}
+
+/*
+ * Errors reported by the driver counted by SQLSTATE for every server and user mapping
+ * Visible to the same users as db2odbc_stat_connections()
+ */
+Datum
+    db2odbc_stat_errors(PG_FUNCTION_ARGS)
+{
+    TupleDesc tupdesc;
+    Tuplestorestate *tupstore;
+    db2StatEntry *entries;
+    bool all_users = has_privs_of_role(GetUserId(), ROLE_PG_READ_ALL_STATS);
+    int n;
+    int i;
+    int j;
+
+    logdebug(__func__);
+    tupstore = materializeResult(fcinfo, &tupdesc);
+    n = statSnapshot(&entries);
+    for (i = 0; i < n; i++)
+    {
+        char *server = statServerName(entries[i].serverid);
+        char *user = statUserName(entries[i].umid, all_users);
+
+        if (server == NULL || user == NULL)
+        {
+            continue;
+        }
+        for (j = 0; j < STAT_SQLSTATES && entries[i].sqlstates[j].count > 0; j++)
+        {
+            Datum values[4];
+            bool nulls[4] = {false, false, false, false};
+
+            values[0] = CStringGetTextDatum(server);
+            values[1] = CStringGetTextDatum(user);
+            values[2] = CStringGetTextDatum(entries[i].sqlstates[j].sqlstate);
+            values[3] = Int64GetDatum(entries[i].sqlstates[j].count);
+            tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+        }
+    }
+    return (Datum)0;
+}
+
+/*
+ * Remove statistics of the current database
+ */
+Datum
+    db2odbc_stat_reset(PG_FUNCTION_ARGS)
+{
+    int i;
+
+    logdebug(__func__);
+    if (sharedState == NULL)
+    {
+        PG_RETURN_VOID();
+    }
+    LWLockAcquire(sharedState->stats_lock, LW_EXCLUSIVE);
+    for (i = 0; i < STAT_ENTRIES; i++)
+    {
+        if (sharedState->stats[i].dbid == MyDatabaseId)
+        {
+            sharedState->stats[i].used = false;
+        }
+    }
+    LWLockRelease(sharedState->stats_lock);
+    PG_RETURN_VOID();
+}
+
+/*
+ * Report diagnostics of failed ODBC call as notices, the error is counted in statistics of conn
+ * by the first SQLSTATE reported
+ */
+static void extract_error(char *fn,
+                          SQLHANDLE handle,
+                          SQLSMALLINT type,
+                          SQLINTEGER *outnative,
+                          db2ConnectionCacheEntry *conn)
+{
+    SQLINTEGER i = 0;
+    SQLINTEGER native;
+    SQLCHAR state[7];
+    SQLCHAR text[256];
+    SQLSMALLINT len;
+    SQLRETURN ret;
+    char sqlstate[6] = "";
+
+    logdebug(__func__);
+    elog(NOTICE,
+         "\n"
+         "The driver reported the following diagnostics while running "
+         "%s\n",
+         fn);
+
+    if (outnative != NULL)
+    {
+        *outnative = ANYERROR;
+    }
+    do
+    {
+        ret = SQLGetDiagRec(type, handle, ++i, state, &native, text,
+                            sizeof(text), &len);
+        if (SQL_SUCCEEDED(ret))
+        {
+            elog(NOTICE, "SQLSTATE:%s : %ld : %ld : %s\n", state, (long int)i, (long int)native, text);
+            if (outnative != NULL && *outnative == ANYERROR)
+            {
+                *outnative = native;
+            }
+            if (sqlstate[0] == '\0')
+            {
+                strlcpy(sqlstate, (char *)state, sizeof(sqlstate));
+            }
+        }
+    } while (ret == SQL_SUCCESS);
+    if (conn != NULL)
+    {
+        countError(conn, sqlstate);
+    }
+}
+
+/*
+ * Adds time elapsed since start to the counter, safe to call from the async and prefetch threads
+ */
+static void accumTime(instr_time *counter, instr_time start)
+{
+    instr_time now;
+
+    INSTR_TIME_SET_CURRENT(now);
+    INSTR_TIME_ACCUM_DIFF(*counter, now, start);
+}
+
+/*
+ * Options of the foreign table used by the executor, scans resolve them at plan time
+ * Returns the server of the table
+ */
+static Oid getScanOptions(Oid foreigntableid, long *fetch_size, long *prefetch, char **cached)
+{
+    ForeignTable *table;
+    ForeignServer *server;
+    List *options;
+    ListCell *lc;
+
+    logdebug(__func__);
+    table = GetForeignTable(foreigntableid);
+    server = GetForeignServer(table->serverid);
+
+    *fetch_size = DEFAULT_FETCH_SIZE;
+    *prefetch = 0;
+    *cached = NULL;
+
+    // table options come after server options, table level wins
+    options = list_concat(list_copy(server->options), table->options);
+    foreach (lc, options)
+    {
+        DefElem *def = (DefElem *)lfirst(lc);
+        if (strcmp(def->defname, CACHED) == 0)
+        {
+            *cached = defGetString(def);
+            logdebug("CACHED: %s", *cached);
+            continue;
+        }
+        if (strcmp(def->defname, FETCHSIZE) == 0)
+        {
+            *fetch_size = checkPositiveInt(def);
+            logdebug("FETCHSIZE: %ld", *fetch_size);
+            continue;
+        }
+        if (strcmp(def->defname, PREFETCH) == 0)
+        {
+            *prefetch = checkPositiveInt(def);
+            logdebug("PREFETCH: %ld", *prefetch);
+            continue;
+        }
+    }
+    return server->serverid;
+}
+
+/*
+ * Take the cached connection of the server for the current user, options not resolved by the planner
+ * are read from the foreign table. Connection options are read only when it has to be opened
+ */
+static void getConnection(db2PrivateData *data, Oid foreigntableid)
+{
+    UserMapping *mapping;
+    db2ConnectionCacheEntry *entry;
+    bool exclusive;
+
+    logdebug(__func__);
+    if (!OidIsValid(data->serverid))
+    {
+        data->serverid = getScanOptions(foreigntableid, &data->fetch_size, &data->prefetch_slots, &data->cached);
+    }
+    mapping = GetUserMapping(GetUserId(), data->serverid);
+
+    entry = lookupConnection(data->serverid, mapping->umid);
+    // connection taken by the statement is not touched by the maintenance thread
+    lockConnection(entry);
+    exclusive = entry->refs == 0;
+    entry->refs++;
+    entry->connect_pending = false;
+    pthread_mutex_unlock(&connLock);
+    data->conn = entry;
+    data->ref = (db2ConnectionRef *)MemoryContextAllocZero(TopTransactionContext, sizeof(db2ConnectionRef));
+    data->ref->entry = entry;
+    data->ref->level = GetCurrentTransactionNestLevel();
+    data->ref->next = connectionRefs;
+    connectionRefs = data->ref;
+
+    // statements of other scans are bound to the connection, it can be replaced only when not in use
+    if (entry->dbc != NULL && exclusive && (entry->invalidated || isConnectionDead(entry->dbc)))
+    {
+        disconnectEntry(entry);
+    }
+    data->conn_used = true;
+    data->conn_reused = entry->dbc != NULL;
+    if (data->conn_reused)
+    {
+        data->counters.connection_hits++;
+    }
+    if (entry->dbc == NULL)
+    {
+        ForeignServer *server = GetForeignServer(data->serverid);
+        List *options;
+        ListCell *lc;
+        char *dsn = NULL;
+        char *username = NULL;
+        char *password = NULL;
+        instr_time start;
+
+        INSTR_TIME_SET_CURRENT(start);
+
+        options = list_concat(list_copy(server->options), mapping->options);
+        foreach (lc, options)
+        {
+            DefElem *def = (DefElem *)lfirst(lc);
+            if (strcmp(def->defname, DSN) == 0)
+            {
+                dsn = defGetString(def);
+                logdebug("DSN: %s", dsn);
+            }
+            if (strcmp(def->defname, USERNAME) == 0)
+            {
+                username = defGetString(def);
+                logdebug("USERNAME: %s", username);
+            }
+            if (strcmp(def->defname, PASSWORD) == 0)
+            {
+                password = defGetString(def);
+            }
+        }
+        connectEntry(entry, dsn, username, password);
+        accumTime(&data->counters.connect_time, start);
+        data->counters.connects++;
+    }
+    else
+    {
+        logdebug("Connection data received from cache");
+    }
+    data->dbc = entry->dbc;
+    if (data->write)
+    {
+        beginRemoteXact(data);
+    }
+    wakeMaintenance(false);
+}
+
+/*
+ * Statement does not use the connection any longer, it stays open for next statements
+ */
+static void closeConnection(db2PrivateData *data)
+{
+    if (data->conn == NULL)
+    {
+        return;
+    }
+    reportCounters(data);
+    // reference released by abort of subtransaction is not in the list any longer
+    if (data->ref->entry != NULL)
+    {
+        db2ConnectionRef **prev = &connectionRefs;
+
+        while (*prev != data->ref)
+        {
+            prev = &(*prev)->next;
+        }
+        *prev = data->ref->next;
+        pthread_mutex_lock(&connLock);
+        if (data->conn->refs > 0 && --data->conn->refs == 0)
+        {
+            data->conn->last_used = time(NULL);
+        }
+        pthread_mutex_unlock(&connLock);
+    }
+    data->conn = NULL;
+    data->ref = NULL;
+}
+
+/*
+ * Statement failed on broken connection, it is reopened when no other statement uses it
+ */
+static void discardConnection(db2PrivateData *data)
+{
+    releaseStatement(data);
+    if (data->conn != NULL)
+    {
+        pthread_mutex_lock(&connLock);
+        data->conn->invalidated = true;
+        pthread_mutex_unlock(&connLock);
+    }
+    closeConnection(data);
+}
+
+// -------------------------------------------
+// column binding and conversion
+// -------------------------------------------
+
+/*
+ * C type to bind the column with, SQL_C_CHAR if value is to be passed through
+ * the type input function
+ */
+static SQLSMALLINT chooseCType(SQLSMALLINT sqltype, Oid pgtype, int32 typmod, SQLULEN columnsize)
+{
+    switch (sqltype)
+    {
+    case SQL_SMALLINT:
+        if (pgtype == INT2OID || pgtype == INT4OID || pgtype == INT8OID)
+            return SQL_C_SSHORT;
+        break;
+    case SQL_INTEGER:
+        if (pgtype == INT4OID || pgtype == INT8OID)
+            return SQL_C_SLONG;
+        break;
+    case SQL_BIGINT:
+        if (pgtype == INT8OID)
+            return SQL_C_SBIGINT;
+        break;
+    case SQL_REAL:
+        // float8 target gets the text, widened binary value would show digits DB2 never printed
+        if (pgtype == FLOAT4OID)
+            return SQL_C_FLOAT;
+        break;
+    case SQL_FLOAT:
+    case SQL_DOUBLE:
+        if (pgtype == FLOAT8OID)
+            return SQL_C_DOUBLE;
+        break;
+    case SQL_TYPE_DATE:
+        if (pgtype == DATEOID)
+            return SQL_C_TYPE_DATE;
+        break;
+    case SQL_TYPE_TIMESTAMP:
+        // typmod rounding is left to the input function
+        if (pgtype == TIMESTAMPOID && typmod < 0)
+            return SQL_C_TYPE_TIMESTAMP;
+        break;
+    case SQL_DECIMAL:
+    case SQL_NUMERIC:
+        if (pgtype == NUMERICOID && columnsize <= 38)
+            return SQL_C_NUMERIC;
+        break;
+    case SQL_BINARY:
+    case SQL_VARBINARY:
+    case SQL_LONGVARBINARY:
+    case DB2_SQL_BLOB:
+        if (pgtype == BYTEAOID)
+            return SQL_C_BINARY;
+        break;
+    }
+    return SQL_C_CHAR;
+}
+
+/*
+ * LOB or column too wide to be bound, its size is bounded only by the actual value
+ */
+static bool isLongColumn(db2ResultColumn *desc)
+{
+    switch (desc->sqltype)
+    {
+    case SQL_LONGVARCHAR:
+    case SQL_WLONGVARCHAR:
+    case SQL_LONGVARBINARY:
+    case DB2_SQL_BLOB:
+    case DB2_SQL_CLOB:
+    case DB2_SQL_DBCLOB:
+    case DB2_SQL_XML:
+        return true;
+    }
+    // size not reported by the driver
+    return desc->columnsize == 0 || Max(desc->displaysize, (SQLLEN)desc->columnsize) > MAX_BOUND_COLUMN_SIZE;
+}
+
+static SQLLEN sizeOfCType(SQLSMALLINT ctype)
+{
+    switch (ctype)
+    {
+    case SQL_C_SSHORT:
+        return sizeof(SQLSMALLINT);
+    case SQL_C_SLONG:
+        return sizeof(SQLINTEGER);
+    case SQL_C_SBIGINT:
+        return sizeof(SQLBIGINT);
+    case SQL_C_FLOAT:
+        return sizeof(SQLREAL);
+    case SQL_C_DOUBLE:
+        return sizeof(SQLDOUBLE);
+    case SQL_C_TYPE_DATE:
+        return sizeof(SQL_DATE_STRUCT);
+    case SQL_C_TYPE_TIMESTAMP:
+        return sizeof(SQL_TIMESTAMP_STRUCT);
+    case SQL_C_NUMERIC:
+        return sizeof(SQL_NUMERIC_STRUCT);
+    }
+    return 0;
+}
+
+/*
+ * Allocate fetch_size row buffer for column and bind it
+ * Returns false if driver refused the binding
+ */
+static bool bindColumn(db2PrivateData *data, int i, SQLSMALLINT ctype, SQLLEN width, SQLSMALLINT scale)
+{
+    db2ColumnDesc *col = &data->columnsbuf[i];
+    SQLRETURN ret;
+
+    logdebug(__func__);
+    col->width = width;
+    col->buf = palloc(col->width * data->fetch_size);
+    col->indicator = palloc(sizeof(SQLLEN) * data->fetch_size);
+    ret = SQLBindCol(data->stmt, i + 1, ctype, col->buf, col->width, col->indicator);
+    if (SQL_SUCCEEDED(ret) && ctype == SQL_C_NUMERIC)
+    {
+        // default scale for SQL_C_NUMERIC is 0, precision and scale should be set in ARD
+        // data pointer is set last, it triggers the consistency check
+        SQLHDESC ard;
+        ret = SQLGetStmtAttr(data->stmt, SQL_ATTR_APP_ROW_DESC, &ard, 0, NULL);
+        if (SQL_SUCCEEDED(ret))
+            ret = SQLSetDescField(ard, i + 1, SQL_DESC_TYPE, (SQLPOINTER)SQL_C_NUMERIC, 0);
+        if (SQL_SUCCEEDED(ret))
+            ret = SQLSetDescField(ard, i + 1, SQL_DESC_PRECISION, (SQLPOINTER)(SQLLEN)col->columnsize, 0);
+        if (SQL_SUCCEEDED(ret))
+            ret = SQLSetDescField(ard, i + 1, SQL_DESC_SCALE, (SQLPOINTER)(SQLLEN)scale, 0);
+        if (SQL_SUCCEEDED(ret))
+            ret = SQLSetDescField(ard, i + 1, SQL_DESC_DATA_PTR, col->buf, 0);
+    }
+    if (!SQL_SUCCEEDED(ret))
+    {
+        logdebug("SQLBindCol failed for C type %d", ctype);
+        pfree(col->buf);
+        pfree(col->indicator);
+        if (ctype != SQL_C_CHAR)
+        {
+            // unbind, column can be bound again as text
+            SQLBindCol(data->stmt, i + 1, SQL_C_CHAR, NULL, 0, NULL);
+        }
+        return false;
+    }
+    return true;
+}
+
+/*
+ * SQL_NUMERIC_STRUCT keeps unscaled value as little endian 128 bit integer
+ */
+static char *numericToCString(SQL_NUMERIC_STRUCT *num)
+{
+    unsigned char val[SQL_MAX_NUMERIC_LEN];
+    char digits[64];
+    int nd = 0;
+    int scale = num->scale;
+    bool zero;
+    int j;
+    StringInfoData buf;
+
+    memcpy(val, num->val, SQL_MAX_NUMERIC_LEN);
+    // extract decimal digits, least significant first
+    do
+    {
+        int rem = 0;
+        zero = true;
+        for (j = SQL_MAX_NUMERIC_LEN - 1; j >= 0; j--)
+        {
+            int cur = rem * 256 + val[j];
+            val[j] = cur / 10;
+            rem = cur % 10;
+            if (val[j] != 0)
+                zero = false;
+        }
+        digits[nd++] = '0' + rem;
+    } while (!zero && nd < (int)sizeof(digits));
+    while (nd <= scale)
+    {
+        digits[nd++] = '0';
+    }
+
+    initStringInfo(&buf);
+    if (num->sign == 0)
+        appendStringInfoChar(&buf, '-');
+    for (j = nd - 1; j >= 0; j--)
+    {
+        if (j == scale - 1)
+            appendStringInfoChar(&buf, '.');
+        appendStringInfoChar(&buf, digits[j]);
+    }
+    for (j = scale; j < 0; j++)
+    {
+        appendStringInfoChar(&buf, '0');
+    }
+    return buf.data;
+}
+
+/*
+ * Value received as text converted by the input function of the attribute
+ */
+static Datum textToDatum(db2PrivateData *data, db2ColumnDesc *col, char *p)
+{
+    AttInMetadata *attinmeta = data->attinmeta;
+
+    if (col->isNumber)
+    {
+        char *c;
+        logdebug("Decimal type, replace , with .");
+        while ((c = strrchr(p, ',')))
+        {
+            *c = '.';
+        }
+    }
+    return InputFunctionCall(&attinmeta->attinfuncs[col->attnum], p,
+                             attinmeta->attioparams[col->attnum], attinmeta->atttypmods[col->attnum]);
+}
+
+/*
+ * Convert column value of the row in the row array to Datum
+ */
+static Datum convertColumn(db2PrivateData *data, int i, SQLULEN row)
+{
+    db2ColumnDesc *col = &data->columnsbuf[i];
+    char *p = col->buf + row * col->width;
+    AttInMetadata *attinmeta = data->attinmeta;
+    Oid pgtype = TupleDescAttr(attinmeta->tupdesc, col->attnum)->atttypid;
+
+    switch (col->ctype)
+    {
+    case SQL_C_SSHORT:
+    {
+        SQLSMALLINT v = *(SQLSMALLINT *)p;
+        if (pgtype == INT2OID)
+            return Int16GetDatum(v);
+        if (pgtype == INT4OID)
+            return Int32GetDatum(v);
+        return Int64GetDatum(v);
+    }
+    case SQL_C_SLONG:
+    {
+        SQLINTEGER v = *(SQLINTEGER *)p;
+        if (pgtype == INT4OID)
+            return Int32GetDatum(v);
+        return Int64GetDatum(v);
+    }
+    case SQL_C_SBIGINT:
+        return Int64GetDatum(*(SQLBIGINT *)p);
+    case SQL_C_FLOAT:
+        return Float4GetDatum(*(SQLREAL *)p);
+    case SQL_C_DOUBLE:
+        return Float8GetDatum(*(SQLDOUBLE *)p);
+    case SQL_C_TYPE_DATE:
+    {
+        SQL_DATE_STRUCT *d = (SQL_DATE_STRUCT *)p;
+        return DateADTGetDatum(date2j(d->year, d->month, d->day) - POSTGRES_EPOCH_JDATE);
+    }
+    case SQL_C_TYPE_TIMESTAMP:
+    {
+        SQL_TIMESTAMP_STRUCT *ts = (SQL_TIMESTAMP_STRUCT *)p;
+        struct pg_tm tm;
+        Timestamp result;
+
+        memset(&tm, 0, sizeof(tm));
+        tm.tm_year = ts->year;
+        tm.tm_mon = ts->month;
+        tm.tm_mday = ts->day;
+        tm.tm_hour = ts->hour;
+        tm.tm_min = ts->minute;
+        tm.tm_sec = ts->second;
+        // fraction is in nanoseconds, rounded like the text input of TIMESTAMP(12) would be,
+        // 999999500 and more carries into the next second
+        if (tm2timestamp(&tm, (ts->fraction + 500) / 1000, NULL, &result) != 0)
+        {
+            ereport(ERROR,
+                    (errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+                     errmsg("timestamp out of range")));
+        }
+        return TimestampGetDatum(result);
+    }
+    case SQL_C_NUMERIC:
+        return InputFunctionCall(&attinmeta->attinfuncs[col->attnum], numericToCString((SQL_NUMERIC_STRUCT *)p),
+                                 attinmeta->attioparams[col->attnum], attinmeta->atttypmods[col->attnum]);
+    case SQL_C_BINARY:
+    {
+        SQLLEN len = col->indicator[row];
+        bytea *result = (bytea *)palloc(len + VARHDRSZ);
+
+        SET_VARSIZE(result, len + VARHDRSZ);
+        memcpy(VARDATA(result), p, len);
+        return PointerGetDatum(result);
+    }
+    }
+
+    logdebug("GetData %s %u", p, i);
+    return textToDatum(data, col, p);
+}
+
+/*
+ * Value of unbound column of the current row read by SQLGetData in parts
+ * The buffer grows by the length reported by the driver, so memory is bounded by the value and not
+ * by the declared size of the column. bytea received as binary is built in place
+ * Returns false for NULL
+ */
+static bool streamColumn(db2PrivateData *data, int i, Datum *value)
+{
+    db2ColumnDesc *col = &data->columnsbuf[i];
+    bool binary = col->ctype == SQL_C_BINARY;
+    StringInfoData buf;
+    SQLRETURN ret;
+    SQLLEN ind;
+    instr_time start;
+
+    INSTR_TIME_SET_CURRENT(start);
+    initStringInfo(&buf);
+    if (binary)
+    {
+        // varlena header is set when the length is known
+        appendStringInfoSpaces(&buf, VARHDRSZ);
+    }
+    for (;;)
+    {
+        // character data is terminated by null, binary data keeps the byte for it free
+        SQLLEN avail = buf.maxlen - buf.len - (binary ? 1 : 0);
+        SQLLEN got;
+
+        ret = SQLGetData(data->stmt, i + 1, col->ctype, buf.data + buf.len, avail, &ind);
+        // the previous part was the last one
+        if (ret == SQL_NO_DATA)
+        {
+            break;
+        }
+        if (!SQL_SUCCEEDED(ret))
+        {
+            extract_error("SQLGetData", data->stmt, SQL_HANDLE_STMT, NULL, data->conn);
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("Cannot read column %d of query %s", i + 1, data->query)));
+        }
+        if (ind == SQL_NULL_DATA)
+        {
+            accumTime(&data->counters.fetch_time, start);
+            return false;
+        }
+        got = binary ? avail : avail - 1;
+        // ind is the length remaining before this call
+        if (ind != SQL_NO_TOTAL && ind <= got)
+        {
+            buf.len += ind;
+            break;
+        }
+        buf.len += got;
+        enlargeStringInfo(&buf, ind != SQL_NO_TOTAL ? ind - got : buf.maxlen);
+    }
+    buf.data[buf.len] = '\0';
+    accumTime(&data->counters.fetch_time, start);
+    data->counters.bytes += binary ? buf.len - VARHDRSZ : buf.len;
+    logdebug("Column %d streamed, %d bytes", i + 1, buf.len);
+    if (binary)
+    {
+        SET_VARSIZE(buf.data, buf.len);
+        *value = PointerGetDatum(buf.data);
+    }
+    else
+    {
+        *value = textToDatum(data, col, buf.data);
+    }
+    return true;
+}
+
+// -------------------------------------------
+// parameters
+// -------------------------------------------
+
+/*
+ * Evaluate expressions for parameter markers of remote query
+ */
+static void prepareParams(ForeignScanState *node, db2PrivateData *data, List *fdw_exprs)
+{
+    ListCell *lc;
+    int i = 0;
+
+    logdebug(__func__);
+    data->no_params = list_length(fdw_exprs);
+    data->param_exprs = NIL;
+    if (data->no_params == 0)
+    {
+        return;
+    }
+    data->param_values = palloc(sizeof(char *) * data->no_params);
+    data->param_ind = palloc(sizeof(SQLLEN) * data->no_params);
+    data->param_types = palloc(sizeof(Oid) * data->no_params);
+    foreach (lc, fdw_exprs)
+    {
+        data->param_types[i] = exprType((Node *)lfirst(lc));
+        // other parameters are scalars of shippable types
+        if (type_is_array(data->param_types[i]))
+        {
+            data->batch_param = i;
+        }
+        i++;
+    }
+    data->param_exprs = ExecInitExprList(fdw_exprs, (PlanState *)node);
+    data->paramcontext = AllocSetContextCreate(node->ss.ps.state->es_query_cxt,
+                                               "db2odbc_fdw parameter values",
+                                               ALLOCSET_SMALL_SIZES);
+    if (data->batch_param >= 0)
+    {
+        data->batch_ind = palloc(sizeof(SQLLEN) * data->batch_size);
+        data->batchcontext = AllocSetContextCreate(node->ss.ps.state->es_query_cxt,
+                                                   "db2odbc_fdw batch values",
+                                                   ALLOCSET_DEFAULT_SIZES);
+    }
+}
+
+static int compareBatchValues(const void *a, const void *b, void *arg)
+{
+    return DatumGetInt32(FunctionCall2((FmgrInfo *)arg, *(const Datum *)a, *(const Datum *)b));
+}
+
+/*
+ * Elements of col = ANY(array) parameter as text, sorted and without NULL and duplicates
+ * Every element is sent in exactly one batch, so no row is returned twice
+ */
+static void evaluateBatch(db2PrivateData *data, Datum value)
+{
+    ArrayType *array;
+    Oid elemtype;
+    int16 typlen;
+    bool typbyval;
+    char typalign;
+    Datum *elems;
+    bool *nulls;
+    int n, i, count;
+    TypeCacheEntry *typentry;
+    MemoryContext oldcontext;
+
+    MemoryContextReset(data->batchcontext);
+    oldcontext = MemoryContextSwitchTo(data->batchcontext);
+    array = DatumGetArrayTypeP(value);
+    elemtype = ARR_ELEMTYPE(array);
+    get_typlenbyvalalign(elemtype, &typlen, &typbyval, &typalign);
+    deconstruct_array(array, elemtype, typlen, typbyval, typalign, &elems, &nulls, &n);
+    count = 0;
+    for (i = 0; i < n; i++)
+    {
+        if (!nulls[i])
+        {
+            elems[count++] = elems[i];
+        }
+    }
+    typentry = lookup_type_cache(elemtype, TYPECACHE_CMP_PROC_FINFO);
+    qsort_arg(elems, count, sizeof(Datum), compareBatchValues, &typentry->cmp_proc_finfo);
+    data->batch_values = palloc(sizeof(char *) * Max(count, 1));
+    data->batch_count = 0;
+    for (i = 0; i < count; i++)
+    {
+        if (i > 0 && compareBatchValues(&elems[i - 1], &elems[i], &typentry->cmp_proc_finfo) == 0)
+        {
+            continue;
+        }
+        data->batch_values[data->batch_count++] = db2ValueText(elems[i], elemtype);
+    }
+    data->batch_pos = 0;
+    logdebug("Batched parameter: %d values, %d per batch", data->batch_count, data->batch_size);
+    MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+ * Current values of parameters as text, evaluated before every execution
+ * The values are kept in paramcontext until the next evaluation, asynchronous SQLExecute reads them later
+ */
+static void evaluateParams(ForeignScanState *node, db2PrivateData *data)
+{
+    ExprContext *econtext = node->ss.ps.ps_ExprContext;
+    MemoryContext oldcontext;
+    ListCell *lc;
+    int i = 0;
+
+    logdebug(__func__);
+    if (data->no_params == 0)
+    {
+        return;
+    }
+    MemoryContextReset(data->paramcontext);
+    oldcontext = MemoryContextSwitchTo(data->paramcontext);
+    foreach (lc, data->param_exprs)
+    {
+        ExprState *expr_state = (ExprState *)lfirst(lc);
+        Datum value;
+        bool isnull;
+
+        value = ExecEvalExpr(expr_state, econtext, &isnull);
+        if (i == data->batch_param)
+        {
+            if (isnull)
+            {
+                // col = ANY(NULL) is never true, one batch of NULL markers
+                MemoryContextReset(data->batchcontext);
+                data->batch_count = 0;
+                data->batch_pos = 0;
+            }
+            else
+            {
+                evaluateBatch(data, value);
+            }
+            i++;
+            continue;
+        }
+        if (isnull)
+        {
+            data->param_values[i] = NULL;
+            data->param_ind[i] = SQL_NULL_DATA;
+        }
+        else
+        {
+            data->param_values[i] = db2ValueText(value, data->param_types[i]);
+            data->param_ind[i] = SQL_NTS;
+        }
+        logdebug("Parameter %d : %s", i + 1, data->param_values[i] == NULL ? "NULL" : data->param_values[i]);
+        i++;
+    }
+    MemoryContextSwitchTo(oldcontext);
+}
+
+static void bindParam(db2PrivateData *data, SQLUSMALLINT marker, char *value, SQLLEN *ind)
+{
+    SQLRETURN ret;
+    SQLULEN len = value == NULL ? 1 : strlen(value) + 1;
+
+    ret = SQLBindParameter(data->stmt, marker, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_VARCHAR,
+                           len, 0, value, len, ind);
+    if (!SQL_SUCCEEDED(ret))
+    {
+        extract_error("SQLBindParameter", data->stmt, SQL_HANDLE_STMT, NULL, data->conn);
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Cannot bind parameter %d for query %s", marker, data->query)));
+    }
+}
+
+/*
+ * Bind text values of parameters, the markers in remote query are casted to the target type
+ * Batched parameter takes batch_size markers, the current batch starts at batch_pos
+ */
+static void bindParams(db2PrivateData *data)
+{
+    SQLUSMALLINT marker = 1;
+    int i, j;
+
+    for (i = 0; i < data->no_params; i++)
+    {
+        if (i != data->batch_param)
+        {
+            bindParam(data, marker++, data->param_values[i], &data->param_ind[i]);
+            continue;
+        }
+        for (j = 0; j < data->batch_size; j++)
+        {
+            int k = data->batch_pos + j;
+            // the last batch is filled up with NULL, it matches nothing
+            char *value = k < data->batch_count ? data->batch_values[k] : NULL;
+
+            data->batch_ind[j] = value == NULL ? SQL_NULL_DATA : SQL_NTS;
+            bindParam(data, marker++, value, &data->batch_ind[j]);
+        }
+    }
+    if (data->slices > 0)
+    {
+        snprintf(data->slice_value, sizeof(data->slice_value), "%d", data->slice);
+        data->slice_ind = SQL_NTS;
+        bindParam(data, marker++, data->slice_value, &data->slice_ind);
+    }
+}
+
+/*
+ * fileExplainForeignScan
+ *		Produce extra output for EXPLAIN
+ */
+static void
+db2_ExplainForeignScan(ForeignScanState *node, ExplainState *es)
+{
+    ForeignScan *fsplan = (ForeignScan *)node->ss.ps.plan;
+    db2PrivateData *data = (db2PrivateData *)node->fdw_state;
+    int cache_ttl = intVal(list_nth(fsplan->fdw_private, FdwScanPrivateCacheTtl));
+
+    logdebug(__func__);
+    ExplainPropertyText("Remote SQL", strVal(list_nth(fsplan->fdw_private, FdwScanPrivateSelectSql)), es);
+    // rows per SQLFetch, reduced to 1 by execution if a LOB column is streamed
+    ExplainPropertyInteger("Fetch Size", NULL, data->fetch_size, es);
+    if (es->verbose && cache_ttl > 0)
+    {
+        ExplainPropertyInteger("Result Cache TTL", "s", cache_ttl, es);
+    }
+    if (!es->analyze)
+    {
+        return;
+    }
+    // counters are summed over all executions of the node
+    if (data->conn_used)
+    {
+        ExplainPropertyText("Connection", data->conn_reused ? "cached" : "new", es);
+    }
+    if (data->cache_ttl > 0)
+    {
+        ExplainPropertyInteger("Result Cache Hits", NULL, data->cache_hits, es);
+    }
+    ExplainPropertyInteger("Remote Executions", NULL, data->counters.queries, es);
+    ExplainPropertyInteger("Remote Rows", NULL, data->counters.rows, es);
+    ExplainPropertyInteger("Remote Fetches", NULL, data->counters.fetches, es);
+    ExplainPropertyInteger("Remote Bytes", NULL, data->counters.bytes, es);
+    if (es->timing)
+    {
+        ExplainPropertyFloat("Connect Time", "ms", INSTR_TIME_GET_MILLISEC(data->counters.connect_time), 3, es);
+        ExplainPropertyFloat("Execute Time", "ms", INSTR_TIME_GET_MILLISEC(data->counters.execute_time), 3, es);
+        ExplainPropertyFloat("Fetch Time", "ms", INSTR_TIME_GET_MILLISEC(data->counters.fetch_time), 3, es);
+        ExplainPropertyFloat("Convert Time", "ms", INSTR_TIME_GET_MILLISEC(data->convert_time), 3, es);
+    }
+}
+
+#define RETRYNUMB 2
+
+/*
+ * Prepare and execute data->query, the connection is taken from the cache and the statement
+ * is retried if the cached connection is broken
+ */
+static void executeQuery(db2PrivateData *data, Oid relid)
+{
+    char *query = data->query;
+    int retry = 0;
+    SQLRETURN ret;
+    SQLINTEGER native;
+    long int lcached;
+    int failure;
+
+    logdebug(__func__);
+    failure = 1;
+    // it is
+    while (retry < RETRYNUMB)
+    {
+        instr_time start;
+
+        if (retry > 0)
+        {
+            data->counters.retries++;
+        }
+        getConnection(data, relid);
+        INSTR_TIME_SET_CURRENT(start);
+        // prepared statement is executed again by rescan and kept with the connection for next scans
+        ret = prepareStatement(data);
+        if (SQL_SUCCEEDED(ret))
+        {
+            bindParams(data);
+            /* Retrieve a list of rows */
+            ret = SQLExecute(data->stmt);
+            data->counters.queries++;
+        }
+        accumTime(&data->counters.execute_time, start);
+        // searched UPDATE or DELETE which affected no rows
+        if (SQL_SUCCEEDED(ret) || ret == SQL_NO_DATA)
+        {
+            logdebug("SQLExecute");
+            // OK
+            failure = 0;
+            break;
+        }
+        else
+        {
+            retry++;
+            extract_error("Error while executing query", data->stmt, SQL_HANDLE_STMT, &native, data->conn);
+            // new connection would lose the writes of the DB2 transaction
+            if (data->cached == NULL || data->conn->xact_depth > 0)
+            {
+                logdebug("Not cached, failed");
+                break;
+            }
+            logdebug("Error native code: %u", native);
+            // reconnect
+            discardConnection(data);
+            // try retry
+            lcached = atol(data->cached);
+
+            if (lcached == 0)
+            {
+                lcached = ANYERROR;
+                logdebug("Cached is 0 (may an error), ANYERROR is assumed");
+            }
+            if (lcached == ANYERROR)
+            {
+                logdebug("ANYERROR assuemed, try again");
+                continue;
+            }
+            if (lcached != native)
+            {
+                logdebug("Native code not valid for retry, fail");
+                break;
+            }
+            logdebug("Native code valid for retry, try again");
+        }
+    } // while
+
+    if (failure == 1)
+    {
+        // the error was extracted already
+        releaseStatement(data);
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Cannot execute query %s", query),
+                 errhint("Check query syntax")));
+    }
+}
+
+/*
+ * Execute prepared statement again with current parameter values, result columns stay bound
+ */
+static void reExecuteQuery(db2PrivateData *data)
+{
+    SQLRETURN ret;
+    instr_time start;
+
+    logdebug(__func__);
+    bindParams(data);
+    INSTR_TIME_SET_CURRENT(start);
+    ret = SQLExecute(data->stmt);
+    accumTime(&data->counters.execute_time, start);
+    data->counters.queries++;
+    if (!SQL_SUCCEEDED(ret))
+    {
+        extract_error("SQLExecute", data->stmt, SQL_HANDLE_STMT, NULL, data->conn);
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Cannot execute query %s", data->query)));
+    }
+    data->rows_fetched = 0;
+    data->next_row = 0;
+    data->eof = false;
+}
+
+static bool hasNextBatch(db2PrivateData *data)
+{
+    return data->batch_param >= 0 && data->batch_pos + data->batch_size < data->batch_count;
+}
+
+/*
+ * Execute the statement again for the next batch of col = ANY(array) elements
+ * Returns false if the last batch was already executed
+ */
+static bool nextBatch(db2PrivateData *data)
+{
+    if (!hasNextBatch(data))
+    {
+        return false;
+    }
+    stopPrefetch(data);
+    SQLFreeStmt(data->stmt, SQL_CLOSE);
+    data->batch_pos += data->batch_size;
+    reExecuteQuery(data);
+    return true;
+}
+
+/*
+ * Next slice of parallel scan not taken by other participant, false if all are taken
+ */
+static bool claimSlice(db2PrivateData *data)
+{
+    if (data->pscan != NULL)
+    {
+        data->slice = (int)pg_atomic_fetch_add_u32(&data->pscan->next_slice, 1);
+    }
+    else
+    {
+        data->slice = data->next_slice++;
+    }
+    logdebug("Slice %d of %d", data->slice, data->slices);
+    return data->slice < data->slices;
+}
+
+/*
+ * Execute the statement again for the next slice of parallel scan
+ * Returns false if there is no slice left
+ */
+static bool nextSlice(db2PrivateData *data)
+{
+    if (data->slices == 0 || !claimSlice(data))
+    {
+        return false;
+    }
+    stopPrefetch(data);
+    SQLFreeStmt(data->stmt, SQL_CLOSE);
+    data->batch_pos = 0;
+    reExecuteQuery(data);
+    return true;
+}
+
+/*
+ * Result columns of the executed statement, statement taken from the cache is described only once
+ */
+static db2ResultColumn *describeResult(db2PrivateData *data)
+{
+    db2CachedStatement *cs = data->prepared;
+    db2ResultColumn *columns;
+    SQLRETURN ret;
+    int i;
+
+    if (cs != NULL && cs->no_columns >= 0)
+    {
+        logdebug("Result columns taken from cache");
+        data->no_columns = cs->no_columns;
+        return cs->columns;
+    }
+    ret = SQLNumResultCols(data->stmt, &data->no_columns);
+    if (!SQL_SUCCEEDED(ret))
+    {
+        extract_error("SQLNumResultCols", data->stmt, SQL_HANDLE_STMT, NULL, data->conn);
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Cannot retrieve number of columns %s", data->query),
+                 errhint("Check query syntax")));
+    }
+    logdebug("Number of columns: %u", data->no_columns);
+    columns = (db2ResultColumn *)palloc(sizeof(db2ResultColumn) * Max(data->no_columns, 1));
+    for (i = 0; i < data->no_columns; i++)
+    {
+        SQLCHAR name[255];
+        SQLSMALLINT NameLengthPtr;
+        SQLSMALLINT NullablePtr;
+        db2ResultColumn *desc = &columns[i];
+
+        ret = SQLDescribeCol(data->stmt,
+                             i + 1,
+                             name,
+                             sizeof(SQLCHAR) * sizeof(name),
+                             &NameLengthPtr,
+                             &desc->sqltype,
+                             &desc->columnsize,
+                             &desc->scale,
+                             &NullablePtr);
+        if (SQL_SUCCEEDED(ret))
+        {
+            // number of characters needed to represent the value as text, sign and decimal point included
+            ret = SQLColAttribute(data->stmt, i + 1, SQL_DESC_DISPLAY_SIZE, NULL, 0, NULL, &desc->displaysize);
+        }
+        if (!SQL_SUCCEEDED(ret))
+        {
+            extract_error("SQLDescribeCol", data->stmt, SQL_HANDLE_STMT, NULL, data->conn);
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("Cannot retrieve column description for query %s", data->query),
+                     errhint("Check query syntax")));
+        }
+        desc->name = pstrdup((char *)name);
+    }
+    if (cs == NULL)
+    {
+        return columns;
+    }
+    // copied when complete, error above does not leave half described statement in the cache
+    cs->columns = (db2ResultColumn *)MemoryContextAlloc(TopMemoryContext, sizeof(db2ResultColumn) * Max(data->no_columns, 1));
+    for (i = 0; i < data->no_columns; i++)
+    {
+        cs->columns[i] = columns[i];
+        cs->columns[i].name = MemoryContextStrdup(TopMemoryContext, columns[i].name);
+    }
+    cs->no_columns = data->no_columns;
+    return cs->columns;
+}
+
+/*
+ * Describe result set and bind columns, column i is stored in attribute retrieved_attrs[i]
+ * data->attinmeta should be set before
+ */
+static void bindResultColumns(db2PrivateData *data, List *retrieved_attrs)
+{
+    char *query = data->query;
+    db2ResultColumn *columns;
+    SQLRETURN ret;
+    int i, size;
+    int streamed_from;
+
+    logdebug(__func__);
+    columns = describeResult(data);
+    data->columnsbuf = palloc(Max(data->no_columns, 1) * sizeof(db2ColumnDesc));
+    logdebug("Memory for buffor allocated");
+
+    // SQLGetData can read only columns after the last bound one and only with single row fetches,
+    // so columns from the first long column of an attribute on are streamed row by row
+    // long columns not mapped to any attribute are just left unbound
+    streamed_from = data->no_columns;
+    for (i = 0; i < data->no_columns && i < list_length(retrieved_attrs); i++)
+    {
+        if (isLongColumn(&columns[i]))
+        {
+            streamed_from = i;
+            break;
+        }
+    }
+    if (streamed_from < data->no_columns)
+    {
+        logdebug("Columns from %d are streamed, rows are fetched one by one", streamed_from + 1);
+        data->fetch_size = 1;
+        data->prefetch_slots = 0;
+    }
+    for (i = 0; i < data->no_columns; i++)
+    {
+        char *name = columns[i].name;
+        SQLSMALLINT DecimalDigitsPtr = columns[i].scale;
+        SQLLEN displaysize = columns[i].displaysize;
+        db2ColumnDesc *col = &data->columnsbuf[i];
+
+        col->sqltype = columns[i].sqltype;
+        col->columnsize = columns[i].columnsize;
+        logdebug("Number of bytes for column %s : %lu, display size %ld", name, col->columnsize, (long)displaysize);
+        col->isNumber = false;
+        if ((col->sqltype == SQL_DECIMAL) || (col->sqltype == SQL_NUMERIC) || (col->sqltype == SQL_REAL) ||
+            (col->sqltype == SQL_DOUBLE) || (col->sqltype == SQL_FLOAT))
+        {
+            logdebug("Decimal type");
+            col->isNumber = true;
+        }
+        // columns not matching any attribute are fetched but ignored
+        col->ctype = SQL_C_CHAR;
+        col->attnum = -1;
+        if (i < list_length(retrieved_attrs))
+        {
+            Form_pg_attribute attr = TupleDescAttr(data->attinmeta->tupdesc, list_nth_int(retrieved_attrs, i) - 1);
+            if (!attr->attisdropped)
+            {
+                col->attnum = list_nth_int(retrieved_attrs, i) - 1;
+                col->ctype = chooseCType(col->sqltype, attr->atttypid, attr->atttypmod, col->columnsize);
+            }
+        }
+        col->streamed = i >= streamed_from || isLongColumn(&columns[i]);
+        if (col->streamed)
+        {
+            // read as binary for bytea, as text otherwise
+            if (col->ctype != SQL_C_BINARY)
+            {
+                col->ctype = SQL_C_CHAR;
+            }
+            col->buf = NULL;
+            col->indicator = NULL;
+            col->width = 0;
+            logdebug("Column %s streamed as C type %d", name, col->ctype);
+            continue;
+        }
+        if (col->ctype != SQL_C_CHAR &&
+            bindColumn(data, i, col->ctype,
+                       col->ctype == SQL_C_BINARY ? (SQLLEN)col->columnsize : sizeOfCType(col->ctype),
+                       DecimalDigitsPtr))
+        {
+            logdebug("Column %s bound as C type %d", name, col->ctype);
+            continue;
+        }
+        // text fallback, one byte more for terminating null
+        col->ctype = SQL_C_CHAR;
+        // important : for some reason it cause crash with declaration Size
+        // or putting expression directly in palloc invocation
+        size = sizeof(char) * (Size)(Max(displaysize, (SQLLEN)col->columnsize) + 1);
+        if (!bindColumn(data, i, SQL_C_CHAR, size, 0))
+        {
+            extract_error("SQLBindCol", data->stmt, SQL_HANDLE_STMT, NULL, data->conn);
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("Cannot bind column %s for query %s", name, query)));
+        }
+    }
+
+    // column-wise binding, fetch_size rows per SQLFetch
+    ret = SQLSetStmtAttr(data->stmt, SQL_ATTR_ROW_BIND_TYPE, (SQLPOINTER)SQL_BIND_BY_COLUMN, 0);
+    if (SQL_SUCCEEDED(ret))
+    {
+        ret = SQLSetStmtAttr(data->stmt, SQL_ATTR_ROW_ARRAY_SIZE, (SQLPOINTER)data->fetch_size, 0);
+    }
+    if (SQL_SUCCEEDED(ret))
+    {
+        ret = SQLSetStmtAttr(data->stmt, SQL_ATTR_ROWS_FETCHED_PTR, &data->rows_fetched, 0);
+    }
+    if (!SQL_SUCCEEDED(ret))
+    {
+        extract_error("SQLSetStmtAttr", data->stmt, SQL_HANDLE_STMT, NULL, data->conn);
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Cannot set row array size %ld", data->fetch_size)));
+    }
+    data->rows_fetched = 0;
+    data->next_row = 0;
+    data->eof = false;
+}
+
+/*
+ * Start thread calling ODBC, signals are handled by the backend thread only
+ */
+static void startThread(pthread_t *thread, void *(*func)(void *), void *arg)
+{
+    sigset_t all, old;
+    int rc;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    rc = pthread_create(thread, NULL, func, arg);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0)
+    {
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Cannot start thread: %s", strerror(rc))));
+    }
+}
+
+/*
+ * Scans with a running thread, used only by the backend
+ * Abort stops the threads before the connections are released, reset of executor memory may come later
+ */
+static db2PrivateData *helperScans = NULL;
+
+static void listHelperScan(db2PrivateData *data)
+{
+    if (!data->helper_listed)
+    {
+        data->next_helper = helperScans;
+        helperScans = data;
+        data->helper_listed = true;
+    }
+}
+
+static void unlistHelperScan(db2PrivateData *data)
+{
+    db2PrivateData **prev = &helperScans;
+
+    if (!data->helper_listed)
+    {
+        return;
+    }
+    while (*prev != data)
+    {
+        prev = &(*prev)->next_helper;
+    }
+    *prev = data->next_helper;
+    data->helper_listed = false;
+}
+
+/*
+ * Check result of SQLFetch of the row array, rows_fetched is set by the driver
+ */
+static void checkFetch(db2PrivateData *data, SQLRETURN ret)
+{
+    logdebug("SQLFetch %u, rows %lu", ret, data->rows_fetched);
+    if (ret == SQL_NO_DATA_FOUND)
+    {
+        data->rows_fetched = 0;
+        data->eof = true;
+        return;
+    }
+    if (!SQL_SUCCEEDED(ret))
+    {
+        extract_error("SQLFetch", data->stmt, SQL_HANDLE_STMT, NULL, data->conn);
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Cannot fetch next row"),
+                 errhint("Check query syntax")));
+    }
+    // short array means the end of result set
+    if (data->rows_fetched < (SQLULEN)data->fetch_size)
+    {
+        data->eof = true;
+    }
+}
+
+// -------------------------------------------
+// prefetch thread
+// -------------------------------------------
+
+/*
+ * Body of prefetch thread, only ODBC and C library are called here, never PostgreSQL
+ * Fetches row arrays until the ring is full, ends with the result set
+ */
+static void *prefetchThread(void *arg)
+{
+    db2PrivateData *data = (db2PrivateData *)arg;
+    db2Prefetch *pf = data->prefetch;
+    int tail = 0;
+    char c = 0;
+
+    for (;;)
+    {
+        db2PrefetchSlot *slot = &pf->slots[tail];
+        SQLRETURN ret;
+        bool stop;
+        int i;
+
+        pthread_mutex_lock(&pf->lock);
+        while (pf->filled == pf->nslots && !pf->stop)
+        {
+            pthread_cond_wait(&pf->released, &pf->lock);
+        }
+        stop = pf->stop;
+        pthread_mutex_unlock(&pf->lock);
+        if (stop)
+        {
+            break;
+        }
+        pf->rows_fetched = 0;
+        ret = SQLFetch(data->stmt);
+        slot->ret = ret;
+        slot->rows = SQL_SUCCEEDED(ret) ? pf->rows_fetched : 0;
+        for (i = 0; i < data->no_columns; i++)
+        {
+            if (data->columnsbuf[i].streamed)
+            {
+                continue;
+            }
+            memcpy(slot->buf[i], pf->fetchbuf[i], data->columnsbuf[i].width * slot->rows);
+            memcpy(slot->indicator[i], pf->fetchind[i], sizeof(SQLLEN) * slot->rows);
+        }
+        pthread_mutex_lock(&pf->lock);
+        pf->filled++;
+        pthread_mutex_unlock(&pf->lock);
+        while (write(pf->pipe[1], &c, 1) < 0 && errno == EINTR)
+            ;
+        // the same conditions end the result set in checkFetch
+        if (!SQL_SUCCEEDED(ret) || slot->rows < (SQLULEN)data->fetch_size)
+        {
+            break;
+        }
+        tail = (tail + 1) % pf->nslots;
+    }
+    return NULL;
+}
+
+/*
+ * Stop prefetch thread before the cursor is closed, rows not consumed are discarded
+ */
+static void stopPrefetch(db2PrivateData *data)
+{
+    db2Prefetch *pf = data->prefetch;
+    char c;
+
+    if (pf == NULL || !pf->running)
+    {
+        return;
+    }
+    logdebug(__func__);
+    pthread_mutex_lock(&pf->lock);
+    pf->stop = true;
+    pthread_cond_signal(&pf->released);
+    pthread_mutex_unlock(&pf->lock);
+    // SQLFetch can wait for DB2
+    SQLCancel(data->stmt);
+    pthread_join(pf->thread, NULL);
+    pf->running = false;
+    unlistHelperScan(data);
+    while (read(pf->pipe[0], &c, 1) > 0)
+        ;
+}
+
+/*
+ * Called by EndForeignScan and by deletion of executor memory, also when the query fails
+ */
+static void releasePrefetch(void *arg)
+{
+    db2PrivateData *data = (db2PrivateData *)arg;
+    db2Prefetch *pf = data->prefetch;
+
+    stopPrefetch(data);
+    if (pf->pipe[0] >= 0)
+    {
+        close(pf->pipe[0]);
+        close(pf->pipe[1]);
+        pf->pipe[0] = pf->pipe[1] = -1;
+        pthread_mutex_destroy(&pf->lock);
+        pthread_cond_destroy(&pf->released);
+    }
+}
+
+/*
+ * Allocate the ring of row arrays, columns should be bound before
+ * The bound buffers are left to the thread, SQLFetch is never called by the scan again
+ */
+static void setupPrefetch(ForeignScanState *node, db2PrivateData *data)
+{
+    db2Prefetch *pf;
+    MemoryContextCallback *callback;
+    SQLRETURN ret;
+    int i, k;
+
+    logdebug(__func__);
+    pf = (db2Prefetch *)palloc0(sizeof(db2Prefetch));
+    pf->nslots = (int)data->prefetch_slots;
+    pf->fetchbuf = palloc(sizeof(char *) * data->no_columns);
+    pf->fetchind = palloc(sizeof(SQLLEN *) * data->no_columns);
+    for (i = 0; i < data->no_columns; i++)
+    {
+        pf->fetchbuf[i] = data->columnsbuf[i].buf;
+        pf->fetchind[i] = data->columnsbuf[i].indicator;
+    }
+    pf->slots = palloc(sizeof(db2PrefetchSlot) * pf->nslots);
+    for (k = 0; k < pf->nslots; k++)
+    {
+        db2PrefetchSlot *slot = &pf->slots[k];
+
+        slot->buf = palloc(sizeof(char *) * data->no_columns);
+        slot->indicator = palloc(sizeof(SQLLEN *) * data->no_columns);
+        for (i = 0; i < data->no_columns; i++)
+        {
+            slot->buf[i] = palloc(data->columnsbuf[i].width * data->fetch_size);
+            slot->indicator[i] = palloc(sizeof(SQLLEN) * data->fetch_size);
+        }
+    }
+    ret = SQLSetStmtAttr(data->stmt, SQL_ATTR_ROWS_FETCHED_PTR, &pf->rows_fetched, 0);
+    if (!SQL_SUCCEEDED(ret))
+    {
+        extract_error("SQLSetStmtAttr", data->stmt, SQL_HANDLE_STMT, NULL, data->conn);
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Cannot set rows fetched pointer for query %s", data->query)));
+    }
+    // read end is polled together with the latch
+    if (pipe(pf->pipe) != 0 || fcntl(pf->pipe[0], F_SETFL, O_NONBLOCK) != 0)
+    {
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Cannot create pipe for prefetch: %m")));
+    }
+    pthread_mutex_init(&pf->lock, NULL);
+    pthread_cond_init(&pf->released, NULL);
+    data->prefetch = pf;
+    callback = (MemoryContextCallback *)palloc0(sizeof(MemoryContextCallback));
+    callback->func = releasePrefetch;
+    callback->arg = (void *)data;
+    MemoryContextRegisterResetCallback(node->ss.ps.state->es_query_cxt, callback);
+}
+
+/*
+ * Take the next row array from the ring, the scan waits if the thread did not fill it yet
+ * The thread is started by the first call after the statement was executed
+ */
+static void nextPrefetched(db2PrivateData *data)
+{
+    db2Prefetch *pf = data->prefetch;
+    db2PrefetchSlot *slot;
+    int filled, i, rc;
+    char c;
+
+    if (!pf->running)
+    {
+        pf->filled = 0;
+        pf->stop = false;
+        pf->head = 0;
+        pf->holding = false;
+        startThread(&pf->thread, prefetchThread, data);
+        pf->running = true;
+        listHelperScan(data);
+    }
+    else if (pf->holding)
+    {
+        // rows of the slot are converted already
+        pthread_mutex_lock(&pf->lock);
+        pf->filled--;
+        pthread_cond_signal(&pf->released);
+        pthread_mutex_unlock(&pf->lock);
+        pf->head = (pf->head + 1) % pf->nslots;
+        pf->holding = false;
+    }
+    for (;;)
+    {
+        while (read(pf->pipe[0], &c, 1) > 0)
+            ;
+        pthread_mutex_lock(&pf->lock);
+        filled = pf->filled;
+        pthread_mutex_unlock(&pf->lock);
+        if (filled > 0)
+        {
+            break;
+        }
+        rc = WaitLatchOrSocket(MyLatch,
+#if PG_VERSION_NUM >= 120000
+                               WL_LATCH_SET | WL_SOCKET_READABLE | WL_EXIT_ON_PM_DEATH,
+#else
+                               WL_LATCH_SET | WL_SOCKET_READABLE | WL_POSTMASTER_DEATH,
+#endif
+                               pf->pipe[0], -1L, PG_WAIT_EXTENSION);
+        if (rc & WL_LATCH_SET)
+        {
+            ResetLatch(MyLatch);
+            CHECK_FOR_INTERRUPTS();
+        }
+    }
+    slot = &pf->slots[pf->head];
+    pf->holding = true;
+    for (i = 0; i < data->no_columns; i++)
+    {
+        data->columnsbuf[i].buf = slot->buf[i];
+        data->columnsbuf[i].indicator = slot->indicator[i];
+    }
+    data->rows_fetched = slot->rows;
+    checkFetch(data, slot->ret);
+}
+
+/*
+ * Next row of the result set converted to values/isnull arrays of data->natts elements
+ * Values are allocated in data->rowcontext and valid until the next call
+ * Returns false at the end of result set
+ */
+static bool fetchRow(db2PrivateData *data, Datum *values, bool *isnull)
+{
+    SQLSMALLINT i;
+    SQLULEN row;
+    MemoryContext oldcontext;
+    instr_time start;
+    instr_time getdata_time;
+    instr_time fetch_before;
+
+    // local row array exhausted, fetch next one
+    if (data->next_row >= data->rows_fetched)
+    {
+        if (data->eof)
+        {
+            return false;
+        }
+        data->rows_fetched = 0;
+        data->next_row = 0;
+        // with prefetch only the wait for the thread is counted
+        INSTR_TIME_SET_CURRENT(start);
+        if (data->prefetch != NULL)
+        {
+            nextPrefetched(data);
+        }
+        else
+        {
+            checkFetch(data, SQLFetch(data->stmt));
+        }
+        accumTime(&data->counters.fetch_time, start);
+        data->counters.fetches++;
+        if (data->rows_fetched == 0)
+        {
+            return false;
+        }
+    }
+    row = data->next_row++;
+    data->counters.rows++;
+    if (data->instrument)
+    {
+        INSTR_TIME_SET_CURRENT(start);
+        fetch_before = data->counters.fetch_time;
+    }
+
+    // values of the previous row are not referenced any longer
+    MemoryContextReset(data->rowcontext);
+    oldcontext = MemoryContextSwitchTo(data->rowcontext);
+    // attributes not retrieved are NULL
+    memset(isnull, true, sizeof(bool) * data->natts);
+    memset(values, 0, sizeof(Datum) * data->natts);
+    for (i = 0; i < data->no_columns; i++)
+    {
+        db2ColumnDesc *col = &data->columnsbuf[i];
+
+        if (col->attnum < 0)
+        {
+            continue;
+        }
+        // row array has only one row then
+        if (col->streamed)
+        {
+            isnull[col->attnum] = !streamColumn(data, i, &values[col->attnum]);
+            continue;
+        }
+        // for some reason indicator should be casted to int to have comparison correct
+        if ((int)col->indicator[row] == SQL_NULL_DATA)
+        {
+            continue;
+        }
+        data->counters.bytes += Min(col->indicator[row], col->width);
+        values[col->attnum] = convertColumn(data, i, row);
+        isnull[col->attnum] = false;
+    }
+    MemoryContextSwitchTo(oldcontext);
+    if (data->instrument)
+    {
+        // SQLGetData of streamed columns is already counted in fetch_time
+        getdata_time = data->counters.fetch_time;
+        INSTR_TIME_SUBTRACT(getdata_time, fetch_before);
+        INSTR_TIME_ADD(start, getdata_time);
+        accumTime(&data->convert_time, start);
+    }
+
+    return true;
+}
+
+/*
+ * Statement needs SQLExecute or SQLFetch before the next row can be returned
+ */
+static bool needAsyncCall(db2PrivateData *data)
+{
+    if (!data->cursor_open)
+    {
+        return true;
+    }
+    if (data->next_row < data->rows_fetched)
+    {
+        return false;
+    }
+    return !data->eof || hasNextBatch(data);
+}
+
+#if PG_VERSION_NUM >= 140000
+
+/*
+ * Prepare data->query without executing it, the statement is executed by async_thread
+ */
+static void prepareQuery(db2PrivateData *data, Oid relid)
+{
+    SQLRETURN ret;
+
+    logdebug(__func__);
+    getConnection(data, relid);
+    ret = prepareStatement(data);
+    if (!SQL_SUCCEEDED(ret))
+    {
+        extract_error("SQLPrepare", data->stmt, SQL_HANDLE_STMT, NULL, data->conn);
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Cannot prepare query %s", data->query),
+                 errhint("Check query syntax")));
+    }
+}
+
+/*
+ * Body of async_thread, only ODBC and C library are called here, never PostgreSQL
+ * Runs the requested call and waits for the next one until the scan stops the thread
+ */
+static void *asyncThread(void *arg)
+{
+    db2PrivateData *data = (db2PrivateData *)arg;
+    SQLRETURN ret;
+    instr_time start;
+    bool stop;
+    char c = 0;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&data->async_lock);
+        while (!data->async_request && !data->async_stop)
+        {
+            pthread_cond_wait(&data->async_wakeup, &data->async_lock);
+        }
+        stop = data->async_stop;
+        pthread_mutex_unlock(&data->async_lock);
+        if (stop)
+        {
+            break;
+        }
+        INSTR_TIME_SET_CURRENT(start);
+        if (data->async_execute)
+        {
+            ret = SQLExecute(data->stmt);
+            data->counters.queries++;
+            accumTime(&data->counters.execute_time, start);
+            // async_execute stays set if SQLExecute failed
+            if (SQL_SUCCEEDED(ret))
+            {
+                data->async_execute = false;
+                INSTR_TIME_SET_CURRENT(start);
+                ret = SQLFetch(data->stmt);
+                data->counters.fetches++;
+                accumTime(&data->counters.fetch_time, start);
+            }
+        }
+        else
+        {
+            ret = SQLFetch(data->stmt);
+            data->counters.fetches++;
+            accumTime(&data->counters.fetch_time, start);
+        }
+        data->async_ret = ret;
+        pthread_mutex_lock(&data->async_lock);
+        data->async_request = false;
+        pthread_mutex_unlock(&data->async_lock);
+        // wake up the backend waiting for async_pipe
+        while (write(data->async_pipe[1], &c, 1) < 0 && errno == EINTR)
+            ;
+    }
+    return NULL;
+}
+
+/*
+ * Run SQLExecute (if execute is set) and SQLFetch of the next row array in async_thread
+ * Parameters and result columns should be bound before
+ * The thread is started by the first call of the scan
+ */
+static void startAsyncCall(db2PrivateData *data, bool execute)
+{
+    logdebug(__func__);
+    data->async_execute = execute;
+    data->rows_fetched = 0;
+    data->next_row = 0;
+    data->eof = false;
+    if (!data->async_running)
+    {
+        data->async_request = false;
+        data->async_stop = false;
+        startThread(&data->async_thread, asyncThread, data);
+        data->async_running = true;
+        listHelperScan(data);
+    }
+    pthread_mutex_lock(&data->async_lock);
+    data->async_request = true;
+    pthread_cond_signal(&data->async_wakeup);
+    pthread_mutex_unlock(&data->async_lock);
+    data->async_pending = true;
+}
+
+/*
+ * Wait until async_thread finishes the pending call
+ */
+static void joinAsyncCall(db2PrivateData *data)
+{
+    char c;
+
+    // the byte is written when the call is finished
+    while (read(data->async_pipe[0], &c, 1) < 0 && errno == EINTR)
+        ;
+    data->async_pending = false;
+}
+
+/*
+ * Wait for async_thread and check the result of its call
+ */
+static void finishAsyncCall(db2PrivateData *data)
+{
+    logdebug(__func__);
+    joinAsyncCall(data);
+    if (data->async_execute)
+    {
+        extract_error("SQLExecute", data->stmt, SQL_HANDLE_STMT, NULL, data->conn);
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Cannot execute query %s", data->query)));
+    }
+    checkFetch(data, data->async_ret);
+}
+
+/*
+ * Cancel the pending call of async_thread, its result is not needed
+ */
+static void cancelAsyncCall(db2PrivateData *data)
+{
+    if (data->async_pending)
+    {
+        logdebug(__func__);
+        SQLCancel(data->stmt);
+        joinAsyncCall(data);
+    }
+}
+
+/*
+ * Cancel the pending call and end async_thread
+ */
+static void stopAsyncThread(db2PrivateData *data)
+{
+    cancelAsyncCall(data);
+    if (data->async_running)
+    {
+        pthread_mutex_lock(&data->async_lock);
+        data->async_stop = true;
+        pthread_cond_signal(&data->async_wakeup);
+        pthread_mutex_unlock(&data->async_lock);
+        pthread_join(data->async_thread, NULL);
+        data->async_running = false;
+        unlistHelperScan(data);
+    }
+}
+
+/*
+ * Called by EndForeignScan and by deletion of executor memory, also when the query fails,
+ * the thread should not survive the memory it writes to
+ */
+static void releaseAsync(void *arg)
+{
+    db2PrivateData *data = (db2PrivateData *)arg;
+
+    stopAsyncThread(data);
+    if (data->async_pipe[0] >= 0)
+    {
+        close(data->async_pipe[0]);
+        close(data->async_pipe[1]);
+        data->async_pipe[0] = data->async_pipe[1] = -1;
+        pthread_mutex_destroy(&data->async_lock);
+        pthread_cond_destroy(&data->async_wakeup);
+    }
+}
+
+/*
+ * Start SQLExecute or SQLFetch needed for the next row, the statement is prepared synchronously
+ */
+static void startAsyncFetch(ForeignScanState *node, db2PrivateData *data)
+{
+    if (!data->cursor_open)
+    {
+        evaluateParams(node, data);
+        if (data->stmt == SQL_NULL_HSTMT)
+        {
+            prepareQuery(data, data->relid);
+            bindResultColumns(data, data->retrieved_attrs);
+        }
+        bindParams(data);
+        data->cursor_open = true;
+        startAsyncCall(data, true);
+    }
+    else if (!data->eof)
+    {
+        startAsyncCall(data, false);
+    }
+    else
+    {
+        // next batch of col = ANY(array) elements
+        SQLFreeStmt(data->stmt, SQL_CLOSE);
+        data->batch_pos += data->batch_size;
+        bindParams(data);
+        startAsyncCall(data, true);
+    }
+}
+
+#endif
+
+/*
+ * Stop threads of scans started in subtransaction level or deeper, all of them if level is 0
+ * Called by abort before the connections and statements of the scans are released
+ */
+static void stopHelperScans(int level)
+{
+    db2PrivateData **prev = &helperScans;
+
+    while (*prev != NULL)
+    {
+        db2PrivateData *data = *prev;
+
+        if (level > 0 && data->ref != NULL && data->ref->level < level)
+        {
+            prev = &data->next_helper;
+            continue;
+        }
+#if PG_VERSION_NUM >= 140000
+        stopAsyncThread(data);
+#endif
+        stopPrefetch(data);
+        unlistHelperScan(data);
+    }
+}
+
+/*
+ * file_fixed_lengthBeginForeignScan
+ *		Initiate access to the file
+ */
+static void
+db2_BeginForeignScan(ForeignScanState *node, int eflags)
+{
+    ForeignScan *fsplan = (ForeignScan *)node->ss.ps.plan;
+    db2PrivateData *data;
+
+    logdebug(__func__);
+    data = (db2PrivateData *)palloc0(sizeof(db2PrivateData));
+    data->query = strVal(list_nth(fsplan->fdw_private, FdwScanPrivateSelectSql));
+    data->retrieved_attrs = (List *)list_nth(fsplan->fdw_private, FdwScanPrivateRetrievedAttrs);
+    data->relid = (Oid)intVal(list_nth(fsplan->fdw_private, FdwScanPrivateRelid));
+    data->batch_size = intVal(list_nth(fsplan->fdw_private, FdwScanPrivateBatchSize));
+    data->batch_param = -1;
+    data->slices = intVal(list_nth(fsplan->fdw_private, FdwScanPrivateSlices));
+    data->serverid = (Oid)intVal(list_nth(fsplan->fdw_private, FdwScanPrivateServerId));
+    data->fetch_size = intVal(list_nth(fsplan->fdw_private, FdwScanPrivateFetchSize));
+    data->prefetch_slots = intVal(list_nth(fsplan->fdw_private, FdwScanPrivatePrefetch));
+    data->cached = strVal(list_nth(fsplan->fdw_private, FdwScanPrivateCached));
+    if (*data->cached == '\0')
+    {
+        data->cached = NULL;
+    }
+    data->cache_ttl = intVal(list_nth(fsplan->fdw_private, FdwScanPrivateCacheTtl));
+    data->cache_relids = (List *)list_nth(fsplan->fdw_private, FdwScanPrivateCacheRelids);
+    data->async_pipe[0] = data->async_pipe[1] = -1;
+    // EXPLAIN ANALYZE with TIMING, other counters are maintained anyway
+    data->instrument = node->ss.ps.instrument != NULL && node->ss.ps.instrument->need_timer;
+    logdebug("QUERY: %s", data->query);
+    prepareParams(node, data, fsplan->fdw_exprs);
+
+    // relation descriptor or descriptor of fdw_scan_tlist
+    data->attinmeta = TupleDescGetAttInMetadata(node->ss.ss_ScanTupleSlot->tts_tupleDescriptor);
+    data->natts = data->attinmeta->tupdesc->natts;
+    data->rowcontext = AllocSetContextCreate(node->ss.ps.state->es_query_cxt,
+                                             "db2odbc_fdw row data",
+                                             ALLOCSET_SMALL_SIZES);
+
+    // the query is executed by the first IterateForeignScan, values of PARAM_EXEC parameters are not known yet
+    data->stmt = SQL_NULL_HSTMT;
+    data->cursor_open = false;
+    if (data->cache_ttl > 0)
+    {
+        data->cachecontext = AllocSetContextCreate(node->ss.ps.state->es_query_cxt,
+                                                   "db2odbc_fdw cached result",
+                                                   ALLOCSET_DEFAULT_SIZES);
+    }
+
+#if PG_VERSION_NUM >= 140000
+    // scan driven by Append through ForeignAsyncRequest, its result is never cached
+    data->async = node->ss.ps.async_capable;
+    if (data->async)
+    {
+        MemoryContextCallback *callback;
+
+        data->cache_ttl = 0;
+        if (pipe(data->async_pipe) != 0)
+        {
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("Cannot create pipe for asynchronous execution: %m")));
+        }
+        pthread_mutex_init(&data->async_lock, NULL);
+        pthread_cond_init(&data->async_wakeup, NULL);
+        callback = (MemoryContextCallback *)palloc0(sizeof(MemoryContextCallback));
+        callback->func = releaseAsync;
+        callback->arg = (void *)data;
+        MemoryContextRegisterResetCallback(node->ss.ps.state->es_query_cxt, callback);
+    }
+#endif
+
+    node->fdw_state = (void *)data;
+}
+
+/*
+ * fileIterateForeignScan
+ *		Read next record from the data file and store it into the
+ *		ScanTupleSlot as a virtual tuple
+ */
+static TupleTableSlot *
+db2_IterateForeignScan(ForeignScanState *node)
+{
+    db2PrivateData *data;
+    TupleTableSlot *slot;
+
+    logdebug(__func__);
+    data = (db2PrivateData *)node->fdw_state;
+    slot = node->ss.ss_ScanTupleSlot;
+    ExecClearTuple(slot);
+
+    if (data->async)
+    {
+        // SQLExecute and SQLFetch are started by ForeignAsyncRequest, empty slot asks for them
+        if (data->async_pending || needAsyncCall(data))
+        {
+            return slot;
+        }
+    }
+    else if (!data->cursor_open)
+    {
+        // every participant of parallel scan reads the slices it claims
+        if (data->slices > 0 && !claimSlice(data))
+        {
+            return NULL;
+        }
+        evaluateParams(node, data);
+        // rows of cached result are returned without contacting DB2
+        if (!lookupResult(data))
+        {
+            if (data->stmt == SQL_NULL_HSTMT)
+            {
+                executeQuery(data, data->relid);
+                bindResultColumns(data, data->retrieved_attrs);
+                if (data->prefetch_slots > 0)
+                {
+                    setupPrefetch(node, data);
+                }
+            }
+            else
+            {
+                reExecuteQuery(data);
+            }
+        }
+        data->cursor_open = true;
+    }
+    if (data->cache_hit)
+    {
+        if (!nextCachedRow(data, slot->tts_values, slot->tts_isnull))
+        {
+            return NULL;
+        }
+        return ExecStoreVirtualTuple(slot);
+    }
+    while (!fetchRow(data, slot->tts_values, slot->tts_isnull))
+    {
+        if (data->async || (!nextBatch(data) && !nextSlice(data)))
+        {
+            // the whole result was read
+            storeResult(data);
+            return NULL;
+        }
+    }
+    if (data->cache_fill)
+    {
+        collectRow(data, slot->tts_values, slot->tts_isnull);
+    }
+    ExecStoreVirtualTuple(slot);
+
+    return slot;
+}
+
+/*
+ * fileEndForeignScan
+ *		Finish scanning foreign table and dispose objects used for this scan
+ */
+static void
+db2_EndForeignScan(ForeignScanState *node)
+{
+    db2PrivateData *data;
+
+    logdebug(__func__);
+    data = (db2PrivateData *)node->fdw_state;
+#if PG_VERSION_NUM >= 140000
+    releaseAsync(data);
+#endif
+    if (data->prefetch != NULL)
+    {
+        releasePrefetch(data);
+    }
+    // nothing was executed
+    if (data->stmt != SQL_NULL_HSTMT)
+    {
+        releaseStatement(data);
+        closeConnection(data);
+    }
+    MemoryContextDelete(data->rowcontext);
+    if (data->batchcontext != NULL)
+    {
+        MemoryContextDelete(data->batchcontext);
+    }
+    if (data->cachecontext != NULL)
+    {
+        MemoryContextDelete(data->cachecontext);
+    }
+}
+
+/*
+ * fileReScanForeignScan
+ *		Rescan table, possibly with new parameters
+ */
+static void
+db2_ReScanForeignScan(ForeignScanState *node)
+{
+    db2PrivateData *data = (db2PrivateData *)node->fdw_state;
+
+    logdebug(__func__);
+    // close the cursor, the statement is executed again by the next IterateForeignScan
+#if PG_VERSION_NUM >= 140000
+    cancelAsyncCall(data);
+#endif
+    stopPrefetch(data);
+    // shared counter of parallel scan is reset by ReInitializeDSMForeignScan
+    data->next_slice = 0;
+    // result not read to the end is not cached, the next execution looks up the cache again
+    data->cache_hit = false;
+    data->cache_fill = false;
+    if (data->cursor_open && data->stmt != SQL_NULL_HSTMT)
+    {
+        SQLFreeStmt(data->stmt, SQL_CLOSE);
+    }
+    data->cursor_open = false;
+}
+
+/*
+ * Only tables with partition_column can be split among workers, other scans stay in the leader
+ */
+static bool db2_IsForeignScanParallelSafe(PlannerInfo *root, RelOptInfo *rel, RangeTblEntry *rte)
+{
+    logdebug(__func__);
+    return getTableOptions(rte->relid)->partition_attno != InvalidAttrNumber;
+}
+
+static Size db2_EstimateDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt)
+{
+    logdebug(__func__);
+    return sizeof(db2ParallelScan);
+}
+
+static void db2_InitializeDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt, void *coordinate)
+{
+    db2PrivateData *data = (db2PrivateData *)node->fdw_state;
+    db2ParallelScan *pscan = (db2ParallelScan *)coordinate;
+
+    logdebug(__func__);
+    pg_atomic_init_u32(&pscan->next_slice, 0);
+    data->pscan = pscan;
+}
+
+static void db2_ReInitializeDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt, void *coordinate)
+{
+    db2ParallelScan *pscan = (db2ParallelScan *)coordinate;
+
+    logdebug(__func__);
+    pg_atomic_write_u32(&pscan->next_slice, 0);
+}
+
+static void db2_InitializeWorkerForeignScan(ForeignScanState *node, shm_toc *toc, void *coordinate)
+{
+    db2PrivateData *data = (db2PrivateData *)node->fdw_state;
+
+    logdebug(__func__);
+    // the worker opens its own connection by the first IterateForeignScan
+    data->pscan = (db2ParallelScan *)coordinate;
+}
+
+#if PG_VERSION_NUM >= 140000
+
+static bool db2_IsForeignPathAsyncCapable(ForeignPath *path)
+{
+    db2FdwRelationInfo *fpinfo = (db2FdwRelationInfo *)path->path.parent->fdw_private;
+
+    logdebug(__func__);
+    // slices of parallel scan are read one after another
+    return fpinfo->async_capable && !path->path.parallel_aware;
+}
+
+/*
+ * Return the next row if it is already fetched, otherwise start SQLExecute or SQLFetch
+ * in async_thread and leave the request pending until async_pipe is readable
+ */
+static void produceTupleAsync(AsyncRequest *areq)
+{
+    ForeignScanState *node = (ForeignScanState *)areq->requestee;
+    db2PrivateData *data = (db2PrivateData *)node->fdw_state;
+    TupleTableSlot *result;
+
+    if (!data->async_pending)
+    {
+        // local conditions and projection are applied by ExecScan
+        result = ExecProcNode((PlanState *)node);
+        if (!TupIsNull(result) || !needAsyncCall(data))
+        {
+            ExecAsyncRequestDone(areq, result);
+            return;
+        }
+        startAsyncFetch(node, data);
+    }
+    ExecAsyncRequestPending(areq);
+}
+
+static void db2_ForeignAsyncRequest(AsyncRequest *areq)
+{
+    logdebug(__func__);
+    produceTupleAsync(areq);
+}
+
+static void db2_ForeignAsyncConfigureWait(AsyncRequest *areq)
+{
+    ForeignScanState *node = (ForeignScanState *)areq->requestee;
+    db2PrivateData *data = (db2PrivateData *)node->fdw_state;
+
+    logdebug(__func__);
+    Assert(data->async_pending);
+    AddWaitEventToSet(areq->requestor->as_eventset, WL_SOCKET_READABLE, data->async_pipe[0], NULL, areq);
+}
+
+static void db2_ForeignAsyncNotify(AsyncRequest *areq)
+{
+    ForeignScanState *node = (ForeignScanState *)areq->requestee;
+    db2PrivateData *data = (db2PrivateData *)node->fdw_state;
+
+    logdebug(__func__);
+    finishAsyncCall(data);
+    produceTupleAsync(areq);
+}
+
+#endif
+
+// -------------------------------------------
+// INSERT
+// -------------------------------------------
+
+/*
+ * batch_size option of the foreign table or its server, rows sent to DB2 in one SQLExecute
+ */
+static int getInsertBatchSize(Oid foreigntableid)
+{
+    ForeignTable *table;
+    ForeignServer *server;
+    List *options;
+    ListCell *lc;
+    int batch_size = DEFAULT_BATCH_SIZE;
+
+    table = GetForeignTable(foreigntableid);
+    server = GetForeignServer(table->serverid);
+
+    // table options come after server options, table level wins
+    options = NIL;
+    options = list_concat(options, server->options);
+    options = list_concat(options, table->options);
+    foreach (lc, options)
+    {
+        DefElem *def = (DefElem *)lfirst(lc);
+        if (strcmp(def->defname, BATCHSIZE) == 0)
+        {
+            batch_size = (int)checkPositiveInt(def);
+        }
+    }
+    return batch_size;
+}
+
+/*
+ * Connect and prepare the INSERT, parameters are bound column-wise by execInsert
+ */
+static db2ModifyState *createModifyState(Relation rel, EState *estate, char *query, List *target_attrs)
+{
+    db2ModifyState *state;
+    TupleDesc tupdesc = RelationGetDescr(rel);
+    SQLRETURN ret;
+    ListCell *lc;
+    int i = 0;
+
+    logdebug(__func__);
+    state = (db2ModifyState *)palloc0(sizeof(db2ModifyState));
+    state->data.query = query;
+    state->data.relid = RelationGetRelid(rel);
+    state->target_attrs = target_attrs;
+    state->types = (Oid *)palloc(sizeof(Oid) * Max(list_length(target_attrs), 1));
+    foreach (lc, target_attrs)
+    {
+        state->types[i++] = TupleDescAttr(tupdesc, lfirst_int(lc) - 1)->atttypid;
+    }
+    state->batch_size = getInsertBatchSize(RelationGetRelid(rel));
+    state->status = (SQLUSMALLINT *)palloc(sizeof(SQLUSMALLINT) * state->batch_size);
+    state->batchcontext = AllocSetContextCreate(estate->es_query_cxt,
+                                                "db2odbc_fdw insert batch",
+                                                ALLOCSET_DEFAULT_SIZES);
+
+    state->data.write = true;
+    getConnection(&state->data, RelationGetRelid(rel));
+    allocStatement(&state->data);
+    ret = SQLPrepare(state->data.stmt, (SQLCHAR *)query, SQL_NTS);
+    if (SQL_SUCCEEDED(ret))
+    {
+        ret = SQLSetStmtAttr(state->data.stmt, SQL_ATTR_PARAM_BIND_TYPE, (SQLPOINTER)SQL_PARAM_BIND_BY_COLUMN, 0);
+    }
+    if (SQL_SUCCEEDED(ret))
+    {
+        ret = SQLSetStmtAttr(state->data.stmt, SQL_ATTR_PARAM_STATUS_PTR, state->status, 0);
+    }
+    if (!SQL_SUCCEEDED(ret))
+    {
+        extract_error("SQLPrepare", state->data.stmt, SQL_HANDLE_STMT, NULL, state->data.conn);
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Cannot prepare statement %s", query),
+                 errhint("Check table and column names")));
+    }
+    return state;
+}
+
+/*
+ * Send n rows to DB2 in one SQLExecute, every parameter is bound to an array of n text values
+ * The buffer of the column is as wide as its longest value in the batch
+ */
+static void execInsert(db2ModifyState *state, TupleTableSlot **slots, int n)
+{
+    SQLHSTMT stmt = state->data.stmt;
+    MemoryContext oldcontext;
+    SQLRETURN ret;
+    ListCell *lc;
+    SQLUSMALLINT marker = 1;
+    int i;
+    instr_time start;
+
+    logdebug("%s: %d rows", __func__, n);
+    // arrays of the previous batch are not referenced any longer
+    MemoryContextReset(state->batchcontext);
+    oldcontext = MemoryContextSwitchTo(state->batchcontext);
+    foreach (lc, state->target_attrs)
+    {
+        char **values = (char **)palloc(sizeof(char *) * n);
+        SQLLEN *ind = (SQLLEN *)palloc(sizeof(SQLLEN) * n);
+        SQLLEN width = 1;
+        char *buf;
+
+        for (i = 0; i < n; i++)
+        {
+            bool isnull;
+            Datum value = slot_getattr(slots[i], lfirst_int(lc), &isnull);
+
+            values[i] = isnull ? NULL : db2ValueText(value, state->types[marker - 1]);
+            if (values[i] != NULL)
+            {
+                width = Max(width, (SQLLEN)strlen(values[i]) + 1);
+            }
+        }
+        buf = (char *)palloc0(width * n);
+        for (i = 0; i < n; i++)
+        {
+            ind[i] = values[i] == NULL ? SQL_NULL_DATA : SQL_NTS;
+            if (values[i] != NULL)
+            {
+                strcpy(buf + i * width, values[i]);
+            }
+        }
+        ret = SQLBindParameter(stmt, marker, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_VARCHAR,
+                               width, 0, buf, width, ind);
+        if (!SQL_SUCCEEDED(ret))
+        {
+            extract_error("SQLBindParameter", stmt, SQL_HANDLE_STMT, NULL, state->data.conn);
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("Cannot bind parameter %d for query %s", marker, state->data.query)));
+        }
+        marker++;
+    }
+    MemoryContextSwitchTo(oldcontext);
+
+    ret = SQLSetStmtAttr(stmt, SQL_ATTR_PARAMSET_SIZE, (SQLPOINTER)(SQLULEN)n, 0);
+    if (SQL_SUCCEEDED(ret))
+    {
+        INSTR_TIME_SET_CURRENT(start);
+        ret = SQLExecute(stmt);
+        accumTime(&state->data.counters.execute_time, start);
+        state->data.counters.queries++;
+    }
+    // with SQL_SUCCESS_WITH_INFO some rows of the array can still be rejected
+    for (i = 0; SQL_SUCCEEDED(ret) && i < n; i++)
+    {
+        if (state->status[i] == SQL_PARAM_ERROR)
+        {
+            ret = SQL_ERROR;
+        }
+    }
+    if (!SQL_SUCCEEDED(ret))
+    {
+        extract_error("SQLExecute", stmt, SQL_HANDLE_STMT, NULL, state->data.conn);
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Cannot insert %d rows, query %s", n, state->data.query)));
+    }
+}
+
+static void releaseModifyState(db2ModifyState *state)
+{
+    if (state == NULL)
+    {
+        return;
+    }
+    releaseStatement(&state->data);
+    closeConnection(&state->data);
+    // cached results do not reflect the inserted rows
+    invalidateResults(state->data.relid);
+}
+
+/*
+ * Only tables can be modified, sql_query is read-only
+ */
+static int db2_IsForeignRelUpdatable(Relation rel)
+{
+    db2FdwRelationInfo *fpinfo;
+
+    logdebug(__func__);
+    fpinfo = getTableOptions(RelationGetRelid(rel));
+    return fpinfo->table != NULL ? (1 << CMD_INSERT) | (1 << CMD_UPDATE) | (1 << CMD_DELETE) : 0;
+}
+
+static List *db2_PlanForeignModify(PlannerInfo *root, ModifyTable *plan, Index resultRelation, int subplan_index)
+{
+    RangeTblEntry *rte = planner_rt_fetch(resultRelation, root);
+    db2FdwRelationInfo *fpinfo;
+    Relation rel;
+    StringInfoData sql;
+    List *target_attrs;
+
+    logdebug(__func__);
+    // UPDATE and DELETE not accepted by PlanDirectModify
+    if (plan->operation == CMD_UPDATE || plan->operation == CMD_DELETE)
+    {
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("%s of foreign table can be executed only as a single DB2 statement",
+                        plan->operation == CMD_UPDATE ? "UPDATE" : "DELETE"),
+                 errhint("Conditions and assigned values should be evaluated by DB2, RETURNING and row triggers are not supported")));
+    }
+    if (plan->operation != CMD_INSERT)
+    {
+        elog(ERROR, "unexpected operation: %d", (int)plan->operation);
+    }
+    if (plan->returningLists != NIL)
+    {
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("RETURNING is not supported by db2odbc_fdw")));
+    }
+    if (plan->onConflictAction != ONCONFLICT_NONE)
+    {
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("ON CONFLICT is not supported by db2odbc_fdw")));
+    }
+    fpinfo = getTableOptions(rte->relid);
+#if PG_VERSION_NUM >= 120000
+    rel = table_open(rte->relid, NoLock);
+#else
+    rel = heap_open(rte->relid, NoLock);
+#endif
+    initStringInfo(&sql);
+    db2DeparseInsertSql(&sql, rel, fpinfo, &target_attrs);
+#if PG_VERSION_NUM >= 120000
+    table_close(rel, NoLock);
+#else
+    heap_close(rel, NoLock);
+#endif
+    return list_make2(makeString(sql.data), target_attrs);
+}
+
+static void db2_BeginForeignModify(ModifyTableState *mtstate, ResultRelInfo *rinfo, List *fdw_private,
+                                   int subplan_index, int eflags)
+{
+    logdebug(__func__);
+    if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+    {
+        return;
+    }
+    rinfo->ri_FdwState = createModifyState(rinfo->ri_RelationDesc, mtstate->ps.state,
+                                           strVal(list_nth(fdw_private, FdwModifyPrivateInsertSql)),
+                                           (List *)list_nth(fdw_private, FdwModifyPrivateTargetAttrs));
+}
+
+static TupleTableSlot *db2_ExecForeignInsert(EState *estate, ResultRelInfo *rinfo, TupleTableSlot *slot,
+                                             TupleTableSlot *planSlot)
+{
+    logdebug(__func__);
+    execInsert((db2ModifyState *)rinfo->ri_FdwState, &slot, 1);
+    return slot;
+}
+
+static void db2_EndForeignModify(EState *estate, ResultRelInfo *rinfo)
+{
+    logdebug(__func__);
+    releaseModifyState((db2ModifyState *)rinfo->ri_FdwState);
+}
+
+#if PG_VERSION_NUM >= 110000
+
+/*
+ * COPY and rows routed to a foreign partition, the INSERT is deparsed at execution time
+ */
+static void db2_BeginForeignInsert(ModifyTableState *mtstate, ResultRelInfo *rinfo)
+{
+    Relation rel = rinfo->ri_RelationDesc;
+    StringInfoData sql;
+    List *target_attrs;
+
+    logdebug(__func__);
+    initStringInfo(&sql);
+    db2DeparseInsertSql(&sql, rel, getTableOptions(RelationGetRelid(rel)), &target_attrs);
+    rinfo->ri_FdwState = createModifyState(rel, mtstate->ps.state, sql.data, target_attrs);
+}
+
+static void db2_EndForeignInsert(EState *estate, ResultRelInfo *rinfo)
+{
+    logdebug(__func__);
+    releaseModifyState((db2ModifyState *)rinfo->ri_FdwState);
+}
+
+#endif
+
+#if PG_VERSION_NUM >= 140000
+
+/*
+ * Rows are sent one by one if RETURNING or row triggers need them immediately
+ */
+static int db2_GetForeignModifyBatchSize(ResultRelInfo *rinfo)
+{
+    db2ModifyState *state = (db2ModifyState *)rinfo->ri_FdwState;
+
+    logdebug(__func__);
+    if (rinfo->ri_projectReturning != NULL ||
+        (rinfo->ri_TrigDesc != NULL &&
+         (rinfo->ri_TrigDesc->trig_insert_before_row || rinfo->ri_TrigDesc->trig_insert_after_row)))
+    {
+        return 1;
+    }
+    // called also by EXPLAIN when the modify state is not created
+    return state != NULL ? state->batch_size : getInsertBatchSize(RelationGetRelid(rinfo->ri_RelationDesc));
+}
+
+static TupleTableSlot **db2_ExecForeignBatchInsert(EState *estate, ResultRelInfo *rinfo, TupleTableSlot **slots,
+                                                   TupleTableSlot **planSlots, int *numSlots)
+{
+    logdebug(__func__);
+    execInsert((db2ModifyState *)rinfo->ri_FdwState, slots, *numSlots);
+    return slots;
+}
+
+#endif
+
+static void db2_ExplainForeignModify(ModifyTableState *mtstate, ResultRelInfo *rinfo, List *fdw_private,
+                                     int subplan_index, ExplainState *es)
+{
+    logdebug(__func__);
+    ExplainPropertyText("Remote SQL", strVal(list_nth(fdw_private, FdwModifyPrivateInsertSql)), es);
+#if PG_VERSION_NUM >= 140000
+    if (es->verbose && rinfo->ri_BatchSize > 0)
+    {
+        ExplainPropertyInteger("Batch Size", NULL, rinfo->ri_BatchSize, es);
+    }
+#endif
+}
+
+// -------------------------------------------
+// UPDATE and DELETE
+// -------------------------------------------
+
+/*
+ * UPDATE and DELETE are executed only directly, DB2 table has no row identifier to modify
+ * the rows one by one. The callbacks are required to accept the foreign table as result relation
+ */
+static TupleTableSlot *db2_ExecForeignUpdate(EState *estate, ResultRelInfo *rinfo, TupleTableSlot *slot,
+                                             TupleTableSlot *planSlot)
+{
+    elog(ERROR, "UPDATE of foreign table is executed only as a single DB2 statement");
+    return NULL;
+}
+
+static TupleTableSlot *db2_ExecForeignDelete(EState *estate, ResultRelInfo *rinfo, TupleTableSlot *slot,
+                                             TupleTableSlot *planSlot)
+{
+    elog(ERROR, "DELETE of foreign table is executed only as a single DB2 statement");
+    return NULL;
+}
+
+/*
+ * ForeignScan of the result relation, NULL if the subplan is anything else
+ */
+static ForeignScan *findModifySubplan(ModifyTable *plan, Index resultRelation, int subplan_index)
+{
+    Plan *subplan;
+
+#if PG_VERSION_NUM >= 140000
+    subplan = outerPlan(plan);
+    // inherited UPDATE or DELETE, every result relation is scanned by a child of Append
+    if (IsA(subplan, Result) && outerPlan(subplan) != NULL && IsA(outerPlan(subplan), Append))
+    {
+        subplan = outerPlan(subplan);
+    }
+    if (IsA(subplan, Append) && subplan_index < list_length(((Append *)subplan)->appendplans))
+    {
+        subplan = (Plan *)list_nth(((Append *)subplan)->appendplans, subplan_index);
+    }
+#else
+    subplan = (Plan *)list_nth(plan->plans, subplan_index);
+#endif
+    if (IsA(subplan, ForeignScan) && ((ForeignScan *)subplan)->scan.scanrelid == resultRelation)
+    {
+        return (ForeignScan *)subplan;
+    }
+    return NULL;
+}
+
+/*
+ * Replace the scan of the result relation with a single UPDATE or DELETE statement
+ * Possible if all conditions and assigned values are evaluated by DB2
+ */
+static bool db2_PlanDirectModify(PlannerInfo *root, ModifyTable *plan, Index resultRelation, int subplan_index)
+{
+    RelOptInfo *baserel;
+    db2FdwRelationInfo *fpinfo;
+    ForeignScan *fscan;
+    List *target_attrs = NIL;
+    List *exprs = NIL;
+    List *params_list = NIL;
+    StringInfoData sql;
+    ListCell *lc, *lc2;
+    bool recheck;
+
+    logdebug(__func__);
+    if (plan->operation != CMD_UPDATE && plan->operation != CMD_DELETE)
+    {
+        return false;
+    }
+    if (plan->returningLists != NIL)
+    {
+        return false;
+    }
+    fscan = findModifySubplan(plan, resultRelation, subplan_index);
+    if (fscan == NULL)
+    {
+        return false;
+    }
+    // conditions evaluated locally need the rows
+    if (fscan->scan.plan.qual != NIL)
+    {
+        return false;
+    }
+    baserel = root->simple_rel_array[resultRelation];
+    fpinfo = (db2FdwRelationInfo *)baserel->fdw_private;
+    // batched lookup executes the statement many times with different markers
+    if (fpinfo->table == NULL || fpinfo->batch_cond != NULL)
+    {
+        return false;
+    }
+    // row triggers need the rows
+    {
+        RangeTblEntry *rte = planner_rt_fetch(resultRelation, root);
+        Relation rel;
+        TriggerDesc *trigdesc;
+        bool row_triggers;
+
+#if PG_VERSION_NUM >= 120000
+        rel = table_open(rte->relid, NoLock);
+#else
+        rel = heap_open(rte->relid, NoLock);
+#endif
+        trigdesc = rel->trigdesc;
+        row_triggers = trigdesc != NULL &&
+                       (plan->operation == CMD_UPDATE
+                            ? (trigdesc->trig_update_before_row || trigdesc->trig_update_after_row)
+                            : (trigdesc->trig_delete_before_row || trigdesc->trig_delete_after_row));
+#if PG_VERSION_NUM >= 120000
+        table_close(rel, NoLock);
+#else
+        heap_close(rel, NoLock);
+#endif
+        if (row_triggers)
+        {
+            return false;
+        }
+    }
+
+    if (plan->operation == CMD_UPDATE)
+    {
+#if PG_VERSION_NUM >= 140000
+        List *processed_tlist;
+
+        get_translated_update_targetlist(root, resultRelation, &processed_tlist, &target_attrs);
+        foreach (lc, processed_tlist)
+        {
+            exprs = lappend(exprs, lfirst_node(TargetEntry, lc)->expr);
+        }
+#else
+        RangeTblEntry *rte = planner_rt_fetch(resultRelation, root);
+        int col = -1;
+
+        while ((col = bms_next_member(rte->updatedCols, col)) >= 0)
+        {
+            AttrNumber attno = col + FirstLowInvalidHeapAttributeNumber;
+            TargetEntry *tle = get_tle_by_resno(fscan->scan.plan.targetlist, attno);
+
+            if (tle == NULL)
+            {
+                elog(ERROR, "attribute number %d not found in subplan targetlist", attno);
+            }
+            target_attrs = lappend_int(target_attrs, attno);
+            exprs = lappend(exprs, tle->expr);
+        }
+#endif
+        forboth (lc, target_attrs, lc2, exprs)
+        {
+            Expr *expr = (Expr *)lfirst(lc2);
+
+            if (lfirst_int(lc) <= InvalidAttrNumber)
+            {
+                elog(ERROR, "system-column update is not supported");
+            }
+            if (IsA(expr, Const) && ((Const *)expr)->constisnull)
+            {
+                continue;
+            }
+            // assigned value has to be exact
+            if (!db2IsForeignExpr(root, baserel, expr, &recheck) || recheck)
+            {
+                return false;
+            }
+        }
+    }
+
+    initStringInfo(&sql);
+    if (plan->operation == CMD_UPDATE)
+    {
+        db2DeparseUpdateSql(&sql, root, baserel, target_attrs, exprs, fpinfo->remote_conds, &params_list);
+    }
+    else
+    {
+        db2DeparseDeleteSql(&sql, root, baserel, fpinfo->remote_conds, &params_list);
+    }
+    logdebug("Remote SQL: %s", sql.data);
+
+    fscan->operation = plan->operation;
+#if PG_VERSION_NUM >= 140000
+    fscan->resultRelation = resultRelation;
+#endif
+    fscan->fdw_exprs = params_list;
+    fscan->fdw_private = list_make3(makeString(sql.data), makeInteger((int)fpinfo->relid),
+                                    makeInteger(plan->canSetTag));
+    return true;
+}
+
+static void db2_BeginDirectModify(ForeignScanState *node, int eflags)
+{
+    ForeignScan *fsplan = (ForeignScan *)node->ss.ps.plan;
+    db2DirectModifyState *state;
+
+    logdebug(__func__);
+    if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+    {
+        return;
+    }
+    state = (db2DirectModifyState *)palloc0(sizeof(db2DirectModifyState));
+    state->data.query = strVal(list_nth(fsplan->fdw_private, FdwDirectModifyPrivateSql));
+    state->data.relid = (Oid)intVal(list_nth(fsplan->fdw_private, FdwDirectModifyPrivateRelid));
+    state->data.batch_param = -1;
+    state->data.write = true;
+    state->set_processed = intVal(list_nth(fsplan->fdw_private, FdwDirectModifyPrivateSetProcessed));
+    prepareParams(node, &state->data, fsplan->fdw_exprs);
+    node->fdw_state = state;
+}
+
+/*
+ * The statement is executed by the first call, no rows are returned
+ */
+static TupleTableSlot *db2_IterateDirectModify(ForeignScanState *node)
+{
+    db2DirectModifyState *state = (db2DirectModifyState *)node->fdw_state;
+    SQLLEN rows = 0;
+
+    logdebug(__func__);
+    if (!state->executed)
+    {
+        evaluateParams(node, &state->data);
+        executeQuery(&state->data, state->data.relid);
+        state->executed = true;
+        if (!SQL_SUCCEEDED(SQLRowCount(state->data.stmt, &rows)) || rows < 0)
+        {
+            rows = 0;
+        }
+        logdebug("Rows affected: %ld", (long)rows);
+        releaseStatement(&state->data);
+        invalidateResults(state->data.relid);
+        if (state->set_processed)
+        {
+            node->ss.ps.state->es_processed += rows;
+        }
+        if (node->ss.ps.instrument != NULL)
+        {
+            node->ss.ps.instrument->tuplecount += rows;
+        }
+    }
+    return ExecClearTuple(node->ss.ss_ScanTupleSlot);
+}
+
+static void db2_EndDirectModify(ForeignScanState *node)
+{
+    db2DirectModifyState *state = (db2DirectModifyState *)node->fdw_state;
+
+    logdebug(__func__);
+    if (state != NULL && state->executed)
+    {
+        closeConnection(&state->data);
+    }
+}
+
+static void db2_ExplainDirectModify(ForeignScanState *node, ExplainState *es)
+{
+    ForeignScan *fsplan = (ForeignScan *)node->ss.ps.plan;
+
+    logdebug(__func__);
+    ExplainPropertyText("Remote SQL", strVal(list_nth(fsplan->fdw_private, FdwDirectModifyPrivateSql)), es);
+}
+
+/*
+ * Statistics of DB2 table read from SYSCAT.TABLES and SYSCAT.COLUMNS
+ * The result is cached, the planner asks for the same table many times while planning one statement
+ */
+static db2EstimateCacheEntry *getRemoteEstimate(RelOptInfo *baserel)
+{
+    db2FdwRelationInfo *fpinfo = (db2FdwRelationInfo *)baserel->fdw_private;
+    db2EstimateCacheEntry *entry;
+    db2PrivateData data;
+    StringInfoData sql;
+    SQLRETURN ret;
+    bool found;
+    int i;
+
+    logdebug(__func__);
+    if (estimateCache == NULL)
+    {
+        HASHCTL ctl;
+
+        memset(&ctl, 0, sizeof(ctl));
+        ctl.keysize = sizeof(Oid);
+        ctl.entrysize = sizeof(db2EstimateCacheEntry);
+        estimateCache = hash_create("db2odbc_fdw remote estimates", 8, &ctl, HASH_ELEM | HASH_BLOBS);
+    }
+    entry = (db2EstimateCacheEntry *)hash_search(estimateCache, &fpinfo->relid, HASH_ENTER, &found);
+    if (!found)
+    {
+        entry->stmt_start = 0;
+        entry->widths = NULL;
+    }
+    if (entry->stmt_start == GetCurrentStatementStartTimestamp() && entry->natts == fpinfo->natts)
+    {
+        logdebug("Remote estimate received from cache");
+        return entry;
+    }
+    // not valid until the catalog query succeeds
+    entry->stmt_start = 0;
+    if (entry->widths != NULL)
+    {
+        pfree(entry->widths);
+    }
+    entry->natts = fpinfo->natts;
+    entry->widths = (int32 *)MemoryContextAlloc(CacheMemoryContext, sizeof(int32) * (entry->natts + 1));
+    for (i = 0; i < entry->natts; i++)
+    {
+        entry->widths[i] = -1;
+    }
+    entry->tuples = -1;
+
+    initStringInfo(&sql);
+    db2DeparseEstimateSql(&sql, baserel);
+    logdebug("Remote estimate SQL: %s", sql.data);
+
+    memset(&data, 0, sizeof(data));
+    getConnection(&data, fpinfo->relid);
+    allocStatement(&data);
+    ret = SQLExecDirect(data.stmt, (SQLCHAR *)sql.data, SQL_NTS);
+    if (!SQL_SUCCEEDED(ret))
+    {
+        extract_error("SQLExecDirect", data.stmt, SQL_HANDLE_STMT, NULL, data.conn);
+        releaseStatement(&data);
+        closeConnection(&data);
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("Cannot execute query %s", sql.data),
+                 errhint("Remote estimate reads SYSCAT.TABLES and SYSCAT.COLUMNS, set %s to false if not accessible",
+                         USEREMOTEESTIMATE)));
+    }
+    while (SQL_SUCCEEDED(ret = SQLFetch(data.stmt)))
+    {
+        SQLDOUBLE card;
+        SQLINTEGER attno;
+        SQLINTEGER avgcollen;
+        SQLLEN card_ind;
+        SQLLEN attno_ind;
+        SQLLEN avgcollen_ind;
+
+        SQLGetData(data.stmt, 1, SQL_C_DOUBLE, &card, 0, &card_ind);
+        SQLGetData(data.stmt, 2, SQL_C_SLONG, &attno, 0, &attno_ind);
+        SQLGetData(data.stmt, 3, SQL_C_SLONG, &avgcollen, 0, &avgcollen_ind);
+        // CARD and AVGCOLLEN are -1 if RUNSTATS was not run
+        if (card_ind != SQL_NULL_DATA && card >= 0)
+        {
+            entry->tuples = card;
+        }
+        if (attno_ind != SQL_NULL_DATA && attno >= 1 && attno <= entry->natts &&
+            avgcollen_ind != SQL_NULL_DATA && avgcollen >= 0)
+        {
+            entry->widths[attno - 1] = avgcollen;
+        }
+    }
+    releaseStatement(&data);
+    closeConnection(&data);
+    logdebug("Remote estimate: %.0f rows", entry->tuples);
+    entry->stmt_start = GetCurrentStatementStartTimestamp();
+    return entry;
+}
+
+/*
+ * Number of rows and width of the columns retrieved
+ * DB2 catalog is used if use_remote_estimate is set, otherwise statistics gathered by ANALYZE
+ */
+static void estimateRelSize(PlannerInfo *root, RelOptInfo *baserel)
+{
+    db2FdwRelationInfo *fpinfo = (db2FdwRelationInfo *)baserel->fdw_private;
+    bool estimated = false;
+
+    // catalog statistics are available only for table, not for sql_query
+    if (fpinfo->use_remote_estimate && fpinfo->table != NULL)
+    {
+        db2EstimateCacheEntry *entry = getRemoteEstimate(baserel);
+        bool have_wholerow = bms_is_member(0 - FirstLowInvalidHeapAttributeNumber, fpinfo->attrs_used);
+        int width = 0;
+        int i;
+
+        if (entry->tuples >= 0)
+        {
+            baserel->tuples = entry->tuples;
+            estimated = true;
+        }
+        for (i = 1; i <= entry->natts && width >= 0; i++)
+        {
+            if (!have_wholerow && !bms_is_member(i - FirstLowInvalidHeapAttributeNumber, fpinfo->attrs_used))
+            {
+                continue;
+            }
+            width = entry->widths[i - 1] < 0 ? -1 : width + entry->widths[i - 1];
+        }
+        if (width > 0)
+        {
+#if PG_VERSION_NUM >= 90600
+            baserel->reltarget->width = width;
+#else
+            baserel->width = width;
+#endif
+        }
+    }
+    // never analyzed, assume 10 pages as for local table
+    if (!estimated && baserel->pages == 0 && baserel->tuples <= 0)
+    {
+#if PG_VERSION_NUM >= 90600
+        int width = baserel->reltarget->width;
+#else
+        int width = baserel->width;
+#endif
+        baserel->pages = 10;
+        baserel->tuples = (10 * BLCKSZ) / (width + MAXALIGN(SizeofHeapTupleHeader));
+    }
+    fpinfo->retrieved_rows = clamp_row_est(baserel->tuples * clauselist_selectivity(root, fpinfo->remote_conds,
+                                                                                    baserel->relid, JOIN_INNER, NULL));
+    baserel->rows = clamp_row_est(baserel->tuples * clauselist_selectivity(root, baserel->baserestrictinfo,
+                                                                           baserel->relid, JOIN_INNER, NULL));
+    logdebug("Estimated rows: %.0f, retrieved from DB2: %.0f", baserel->rows, fpinfo->retrieved_rows);
+}
+
+/*
+ * Source of rows and planner options of the foreign table
+ */
+static db2FdwRelationInfo *getTableOptions(Oid foreigntableid)
+{
+    db2FdwRelationInfo *fpinfo;
+    ForeignTable *table;
+    ForeignServer *server;
+    List *options;
+    ListCell *lc;
+    char *partition_column = NULL;
+    Oid type;
+
+    logdebug(__func__);
+    fpinfo = (db2FdwRelationInfo *)palloc0(sizeof(db2FdwRelationInfo));
+    fpinfo->relid = foreigntableid;
+    fpinfo->use_remote_estimate = false;
+    fpinfo->fdw_startup_cost = DEFAULT_FDW_STARTUP_COST;
+    fpinfo->fdw_tuple_cost = DEFAULT_FDW_TUPLE_COST;
+    fpinfo->lookup_batch_size = DEFAULT_LOOKUP_BATCH_SIZE;
+    table = GetForeignTable(foreigntableid);
+    server = GetForeignServer(table->serverid);
+
+    // table options come after server options, table level wins
+    options = NIL;
+    options = list_concat(options, server->options);
+    options = list_concat(options, table->options);
+    foreach (lc, options)
+    {
+        DefElem *def = (DefElem *)lfirst(lc);
+        if (strcmp(def->defname, USEREMOTEESTIMATE) == 0)
+        {
+            fpinfo->use_remote_estimate = defGetBoolean(def);
+        }
+        if (strcmp(def->defname, ASYNCCAPABLE) == 0)
+        {
+            fpinfo->async_capable = defGetBoolean(def);
+        }
+        if (strcmp(def->defname, FDWSTARTUPCOST) == 0)
+        {
+            fpinfo->fdw_startup_cost = checkNonNegativeReal(def);
+        }
+        if (strcmp(def->defname, FDWTUPLECOST) == 0)
+        {
+            fpinfo->fdw_tuple_cost = checkNonNegativeReal(def);
+        }
+        if (strcmp(def->defname, LOOKUPBATCHSIZE) == 0)
+        {
+            fpinfo->lookup_batch_size = (int)checkPositiveInt(def);
+        }
+        if (strcmp(def->defname, QUERY) == 0)
+        {
+            fpinfo->query = defGetString(def);
+            logdebug("QUERY: %s", fpinfo->query);
+        }
+        if (strcmp(def->defname, TABLE) == 0)
+        {
+            fpinfo->table = defGetString(def);
+            logdebug("TABLE: %s", fpinfo->table);
+        }
+        if (strcmp(def->defname, SCHEMA) == 0)
+        {
+            fpinfo->schema = defGetString(def);
+            logdebug("SCHEMA: %s", fpinfo->schema);
+        }
+        if (strcmp(def->defname, PARTITIONCOLUMN) == 0)
+        {
+            partition_column = defGetString(def);
+        }
+        if (strcmp(def->defname, PARTITIONS) == 0)
+        {
+            fpinfo->slices = (int)checkPositiveInt(def);
+        }
+        if (strcmp(def->defname, CACHETTL) == 0)
+        {
+            fpinfo->cache_ttl = (int)checkPositiveInt(def);
+        }
+    }
+    fpinfo->partition_attno = InvalidAttrNumber;
+    if (partition_column != NULL)
+    {
+        fpinfo->partition_attno = get_attnum(foreigntableid, partition_column);
+        if (fpinfo->partition_attno <= 0)
+        {
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_COLUMN_NAME_NOT_FOUND),
+                     errmsg("column \"%s\" of option %s not found in foreign table", partition_column, PARTITIONCOLUMN)));
+        }
+        type = get_atttype(foreigntableid, fpinfo->partition_attno);
+        if (type != INT2OID && type != INT4OID && type != INT8OID)
+        {
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+                     errmsg("column \"%s\" of option %s should be of integer type", partition_column, PARTITIONCOLUMN)));
+        }
+        if (fpinfo->slices == 0)
+        {
+            fpinfo->slices = DEFAULT_PARTITIONS;
+        }
+    }
+    return fpinfo;
+}
+
+static void db2_GetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid)
+{
+    db2FdwRelationInfo *fpinfo;
+    ListCell *lc;
+
+    logdebug(__func__);
+
+    fpinfo = getTableOptions(foreigntableid);
+    fpinfo->natts = baserel->max_attr;
+    baserel->fdw_private = (void *)fpinfo;
+    db2ClassifyConditions(root, baserel, baserel->baserestrictinfo, &fpinfo->remote_conds, &fpinfo->local_conds);
+    // result of batched lookup is a concatenation of batches, it cannot be joined, grouped or sorted by DB2
+    fpinfo->pushdown_safe = fpinfo->batch_cond == NULL;
+
+    // columns needed locally: target list and conditions not evaluated by DB2
+    fpinfo->attrs_used = NULL;
+#if PG_VERSION_NUM >= 90600
+    pull_varattnos((Node *)baserel->reltarget->exprs, baserel->relid, &fpinfo->attrs_used);
+#else
+    pull_varattnos((Node *)baserel->reltargetlist, baserel->relid, &fpinfo->attrs_used);
+#endif
+    foreach (lc, fpinfo->local_conds)
+    {
+        RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+        pull_varattnos((Node *)rinfo->clause, baserel->relid, &fpinfo->attrs_used);
+    }
+
+    estimateRelSize(root, baserel);
+}
+
+/*
+ * Cost of remote statement: DB2 reads input_rows, rows are transferred and local conditions applied
+ */
+static void db2_EstimateCosts(PlannerInfo *root, RelOptInfo *rel, double input_rows, double rows,
+                              Cost *startup_cost, Cost *total_cost)
+{
+    db2FdwRelationInfo *fpinfo = (db2FdwRelationInfo *)rel->fdw_private;
+    QualCost local_cost;
+
+    logdebug("----> starting %s", __func__);
+
+    cost_qual_eval(&local_cost, fpinfo->local_conds, root);
+    *startup_cost = fpinfo->fdw_startup_cost + local_cost.startup;
+    *total_cost = *startup_cost + input_rows * cpu_tuple_cost +
+                  rows * (fpinfo->fdw_tuple_cost + cpu_tuple_cost + local_cost.per_tuple);
+
+    logdebug("----> finishing %s", __func__);
+}
+
+/*
+ * Callback argument for generate_implied_equalities_for_column
+ */
+typedef struct ecMemberForeignArg
+{
+    // expression of the relation to find equalities for
+    Expr *current;
+    // expressions already processed
+    List *already_used;
+} ecMemberForeignArg;
+
+static bool ecMemberMatchesForeign(PlannerInfo *root, RelOptInfo *rel, EquivalenceClass *ec,
+                                   EquivalenceMember *em, void *arg)
+{
+    ecMemberForeignArg *state = (ecMemberForeignArg *)arg;
+    Expr *expr = em->em_expr;
+
+    if (state->current != NULL)
+    {
+        return equal(expr, state->current);
+    }
+    if (list_member(state->already_used, expr))
+    {
+        return false;
+    }
+    state->current = expr;
+    return true;
+}
+
+/*
+ * Parameterization for join clause evaluated by DB2, NULL if not possible
+ */
+static ParamPathInfo *joinClauseParamInfo(PlannerInfo *root, RelOptInfo *baserel, RestrictInfo *rinfo)
+{
+    Relids required_outer;
+    bool recheck;
+
+    if (!join_clause_is_movable_to(rinfo, baserel))
+    {
+        return NULL;
+    }
+    if (!db2IsForeignExpr(root, baserel, rinfo->clause, &recheck))
+    {
+        return NULL;
+    }
+    required_outer = bms_union(rinfo->clause_relids, baserel->lateral_relids);
+    required_outer = bms_del_member(required_outer, baserel->relid);
+    if (bms_is_empty(required_outer))
+    {
+        return NULL;
+    }
+    return get_baserel_parampathinfo(root, baserel, required_outer);
+}
+
+/*
+ * Paths with join keys of the outer relation bound as parameters, used by nested loop
+ * DB2 is expected to find the rows by index, so only matching rows are read
+ */
+static void addParameterizedPaths(PlannerInfo *root, RelOptInfo *baserel)
+{
+    List *ppi_list = NIL;
+    ListCell *lc;
+
+    logdebug(__func__);
+    foreach (lc, baserel->joininfo)
+    {
+        ParamPathInfo *param_info = joinClauseParamInfo(root, baserel, (RestrictInfo *)lfirst(lc));
+
+        if (param_info != NULL)
+        {
+            ppi_list = list_append_unique_ptr(ppi_list, param_info);
+        }
+    }
+    // equi-join clauses are kept in equivalence classes
+    if (baserel->has_eclass_joins)
+    {
+        ecMemberForeignArg arg;
+
+        arg.already_used = NIL;
+        for (;;)
+        {
+            List *clauses;
+
+            arg.current = NULL;
+            clauses = generate_implied_equalities_for_column(root, baserel, ecMemberMatchesForeign,
+                                                             (void *)&arg, baserel->lateral_referencers);
+            if (arg.current == NULL)
+            {
+                break;
+            }
+            foreach (lc, clauses)
+            {
+                ParamPathInfo *param_info = joinClauseParamInfo(root, baserel, (RestrictInfo *)lfirst(lc));
+
+                if (param_info != NULL)
+                {
+                    ppi_list = list_append_unique_ptr(ppi_list, param_info);
+                }
+            }
+            arg.already_used = lappend(arg.already_used, arg.current);
+        }
+    }
+    foreach (lc, ppi_list)
+    {
+        ParamPathInfo *param_info = (ParamPathInfo *)lfirst(lc);
+        double rows = get_parameterized_baserel_size(root, baserel, param_info->ppi_clauses);
+        Cost startup_cost;
+        Cost total_cost;
+        Path *path;
+
+        db2_EstimateCosts(root, baserel, rows, rows, &startup_cost, &total_cost);
+        path = (Path *)create_foreignscan_path(root, baserel,
+#if PG_VERSION_NUM >= 90600
+                                               NULL, /* PathTarget */
+#endif
+                                               rows,
+                                               startup_cost,
+                                               total_cost,
+                                               NIL, /* no pathkeys */
+                                               param_info->ppi_req_outer,
+                                               NULL, /* no extra plan */
+                                               NIL /* no fdw_private list */);
+        add_path(baserel, path);
+    }
+}
+
+/*
+ * Share of rows returned by one participant, the same as get_parallel_divisor of the planner
+ */
+static double parallelDivisor(int workers)
+{
+    double divisor = workers;
+    double leader_contribution;
+
+    if (parallel_leader_participation)
+    {
+        leader_contribution = 1.0 - (0.3 * workers);
+        if (leader_contribution > 0)
+        {
+            divisor += leader_contribution;
+        }
+    }
+    return divisor;
+}
+
+/*
+ * Partial path of parallel scan, every participant reads slices MOD(partition_column, slices)
+ * The number of workers is limited by the number of slices
+ */
+static void addPartialPath(PlannerInfo *root, RelOptInfo *baserel)
+{
+    db2FdwRelationInfo *fpinfo = (db2FdwRelationInfo *)baserel->fdw_private;
+    ForeignPath *path;
+    Cost startup_cost;
+    Cost total_cost;
+    int workers;
+    double divisor;
+
+    if (fpinfo->partition_attno == InvalidAttrNumber || !baserel->consider_parallel)
+    {
+        return;
+    }
+    workers = Min(fpinfo->slices, max_parallel_workers_per_gather);
+    if (workers <= 0)
+    {
+        return;
+    }
+    logdebug("Add partial path, %d workers", workers);
+    divisor = parallelDivisor(workers);
+    db2_EstimateCosts(root, baserel, baserel->tuples / divisor, fpinfo->retrieved_rows / divisor,
+                      &startup_cost, &total_cost);
+    path = create_foreignscan_path(root, baserel,
+#if PG_VERSION_NUM >= 90600
+                                   NULL, /* PathTarget */
+#endif
+                                   clamp_row_est(baserel->rows / divisor),
+                                   startup_cost,
+                                   total_cost,
+                                   NIL,  /* no pathkeys */
+                                   NULL, /* no outer rel either */
+                                   NULL, /* no extra plan */
+                                   NIL /* no fdw_private list */);
+    path->path.parallel_aware = true;
+    path->path.parallel_workers = workers;
+    add_partial_path(baserel, (Path *)path);
+}
+
+static void db2_GetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid)
+{
+    db2FdwRelationInfo *fpinfo = (db2FdwRelationInfo *)baserel->fdw_private;
+    Cost startup_cost;
+    Cost total_cost;
+    Path *path;
+
+    logdebug("----> starting %s", __func__);
+    logdebug("baserel 1 %p", baserel->pathlist);
+
+    db2_EstimateCosts(root, baserel, baserel->tuples, fpinfo->retrieved_rows, &startup_cost, &total_cost);
+
+    logdebug("Before create path");
+
+    path = (Path *)create_foreignscan_path(root, baserel,
+#if PG_VERSION_NUM >= 90600
+                                                NULL, /* PathTarget */
+#endif
+                                                baserel->rows,
+                                                startup_cost,
+                                                total_cost,
+                                                NIL,  /* no pathkeys */
+                                                NULL, /* no outer rel either */
+                                                NULL, /* no extra plan */
+                                                NIL /* no fdw_private list */);
+
+
+    add_path(baserel, path);
+
+    // presorted path, ORDER BY evaluated by DB2
+    fpinfo->qp_is_pushdown_safe = root->query_pathkeys != NIL && fpinfo->batch_cond == NULL &&
+                                  db2IsShippablePathkeys(root, baserel, root->query_pathkeys);
+    if (fpinfo->qp_is_pushdown_safe)
+    {
+        logdebug("Add presorted path");
+        path = (Path *)create_foreignscan_path(root, baserel,
+#if PG_VERSION_NUM >= 90600
+                                               NULL, /* PathTarget */
+#endif
+                                               baserel->rows,
+                                               startup_cost * DEFAULT_FDW_SORT_MULTIPLIER,
+                                               total_cost * DEFAULT_FDW_SORT_MULTIPLIER,
+                                               root->query_pathkeys,
+                                               NULL, /* no outer rel either */
+                                               NULL, /* no extra plan */
+                                               NIL /* no fdw_private list */);
+        add_path(baserel, path);
+    }
+
+    addPartialPath(root, baserel);
+    addParameterizedPaths(root, baserel);
+
+    logdebug("----> finishing %s", __func__);
+}
+
+#if PG_VERSION_NUM >= 120000
+
+/*
+ * Check if the join can be evaluated by DB2 and classify join conditions
+ * The planner calls GetForeignJoinPaths only for relations of the same server and user mapping,
+ * so all tables are read by the same connection
+ */
+static bool foreignJoinOk(PlannerInfo *root, RelOptInfo *joinrel, JoinType jointype, RelOptInfo *outerrel,
+                          RelOptInfo *innerrel, JoinPathExtraData *extra)
+{
+    db2FdwRelationInfo *fpinfo = (db2FdwRelationInfo *)joinrel->fdw_private;
+    db2FdwRelationInfo *fpinfo_o = (db2FdwRelationInfo *)outerrel->fdw_private;
+    db2FdwRelationInfo *fpinfo_i = (db2FdwRelationInfo *)innerrel->fdw_private;
+    List *vars;
+    ListCell *lc;
+    bool recheck;
+
+    logdebug(__func__);
+    if (jointype != JOIN_INNER && jointype != JOIN_LEFT && jointype != JOIN_RIGHT)
+    {
+        return false;
+    }
+    if (fpinfo_o == NULL || fpinfo_i == NULL || !fpinfo_o->pushdown_safe || !fpinfo_i->pushdown_safe)
+    {
+        return false;
+    }
+    // local conditions of joined relations should be applied before the join
+    if (fpinfo_o->local_conds != NIL || fpinfo_i->local_conds != NIL)
+    {
+        return false;
+    }
+    // placeholders are computed locally at the join level
+    foreach (lc, root->placeholder_list)
+    {
+        PlaceHolderInfo *phinfo = lfirst_node(PlaceHolderInfo, lc);
+
+        if (bms_overlap(phinfo->ph_eval_at, joinrel->relids))
+        {
+            return false;
+        }
+    }
+    // whole-row and system columns are not retrieved from DB2
+    vars = pull_var_clause((Node *)joinrel->reltarget->exprs, PVC_RECURSE_PLACEHOLDERS);
+    foreach (lc, vars)
+    {
+        Var *var = (Var *)lfirst(lc);
+
+        if (!IsA(var, Var) || var->varattno <= 0)
+        {
+            return false;
+        }
+    }
+
+    foreach (lc, extra->restrictlist)
+    {
+        RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+        bool is_remote = db2IsForeignExpr(root, joinrel, rinfo->clause, &recheck);
+
+        if (IS_OUTER_JOIN(jointype) && !RINFO_IS_PUSHED_DOWN(rinfo, joinrel->relids))
+        {
+            // outer join clause decides which rows are null-extended, DB2 result should be exact
+            if (!is_remote || recheck)
+            {
+                return false;
+            }
+            fpinfo->joinclauses = lappend(fpinfo->joinclauses, rinfo);
+            continue;
+        }
+        if (!is_remote)
+        {
+            fpinfo->local_conds = lappend(fpinfo->local_conds, rinfo);
+            continue;
+        }
+        // conditions of inner join are placed in ON, filters over outer join in WHERE
+        if (jointype == JOIN_INNER)
+        {
+            fpinfo->joinclauses = lappend(fpinfo->joinclauses, rinfo);
+        }
+        else
+        {
+            fpinfo->remote_conds = lappend(fpinfo->remote_conds, rinfo);
+        }
+        if (recheck)
+        {
+            fpinfo->local_conds = lappend(fpinfo->local_conds, rinfo);
+        }
+    }
+
+    // conditions of joined relations: nullable side goes to ON, the other to WHERE
+    switch (jointype)
+    {
+    case JOIN_INNER:
+        fpinfo->remote_conds = list_concat(fpinfo->remote_conds, list_copy(fpinfo_o->remote_conds));
+        fpinfo->remote_conds = list_concat(fpinfo->remote_conds, list_copy(fpinfo_i->remote_conds));
+        break;
+    case JOIN_LEFT:
+        fpinfo->joinclauses = list_concat(fpinfo->joinclauses, list_copy(fpinfo_i->remote_conds));
+        fpinfo->remote_conds = list_concat(fpinfo->remote_conds, list_copy(fpinfo_o->remote_conds));
+        break;
+    case JOIN_RIGHT:
+        fpinfo->joinclauses = list_concat(fpinfo->joinclauses, list_copy(fpinfo_o->remote_conds));
+        fpinfo->remote_conds = list_concat(fpinfo->remote_conds, list_copy(fpinfo_i->remote_conds));
+        break;
+    default:
+        break;
+    }
+
+    fpinfo->outerrel = outerrel;
+    fpinfo->innerrel = innerrel;
+    fpinfo->jointype = jointype;
+    fpinfo->relid = fpinfo_o->relid;
+    fpinfo->fdw_startup_cost = fpinfo_o->fdw_startup_cost;
+    fpinfo->fdw_tuple_cost = fpinfo_o->fdw_tuple_cost;
+    fpinfo->async_capable = fpinfo_o->async_capable && fpinfo_i->async_capable;
+    return true;
+}
+
+/*
+ * Join of foreign tables evaluated by DB2 as one statement
+ */
+static void db2_GetForeignJoinPaths(PlannerInfo *root, RelOptInfo *joinrel, RelOptInfo *outerrel,
+                                    RelOptInfo *innerrel, JoinType jointype, JoinPathExtraData *extra)
+{
+    db2FdwRelationInfo *fpinfo;
+    Cost startup_cost;
+    Cost total_cost;
+    Path *path;
+
+    logdebug("----> starting %s", __func__);
+    // the same join relation is offered for every order of input relations, the first one is used
+    if (joinrel->fdw_private != NULL)
+    {
+        return;
+    }
+    // EvalPlanQual recheck of joined rows is not supported
+    if (root->parse->commandType != CMD_SELECT || root->rowMarks != NIL)
+    {
+        return;
+    }
+    if (joinrel->reloptkind != RELOPT_JOINREL || !bms_is_empty(joinrel->lateral_relids))
+    {
+        return;
+    }
+    fpinfo = (db2FdwRelationInfo *)palloc0(sizeof(db2FdwRelationInfo));
+    fpinfo->pushdown_safe = false;
+    joinrel->fdw_private = fpinfo;
+    if (!foreignJoinOk(root, joinrel, jointype, outerrel, innerrel, extra))
+    {
+        return;
+    }
+    fpinfo->pushdown_safe = true;
+
+    fpinfo->retrieved_rows = joinrel->rows;
+    db2_EstimateCosts(root, joinrel, ((db2FdwRelationInfo *)outerrel->fdw_private)->retrieved_rows +
+                                         ((db2FdwRelationInfo *)innerrel->fdw_private)->retrieved_rows,
+                      fpinfo->retrieved_rows, &startup_cost, &total_cost);
+
+    path = (Path *)create_foreign_join_path(root, joinrel,
+                                            NULL, /* default pathtarget */
+                                            joinrel->rows,
+                                            startup_cost,
+                                            total_cost,
+                                            NIL,  /* no pathkeys */
+                                            NULL, /* no required_outer */
+                                            NULL, /* no epq_path */
+                                            NIL /* no fdw_private list */);
+    add_path(joinrel, path);
+    logdebug("----> finishing %s", __func__);
+}
+
+/*
+ * ORDER BY of the query over base relation is pushed down by the presorted path
+ * Ordered relation only records if it is safe, the sort is added together with LIMIT
+ */
+static void addForeignOrderedPaths(PlannerInfo *root, RelOptInfo *input_rel, RelOptInfo *ordered_rel)
+{
+    db2FdwRelationInfo *ifpinfo = (db2FdwRelationInfo *)input_rel->fdw_private;
+    db2FdwRelationInfo *fpinfo = (db2FdwRelationInfo *)ordered_rel->fdw_private;
+
+    logdebug(__func__);
+    if (input_rel->reloptkind != RELOPT_BASEREL)
+    {
+        return;
+    }
+    fpinfo->outerrel = input_rel;
+    fpinfo->relid = ifpinfo->relid;
+    fpinfo->pushdown_safe = ifpinfo->qp_is_pushdown_safe;
+}
+
+/*
+ * LIMIT/OFFSET (with ORDER BY) pushed down as FETCH FIRST n ROWS ONLY
+ * The path is created for the underlying base relation, so the plan is still simple foreign scan
+ */
+static void addForeignFinalPaths(PlannerInfo *root, RelOptInfo *input_rel, RelOptInfo *final_rel,
+                                 FinalPathExtraData *extra)
+{
+    Query *parse = root->parse;
+    db2FdwRelationInfo *ifpinfo = (db2FdwRelationInfo *)input_rel->fdw_private;
+    db2FdwRelationInfo *fpinfo = (db2FdwRelationInfo *)final_rel->fdw_private;
+    List *pathkeys = NIL;
+    double rows;
+    Cost startup_cost;
+    Cost total_cost;
+    Path *path;
+
+    logdebug(__func__);
+    if (parse->commandType != CMD_SELECT || parse->rowMarks != NIL || parse->hasTargetSRFs)
+    {
+        return;
+    }
+    // without LIMIT there is nothing to add to the paths of the input relation
+    if (!extra->limit_needed)
+    {
+        return;
+    }
+    if (input_rel->reloptkind == RELOPT_UPPER_REL && ifpinfo->stage == UPPERREL_ORDERED)
+    {
+        input_rel = ifpinfo->outerrel;
+        ifpinfo = (db2FdwRelationInfo *)input_rel->fdw_private;
+        pathkeys = root->sort_pathkeys;
+    }
+    if (input_rel->reloptkind != RELOPT_BASEREL)
+    {
+        return;
+    }
+    // all rows returned by DB2 should be passed, FETCH FIRST cannot be applied before local filter
+    if (ifpinfo->local_conds != NIL)
     {
-        ereport(ERROR,
-                (errcode(ERRCODE_FDW_ERROR),
-                 errmsg("Cannot execute query %s", query),
-                 errhint("Check query syntax")));
+        return;
+    }
+#if PG_VERSION_NUM >= 130000
+    if (parse->limitOption == LIMIT_OPTION_WITH_TIES)
+    {
+        return;
+    }
+#endif
+    if (!db2IsShippableLimit(parse->limitCount) || !db2IsShippableLimit(parse->limitOffset))
+    {
+        return;
     }
+    fpinfo->outerrel = input_rel;
+    fpinfo->relid = ifpinfo->relid;
+    fpinfo->pushdown_safe = true;
 
-    ret = SQLNumResultCols(data->stmt, &data->no_columns);
-    if (!SQL_SUCCEEDED(ret))
+    rows = input_rel->rows;
+    if (extra->count_est > 0 && extra->count_est < rows)
     {
-        extract_error("SQLNumResultCols", data->stmt, SQL_HANDLE_STMT, NULL);
-        ereport(ERROR,
-                (errcode(ERRCODE_FDW_ERROR),
-                 errmsg("Cannot retrieve number of columns %s", query),
-                 errhint("Check query syntax")));
+        rows = extra->count_est;
     }
-    logdebug("Number of columns: %u", data->no_columns);
-    data->columnsbuf = palloc(data->no_columns * sizeof(db2ColumnDesc));
-    logdebug("Memory for buffor allocated");
-    data->values = palloc(sizeof(char *) * data->no_columns);
-    for (i = 0; i < data->no_columns; i++)
+    // cost of the scan the LIMIT would be applied to locally
+    db2_EstimateCosts(root, input_rel, input_rel->tuples, ifpinfo->retrieved_rows, &startup_cost, &total_cost);
+    if (pathkeys != NIL)
     {
-        SQLCHAR name[255];
-        SQLSMALLINT NameLengthPtr;
-        SQLSMALLINT DataTypePtr;
-        SQLSMALLINT DecimalDigitsPtr;
-        SQLSMALLINT NullablePtr;
-        ret = SQLDescribeCol(data->stmt,
-                             i + 1,
-                             name,
-                             sizeof(SQLCHAR) * sizeof(name),
-                             &NameLengthPtr,
-                             &DataTypePtr,
-                             &data->columnsbuf[i].columnsize,
-                             &DecimalDigitsPtr,
-                             &NullablePtr);
-        if (!SQL_SUCCEEDED(ret))
-        {
-            extract_error("SQLDescribeCol", data->stmt, SQL_HANDLE_STMT, NULL);
-            ereport(ERROR,
-                    (errcode(ERRCODE_FDW_ERROR),
-                     errmsg("Cannot retrieve column description for query %s", query),
-                     errhint("Check query syntax")));
-        }
-        logdebug("Number of bytes for column %s : %lu", name, data->columnsbuf[i].columnsize);
-        // important : for some reason it cause crash with declaration Size
-        // or putting expression directly in palloc invocation
-        size = sizeof(char) * (Size)data->columnsbuf[i].columnsize;
-        data->columnsbuf[i].buf = palloc(size);
-        logdebug("Memory for column buffer allocated");
-        data->values[i] = data->columnsbuf[i].buf;
-        data->columnsbuf[i].isNumber = false;
-        if ((DataTypePtr == SQL_DECIMAL) || (DataTypePtr == SQL_NUMERIC) || (DataTypePtr == SQL_REAL) ||
-            (DataTypePtr == SQL_DOUBLE) || (DataTypePtr == SQL_FLOAT))
-        {
-            logdebug("Decimal type");
-            data->columnsbuf[i].isNumber = true;
-        }
+        startup_cost *= DEFAULT_FDW_SORT_MULTIPLIER;
+        total_cost *= DEFAULT_FDW_SORT_MULTIPLIER;
+    }
+    // DB2 stops after OFFSET + FETCH FIRST rows, the run cost is reduced the same way as by local LIMIT
+    // and a little more, otherwise both paths cost the same and the rows skipped by OFFSET are transferred
+    if (extra->limit_tuples > 0 && extra->limit_tuples < ifpinfo->retrieved_rows)
+    {
+        total_cost = startup_cost + (total_cost - startup_cost) * extra->limit_tuples / ifpinfo->retrieved_rows * 0.95;
     }
-    data->attinmeta = TupleDescGetAttInMetadata(node->ss.ss_currentRelation->rd_att);
 
-    node->fdw_state = (void *)data;
+    path = (Path *)create_foreign_upper_path(root, input_rel,
+                                             root->upper_targets[UPPERREL_FINAL],
+                                             rows,
+                                             startup_cost,
+                                             total_cost,
+                                             pathkeys,
+                                             NULL, /* no extra plan */
+                                             list_make2(makeInteger(pathkeys != NIL), makeInteger(true)));
+    add_path(final_rel, path);
 }
 
 /*
- * fileIterateForeignScan
- *		Read next record from the data file and store it into the
- *		ScanTupleSlot as a virtual tuple
+ * Check if grouping and aggregation can be done by DB2, build the list of columns to retrieve
  */
-static TupleTableSlot *
-db2_IterateForeignScan(ForeignScanState *node)
+static bool foreignGroupingOk(PlannerInfo *root, RelOptInfo *grouped_rel, Node *havingQual)
 {
-    db2PrivateData *data;
-    SQLRETURN ret;
-    SQLSMALLINT i;
-    HeapTuple tuple;
-    TupleTableSlot *slot;
-
-    data = (db2PrivateData *)node->fdw_state;
-    ret = SQLFetch(data->stmt);
+    Query *query = root->parse;
+    PathTarget *grouping_target = grouped_rel->reltarget;
+    db2FdwRelationInfo *fpinfo = (db2FdwRelationInfo *)grouped_rel->fdw_private;
+    db2FdwRelationInfo *ofpinfo = (db2FdwRelationInfo *)fpinfo->outerrel->fdw_private;
+    List *tlist = NIL;
+    ListCell *lc;
+    bool recheck;
+    int i = 0;
 
     logdebug(__func__);
-    logdebug("SQLFetch %u", ret);
-    if (ret == SQL_NO_DATA_FOUND)
+    if (query->groupingSets)
     {
-        return NULL;
+        return false;
     }
-    if (!SQL_SUCCEEDED(ret))
+    // local conditions should be applied before grouping
+    if (ofpinfo->local_conds != NIL)
     {
-        extract_error("SQLFetch", data->stmt, SQL_HANDLE_STMT, NULL);
-        ereport(ERROR,
-                (errcode(ERRCODE_FDW_ERROR),
-                 errmsg("Cannot fetch next row"),
-                 errhint("Check query syntax")));
+        return false;
     }
-    slot = node->ss.ss_ScanTupleSlot;
-    ExecClearTuple(slot);
-    for (i = 0; i < data->no_columns; i++)
+    foreach (lc, grouping_target->exprs)
     {
-        SQLLEN indicator;
-        ret = SQLGetData(data->stmt, i + 1, SQL_C_CHAR,
-                         data->columnsbuf[i].buf, data->columnsbuf[i].columnsize, &indicator);
-        logdebug("GetData %s %u", data->columnsbuf[i].buf, i);
-        logdebug("Indicator %ld", indicator);
-        // for some reason indicator should be casted to int to have comparison correct
-        if ((int)indicator == SQL_NULL_DATA)
+        Expr *expr = (Expr *)lfirst(lc);
+        Index sgref = get_pathtarget_sortgroupref(grouping_target, i);
+
+        i++;
+        if (sgref && get_sortgroupref_clause_noerr(sgref, query->groupClause))
+        {
+            TargetEntry *tle;
+            Oid type = exprType((Node *)expr);
+
+            if (!db2IsForeignExpr(root, grouped_rel, expr, &recheck) || recheck)
+            {
+                return false;
+            }
+            // DB2 ignores trailing blanks when comparing VARCHAR values
+            if (type == TEXTOID || type == VARCHAROID)
+            {
+                return false;
+            }
+            tle = makeTargetEntry(expr, list_length(tlist) + 1, NULL, false);
+            tle->ressortgroupref = sgref;
+            tlist = lappend(tlist, tle);
+            continue;
+        }
+        if (db2IsForeignExpr(root, grouped_rel, expr, &recheck) && !recheck)
         {
-            data->values[i] = NULL;
+            tlist = add_to_flat_tlist(tlist, list_make1(expr));
         }
         else
         {
-            data->values[i] = data->columnsbuf[i].buf;
-            if (data->columnsbuf[i].isNumber)
+            // expression is computed locally from aggregates and grouping columns
+            List *aggvars = pull_var_clause((Node *)expr, PVC_INCLUDE_AGGREGATES);
+            ListCell *l;
+
+            foreach (l, aggvars)
             {
-                char *p;
-                logdebug("Decimal type, replace , with .");
-                while ((p = strrchr(data->values[i], ',')))
+                Expr *e = (Expr *)lfirst(l);
+                if (IsA(e, Aggref) && (!db2IsForeignExpr(root, grouped_rel, e, &recheck) || recheck))
                 {
-                    *p = '.';
+                    return false;
                 }
             }
+            tlist = add_to_flat_tlist(tlist, aggvars);
         }
-        if (!SQL_SUCCEEDED(ret))
+    }
+    // HAVING is pushed down as a whole
+    foreach (lc, (List *)havingQual)
+    {
+        Expr *expr = (Expr *)lfirst(lc);
+
+        if (!db2IsForeignExpr(root, grouped_rel, expr, &recheck) || recheck)
         {
-            extract_error("SQLGetData", data->stmt, SQL_HANDLE_STMT, NULL);
-            ereport(ERROR,
-                    (errcode(ERRCODE_FDW_ERROR),
-                     errmsg("Cannot get data for next column"),
-                     errhint("Check query syntax")));
+            return false;
         }
+        fpinfo->remote_conds = lappend(fpinfo->remote_conds, expr);
     }
-    tuple = BuildTupleFromCStrings(data->attinmeta, data->values);
-#if PG_VERSION_NUM < 120000
-    ExecStoreTuple(tuple, slot, InvalidBuffer, false);
-#else
-    ExecStoreHeapTuple(tuple, slot, false);
-#endif
-
-    return slot;
+    fpinfo->grouped_tlist = tlist;
+    return true;
 }
 
 /*
- * fileEndForeignScan
- *		Finish scanning foreign table and dispose objects used for this scan
+ * GROUP BY and aggregates evaluated by DB2, only grouped rows are transferred
  */
-static void
-db2_EndForeignScan(ForeignScanState *node)
+static void addForeignGroupingPaths(PlannerInfo *root, RelOptInfo *input_rel, RelOptInfo *grouped_rel,
+                                    GroupPathExtraData *extra)
 {
-    db2PrivateData *data;
+    Query *parse = root->parse;
+    db2FdwRelationInfo *ifpinfo = (db2FdwRelationInfo *)input_rel->fdw_private;
+    db2FdwRelationInfo *fpinfo = (db2FdwRelationInfo *)grouped_rel->fdw_private;
+    double numGroups;
+    Cost startup_cost;
+    Cost total_cost;
+    Path *path;
 
     logdebug(__func__);
-    data = (db2PrivateData *)node->fdw_state;
-    SQLFreeHandle(SQL_HANDLE_STMT, data->stmt);
-    closeConnection(data);
-}
+    if (!parse->groupClause && !parse->groupingSets && !parse->hasAggs && !root->hasHavingQual)
+    {
+        return;
+    }
+    // partial aggregation is not supported
+    if (extra->patype == PARTITIONWISE_AGGREGATE_PARTIAL || input_rel->reloptkind != RELOPT_BASEREL)
+    {
+        return;
+    }
+    fpinfo->outerrel = input_rel;
+    fpinfo->relid = ifpinfo->relid;
+    fpinfo->fdw_startup_cost = ifpinfo->fdw_startup_cost;
+    fpinfo->fdw_tuple_cost = ifpinfo->fdw_tuple_cost;
+    if (!foreignGroupingOk(root, grouped_rel, extra->havingQual))
+    {
+        return;
+    }
+    fpinfo->pushdown_safe = true;
 
-/*
- * fileReScanForeignScan
- *		Rescan table, possibly with new parameters
- */
-static void
-db2_ReScanForeignScan(ForeignScanState *node)
-{
-    logdebug(__func__);
-}
+    numGroups = 1;
+    if (parse->groupClause != NIL)
+    {
+        List *groupExprs = get_sortgrouplist_exprs(parse->groupClause, fpinfo->grouped_tlist);
+#if PG_VERSION_NUM >= 140000
+        numGroups = estimate_num_groups(root, groupExprs, input_rel->rows, NULL, NULL);
+#else
+        numGroups = estimate_num_groups(root, groupExprs, input_rel->rows, NULL);
+#endif
+    }
+    grouped_rel->rows = numGroups;
 
-static void db2_GetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid)
-{    
-    logdebug(__func__);
+    // DB2 reads and aggregates all input rows before the first group is returned
+    db2_EstimateCosts(root, grouped_rel, input_rel->tuples, numGroups, &startup_cost, &total_cost);
+    startup_cost += input_rel->tuples * cpu_tuple_cost + ifpinfo->retrieved_rows * cpu_operator_cost;
+    total_cost += ifpinfo->retrieved_rows * cpu_operator_cost;
 
-    baserel->rows = 0;
-    baserel->tuples = baserel->rows;
+    path = (Path *)create_foreign_upper_path(root, grouped_rel,
+                                             grouped_rel->reltarget,
+                                             numGroups,
+                                             startup_cost,
+                                             total_cost,
+                                             NIL,  /* no pathkeys */
+                                             NULL, /* no extra plan */
+                                             NIL /* no fdw_private list */);
+    add_path(grouped_rel, path);
 }
 
-static void db2_EstimateCosts(PlannerInfo *root, RelOptInfo *baserel, Cost *startup_cost, Cost *total_cost, Oid foreigntableid)
+static void db2_GetForeignUpperPaths(PlannerInfo *root, UpperRelationKind stage, RelOptInfo *input_rel,
+                                     RelOptInfo *output_rel, void *extra)
 {
+    db2FdwRelationInfo *ifpinfo = (db2FdwRelationInfo *)input_rel->fdw_private;
+    db2FdwRelationInfo *fpinfo;
 
     logdebug("----> starting %s", __func__);
+    if (ifpinfo == NULL || !ifpinfo->pushdown_safe)
+    {
+        return;
+    }
+    // skip unsupported stages and duplicate calls
+    if ((stage != UPPERREL_GROUP_AGG && stage != UPPERREL_ORDERED && stage != UPPERREL_FINAL) ||
+        output_rel->fdw_private != NULL)
+    {
+        return;
+    }
+    fpinfo = (db2FdwRelationInfo *)palloc0(sizeof(db2FdwRelationInfo));
+    fpinfo->pushdown_safe = false;
+    fpinfo->stage = stage;
+    fpinfo->async_capable = ifpinfo->async_capable;
+    output_rel->fdw_private = fpinfo;
 
-    /* Fetch the foreign table options */
-    //	odbcGetTableOptions(foreigntableid, &options);
-
-    //	odbcGetTableSize(&options, &table_size);
+    switch (stage)
+    {
+    case UPPERREL_GROUP_AGG:
+        addForeignGroupingPaths(root, input_rel, output_rel, (GroupPathExtraData *)extra);
+        break;
+    case UPPERREL_ORDERED:
+        addForeignOrderedPaths(root, input_rel, output_rel);
+        break;
+    case UPPERREL_FINAL:
+        addForeignFinalPaths(root, input_rel, output_rel, (FinalPathExtraData *)extra);
+        break;
+    default:
+        break;
+    }
+    logdebug("----> finishing %s", __func__);
+}
 
-    *startup_cost = 25;
+#endif
 
-    *total_cost = baserel->rows + *startup_cost;
+/*
+ * Columns retrieved by join: variables of the target list and of conditions evaluated locally
+ */
+static List *joinScanTlist(RelOptInfo *joinrel)
+{
+    db2FdwRelationInfo *fpinfo = (db2FdwRelationInfo *)joinrel->fdw_private;
+    List *tlist = NIL;
+    ListCell *lc;
 
-    logdebug("----> finishing %s", __func__);
+#if PG_VERSION_NUM >= 90600
+    tlist = add_to_flat_tlist(tlist, pull_var_clause((Node *)joinrel->reltarget->exprs, PVC_RECURSE_PLACEHOLDERS));
+#else
+    tlist = add_to_flat_tlist(tlist, pull_var_clause((Node *)joinrel->reltargetlist, PVC_RECURSE_AGGREGATES, PVC_RECURSE_PLACEHOLDERS));
+#endif
+    foreach (lc, fpinfo->local_conds)
+    {
+        RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+#if PG_VERSION_NUM >= 90600
+        tlist = add_to_flat_tlist(tlist, pull_var_clause((Node *)rinfo->clause, PVC_RECURSE_PLACEHOLDERS));
+#else
+        tlist = add_to_flat_tlist(tlist, pull_var_clause((Node *)rinfo->clause, PVC_RECURSE_AGGREGATES, PVC_RECURSE_PLACEHOLDERS));
+#endif
+    }
+    return tlist;
 }
 
-static void db2_GetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid)
+static ForeignScan *db2_GetForeignPlan(PlannerInfo *root, RelOptInfo *baserel,
+                                       Oid foreigntableid, ForeignPath *best_path, List *tlist, List *scan_clauses, Plan *outer_plan)
 {
-    Cost startup_cost;
-    Cost total_cost;
-    Path *path;
+    db2FdwRelationInfo *fpinfo = (db2FdwRelationInfo *)baserel->fdw_private;
+    Index scan_relid = baserel->relid;
+    List *remote_exprs = NIL;
+    List *local_exprs = NIL;
+    List *params_list = NIL;
+    List *retrieved_attrs;
+    List *fdw_scan_tlist = NIL;
+    bool has_limit = false;
+    bool recheck;
+    int slices;
+    Oid serverid;
+    long fetch_size;
+    long prefetch;
+    char *cached;
+    int cache_ttl = 0;
+    List *cache_relids = NIL;
+    Relids relids;
+    int rti = -1;
+    List *fdw_private;
+    StringInfoData sql;
+    ListCell *lc;
 
     logdebug("----> starting %s", __func__);
-    logdebug("baserel 1 %p", baserel->pathlist);
 
-    db2_EstimateCosts(root, baserel, &startup_cost, &total_cost, foreigntableid);
+    // grouped relation, the scan returns columns of fdw_scan_tlist
+    // conditions are applied remotely, scan_clauses is empty
+    if (baserel->reloptkind == RELOPT_UPPER_REL)
+    {
+        scan_relid = 0;
+        fdw_scan_tlist = fpinfo->grouped_tlist;
+    }
+    // join relation, conditions were classified by GetForeignJoinPaths, scan_clauses is empty
+    if (baserel->reloptkind == RELOPT_JOINREL)
+    {
+        scan_relid = 0;
+        fdw_scan_tlist = joinScanTlist(baserel);
+        local_exprs = extract_actual_clauses(fpinfo->local_conds, false);
+    }
 
-    logdebug("Before create path");
+    // path created by GetForeignUpperPaths
+    if (best_path->fdw_private != NIL)
+    {
+        has_limit = intVal(list_nth(best_path->fdw_private, FdwPathPrivateHasLimit));
+    }
 
-    path = (Path *)create_foreignscan_path(root, baserel,
-#if PG_VERSION_NUM >= 90600
-                                                NULL, /* PathTarget */
-#endif
-                                                baserel->rows,
-                                                startup_cost,
-                                                total_cost,
-                                                NIL,  /* no pathkeys */
-                                                NULL, /* no outer rel either */
-                                                NULL, /* no extra plan */
-                                                NIL /* no fdw_private list */);
+    foreach (lc, scan_clauses)
+    {
+        RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+
+        if (rinfo->pseudoconstant)
+        {
+            continue;
+        }
+        // clause can be remote and local at the same time
+        if (list_member_ptr(fpinfo->remote_conds, rinfo) || list_member_ptr(fpinfo->local_conds, rinfo))
+        {
+            if (list_member_ptr(fpinfo->remote_conds, rinfo))
+            {
+                remote_exprs = lappend(remote_exprs, rinfo->clause);
+            }
+            if (list_member_ptr(fpinfo->local_conds, rinfo))
+            {
+                local_exprs = lappend(local_exprs, rinfo->clause);
+            }
+            continue;
+        }
+        // join clause of parameterized path
+        if (db2IsForeignExpr(root, baserel, rinfo->clause, &recheck))
+        {
+            remote_exprs = lappend(remote_exprs, rinfo->clause);
+            if (recheck)
+            {
+                local_exprs = lappend(local_exprs, rinfo->clause);
+            }
+        }
+        else
+        {
+            local_exprs = lappend(local_exprs, rinfo->clause);
+        }
+    }
 
+    // partial path created by GetForeignPaths
+    slices = best_path->path.parallel_aware ? fpinfo->slices : 0;
+    initStringInfo(&sql);
+    db2DeparseSelectSql(&sql, root, baserel, fdw_scan_tlist, remote_exprs, best_path->path.pathkeys, has_limit,
+                        slices, &retrieved_attrs, &params_list);
+    logdebug("Remote SQL: %s", sql.data);
+    fdw_private = list_make4(makeString(sql.data), retrieved_attrs, makeInteger((int)fpinfo->relid),
+                             makeInteger(fpinfo->lookup_batch_size));
+    fdw_private = lappend(fdw_private, makeInteger(slices));
+    // connection and fetch options, the executor takes them from the plan
+    serverid = getScanOptions(fpinfo->relid, &fetch_size, &prefetch, &cached);
+    fdw_private = lappend(fdw_private, makeInteger((int)serverid));
+    fdw_private = lappend(fdw_private, makeInteger((int)fetch_size));
+    fdw_private = lappend(fdw_private, makeInteger((int)prefetch));
+    fdw_private = lappend(fdw_private, makeString(cached != NULL ? cached : ""));
 
-    add_path(baserel, path);
+    // result of non parallel scan can be cached if all its tables have cache_ttl, the shortest one is used
+    relids = baserel->reloptkind == RELOPT_UPPER_REL ? fpinfo->outerrel->relids : baserel->relids;
+    while (slices == 0 && (rti = bms_next_member(relids, rti)) >= 0)
+    {
+        int ttl;
+
+        // relids of outer join contain also the join itself
+        if (planner_rt_fetch(rti, root)->rtekind != RTE_RELATION)
+        {
+            continue;
+        }
+        ttl = getTableOptions(planner_rt_fetch(rti, root)->relid)->cache_ttl;
+
+        if (ttl == 0 || list_length(cache_relids) == RESULT_CACHE_MAX_RELS)
+        {
+            cache_ttl = 0;
+            cache_relids = NIL;
+            break;
+        }
+        cache_ttl = cache_relids == NIL ? ttl : Min(cache_ttl, ttl);
+        cache_relids = lappend_oid(cache_relids, planner_rt_fetch(rti, root)->relid);
+    }
+    fdw_private = lappend(fdw_private, makeInteger(cache_ttl));
+    fdw_private = lappend(fdw_private, cache_relids);
 
     logdebug("----> finishing %s", __func__);
+
+    return make_foreignscan(tlist, local_exprs,
+                            scan_relid, params_list,
+                            fdw_private,
+                            fdw_scan_tlist, NIL, /* fdw_recheck_quals */
+                            NULL /* outer_plan */);
 }
 
-static ForeignScan *db2_GetForeignPlan(PlannerInfo *root, RelOptInfo *baserel,
-                                       Oid foreigntableid, ForeignPath *best_path, List *tlist, List *scan_clauses, Plan *outer_plan)
+/*
+ * First row of single-row query as numbers, -1 for NULL or if there is no row
+ */
+static void getRemoteNumbers(Oid relid, char *sql, double *values, int n)
 {
-    Index scan_relid = baserel->relid;
-    logdebug("----> starting %s", __func__);
+    db2PrivateData data;
+    SQLRETURN ret;
+    int i;
 
-    scan_clauses = extract_actual_clauses(scan_clauses, false);
+    logdebug(__func__);
+    logdebug("QUERY: %s", sql);
+    for (i = 0; i < n; i++)
+    {
+        values[i] = -1;
+    }
+    memset(&data, 0, sizeof(data));
+    data.query = sql;
+    executeQuery(&data, relid);
+    ret = SQLFetch(data.stmt);
+    for (i = 0; i < n && SQL_SUCCEEDED(ret); i++)
+    {
+        SQLDOUBLE value;
+        SQLLEN ind;
 
-    logdebug("----> finishing %s", __func__);
+        ret = SQLGetData(data.stmt, i + 1, SQL_C_DOUBLE, &value, 0, &ind);
+        if (SQL_SUCCEEDED(ret) && ind != SQL_NULL_DATA)
+        {
+            values[i] = value;
+        }
+    }
+    releaseStatement(&data);
+    closeConnection(&data);
+}
 
-    return make_foreignscan(tlist, scan_clauses,
-                            scan_relid, NIL, NIL,
-                            NIL /* fdw_scan_tlist */, NIL, /* fdw_recheck_quals */
-                            NULL /* outer_plan */);
+/*
+ * Sample of rows for ANALYZE
+ * DB2 chooses about targrows rows randomly, reservoir sampling keeps targrows of rows received
+ */
+static int db2AcquireSampleRows(Relation relation, int elevel, HeapTuple *rows, int targrows,
+                                double *totalrows, double *totaldeadrows)
+{
+    db2FdwRelationInfo *fpinfo;
+    db2PrivateData *data;
+    TupleDesc tupdesc = RelationGetDescr(relation);
+    List *retrieved_attrs;
+    StringInfoData sql;
+    double stats[2] = {-1, -1};
+    double sample_frac = 1;
+    double samplerows = 0;
+    double rowstoskip = -1;
+    ReservoirStateData rstate;
+    Datum *values;
+    bool *isnull;
+    int numrows = 0;
+
+    logdebug(__func__);
+    fpinfo = getTableOptions(RelationGetRelid(relation));
+    fpinfo->natts = tupdesc->natts;
+
+    // number of rows from DB2 catalog, counted if RUNSTATS was not run
+    if (fpinfo->table != NULL)
+    {
+        initStringInfo(&sql);
+        db2DeparseTableStatsSql(&sql, fpinfo);
+        getRemoteNumbers(fpinfo->relid, sql.data, stats, 2);
+    }
+    if (stats[0] < 0)
+    {
+        initStringInfo(&sql);
+        db2DeparseCountSql(&sql, fpinfo);
+        getRemoteNumbers(fpinfo->relid, sql.data, stats, 1);
+    }
+    if (stats[0] > targrows)
+    {
+        sample_frac = targrows / stats[0];
+    }
+
+    initStringInfo(&sql);
+    db2DeparseAnalyzeSql(&sql, relation, fpinfo, sample_frac, &retrieved_attrs);
+    data = (db2PrivateData *)palloc0(sizeof(db2PrivateData));
+    data->query = sql.data;
+    data->attinmeta = TupleDescGetAttInMetadata(tupdesc);
+    data->natts = tupdesc->natts;
+    data->rowcontext = AllocSetContextCreate(CurrentMemoryContext,
+                                             "db2odbc_fdw analyze row data",
+                                             ALLOCSET_SMALL_SIZES);
+    executeQuery(data, fpinfo->relid);
+    bindResultColumns(data, retrieved_attrs);
+
+    values = (Datum *)palloc(sizeof(Datum) * tupdesc->natts);
+    isnull = (bool *)palloc(sizeof(bool) * tupdesc->natts);
+    reservoir_init_selection_state(&rstate, targrows);
+    while (fetchRow(data, values, isnull))
+    {
+        vacuum_delay_point();
+        samplerows += 1;
+        if (numrows < targrows)
+        {
+            rows[numrows++] = heap_form_tuple(tupdesc, values, isnull);
+            continue;
+        }
+        // replace random row of the reservoir
+        if (rowstoskip < 0)
+        {
+            rowstoskip = reservoir_get_next_S(&rstate, samplerows, targrows);
+        }
+        if (rowstoskip <= 0)
+        {
+#if PG_VERSION_NUM >= 150000
+            int k = (int)(targrows * sampler_random_fract(&rstate.randstate));
+#else
+            int k = (int)(targrows * sampler_random_fract(rstate.randstate));
+#endif
+            heap_freetuple(rows[k]);
+            rows[k] = heap_form_tuple(tupdesc, values, isnull);
+        }
+        rowstoskip -= 1;
+    }
+    releaseStatement(data);
+    closeConnection(data);
+    MemoryContextDelete(data->rowcontext);
+
+    *totaldeadrows = 0;
+    *totalrows = sample_frac < 1 ? stats[0] : samplerows;
+    ereport(elevel,
+            (errmsg("\"%s\": table contains %.0f rows, %.0f rows sampled by DB2, %d rows in sample",
+                    RelationGetRelationName(relation), *totalrows, samplerows, numrows)));
+    return numrows;
 }
 
+/*
+ * Size of the table in DB2 pages converted to PostgreSQL blocks
+ * Only tables have the size in catalog, for sql_query one page is assumed
+ */
 static bool db2_AnalyzeForeignTable(Relation relation, AcquireSampleRowsFunc *func, BlockNumber *totalpages)
 {
+    db2FdwRelationInfo *fpinfo;
+    double stats[2];
+
     logdebug("----> starting %s", __func__);
+
+    *func = db2AcquireSampleRows;
+    *totalpages = 1;
+    fpinfo = getTableOptions(RelationGetRelid(relation));
+    if (fpinfo->table != NULL)
+    {
+        StringInfoData sql;
+
+        initStringInfo(&sql);
+        db2DeparseTableStatsSql(&sql, fpinfo);
+        getRemoteNumbers(fpinfo->relid, sql.data, stats, 2);
+        if (stats[1] > BLCKSZ)
+        {
+            *totalpages = (BlockNumber)(stats[1] / BLCKSZ);
+        }
+    }
     logdebug("----> finishing %s", __func__);
 
-    return false;
+    return true;
 }
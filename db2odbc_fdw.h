@@ -0,0 +1,183 @@
+/*-------------------------------------------------------------------------
+ *
+ * db2odbc_fdw.h - foreign data wrapper for odbc
+ *
+ * Author: stanislawbartkowski@gmail.com
+ *
+ * Copyright (c) 2010-2013, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		  db2odbc_fdw/db2odbc_fdw.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef DB2ODBC_FDW_H
+#define DB2ODBC_FDW_H
+
+#if PG_VERSION_NUM >= 120000
+#include "nodes/pathnodes.h"
+#else
+#include "nodes/relation.h"
+#endif
+#include "nodes/pg_list.h"
+#include "lib/stringinfo.h"
+#include "utils/relcache.h"
+
+//#define DEBUG
+
+#ifdef DEBUG
+
+#define N NOTICE
+#define NCONNECTION NOTICE
+
+#else
+
+#define N DEBUG5
+#define NCONNECTION DEBUG5
+
+#endif
+
+#define logdebug(...) elog(N, __VA_ARGS__)
+
+/*
+ * Planner information kept in RelOptInfo.fdw_private
+ */
+typedef struct db2FdwRelationInfo
+{
+    // relation can be evaluated by DB2 as a whole
+    bool pushdown_safe;
+    Oid relid;
+    // sql_query option of the foreign table, or table and schema options
+    char *query;
+    char *table;
+    char *schema;
+    // number of attributes of the foreign table, columns of sql_query are mapped positionally
+    int natts;
+    // attributes referenced by the query, offset by FirstLowInvalidHeapAttributeNumber
+    Bitmapset *attrs_used;
+
+    // restriction clauses shipped to DB2 and evaluated locally
+    // a clause can be on both lists if the DB2 result is only a superset
+    List *remote_conds;
+    List *local_conds;
+    // remote condition col = ANY(array) executed by batches of lookup_batch_size elements
+    RestrictInfo *batch_cond;
+    int lookup_batch_size;
+
+    // query_pathkeys can be evaluated by DB2
+    bool qp_is_pushdown_safe;
+
+    // upper relation: stage and input relation
+    UpperRelationKind stage;
+    RelOptInfo *outerrel;
+    // join relation: outerrel and innerrel joined by clauses in ON
+    // remote_conds go to WHERE, local_conds are evaluated over fdw_scan_tlist
+    RelOptInfo *innerrel;
+    JoinType jointype;
+    List *joinclauses;
+    // grouped relation: columns retrieved from DB2, HAVING is kept in remote_conds as bare expressions
+    List *grouped_tlist;
+
+    // planner cost parameters, server options
+    bool use_remote_estimate;
+    Cost fdw_startup_cost;
+    Cost fdw_tuple_cost;
+    // scan can run concurrently with other scans of Append
+    bool async_capable;
+    // parallel scan reads slices MOD(partition column, slices), InvalidAttrNumber if not set
+    AttrNumber partition_attno;
+    int slices;
+    // seconds the result is kept in the shared result cache, 0 if not cached
+    int cache_ttl;
+    // rows sent by DB2, before local conditions are applied
+    double retrieved_rows;
+} db2FdwRelationInfo;
+
+/*
+ * Indexes of items in ForeignScan.fdw_private list
+ */
+enum FdwScanPrivateIndex
+{
+    // SQL statement to execute remotely (as a String node)
+    FdwScanPrivateSelectSql,
+    // Integer list of attribute numbers retrieved by the SELECT
+    FdwScanPrivateRetrievedAttrs,
+    // Oid of the foreign table (as Integer node), for grouped relation the underlying table
+    // and for join the leftmost table, used to find the connection
+    FdwScanPrivateRelid,
+    // number of parameter markers of batched col = ANY(array) condition (as Integer node)
+    FdwScanPrivateBatchSize,
+    // number of slices of parallel scan, 0 if the scan is not parallel aware (as Integer node)
+    FdwScanPrivateSlices,
+    // options resolved at plan time, the executor does not read the catalog again
+    // Oid of the foreign server (as Integer node)
+    FdwScanPrivateServerId,
+    // fetch_size and prefetch options (as Integer nodes)
+    FdwScanPrivateFetchSize,
+    FdwScanPrivatePrefetch,
+    // cached option, empty if not set (as String node)
+    FdwScanPrivateCached,
+    // seconds the result is kept in the shared result cache, 0 if not cached (as Integer node)
+    FdwScanPrivateCacheTtl,
+    // Oid list of foreign tables the result is read from, for invalidation
+    FdwScanPrivateCacheRelids
+};
+
+/*
+ * Indexes of items in ForeignPath.fdw_private list of paths created by GetForeignUpperPaths
+ */
+enum FdwPathPrivateIndex
+{
+    // ORDER BY of the query is pushed down (as Integer node)
+    FdwPathPrivateHasFinalSort,
+    // LIMIT/OFFSET of the query is pushed down (as Integer node)
+    FdwPathPrivateHasLimit
+};
+
+/*
+ * Indexes of items in ModifyTable.fdw_private list
+ */
+enum FdwModifyPrivateIndex
+{
+    // INSERT statement with parameter markers (as String node)
+    FdwModifyPrivateInsertSql,
+    // Integer list of attribute numbers bound to the markers
+    FdwModifyPrivateTargetAttrs
+};
+
+/*
+ * Indexes of items in ForeignScan.fdw_private list of UPDATE or DELETE executed directly
+ */
+enum FdwDirectModifyPrivateIndex
+{
+    // UPDATE or DELETE statement (as String node)
+    FdwDirectModifyPrivateSql,
+    // Oid of the foreign table (as Integer node)
+    FdwDirectModifyPrivateRelid,
+    // the number of rows affected is counted in es_processed (as Integer node)
+    FdwDirectModifyPrivateSetProcessed
+};
+
+/* in deparse.c */
+extern bool db2IsForeignExpr(PlannerInfo *root, RelOptInfo *baserel, Expr *expr, bool *recheck);
+extern void db2ClassifyConditions(PlannerInfo *root, RelOptInfo *baserel, List *input_conds,
+                                  List **remote_conds, List **local_conds);
+extern void db2DeparseSelectSql(StringInfo buf, PlannerInfo *root, RelOptInfo *baserel, List *tlist,
+                                List *remote_conds, List *pathkeys, bool has_limit, int slices,
+                                List **retrieved_attrs, List **params_list);
+extern Expr *db2FindEmExprForRel(EquivalenceClass *ec, RelOptInfo *rel);
+extern bool db2IsShippablePathkeys(PlannerInfo *root, RelOptInfo *rel, List *pathkeys);
+extern bool db2IsShippableLimit(Node *node);
+extern char *db2ValueText(Datum value, Oid type);
+extern void db2DeparseEstimateSql(StringInfo buf, RelOptInfo *baserel);
+extern void db2DeparseTableStatsSql(StringInfo buf, db2FdwRelationInfo *fpinfo);
+extern void db2DeparseCountSql(StringInfo buf, db2FdwRelationInfo *fpinfo);
+extern void db2DeparseAnalyzeSql(StringInfo buf, Relation rel, db2FdwRelationInfo *fpinfo, double sample_frac,
+                                 List **retrieved_attrs);
+extern void db2DeparseInsertSql(StringInfo buf, Relation rel, db2FdwRelationInfo *fpinfo, List **target_attrs);
+extern void db2DeparseUpdateSql(StringInfo buf, PlannerInfo *root, RelOptInfo *baserel, List *target_attrs, List *exprs,
+                                List *remote_conds, List **params_list);
+extern void db2DeparseDeleteSql(StringInfo buf, PlannerInfo *root, RelOptInfo *baserel, List *remote_conds,
+                                List **params_list);
+
+#endif /* DB2ODBC_FDW_H */
@@ -0,0 +1,1810 @@
+/*-------------------------------------------------------------------------
+ *
+ * deparse.c - build DB2 SQL statements from planner structures
+ *
+ * Author: stanislawbartkowski@gmail.com
+ *
+ * Copyright (c) 2010-2013, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		  db2odbc_fdw/deparse.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <ctype.h>
+
+#include "access/stratnum.h"
+#include "access/sysattr.h"
+#include "access/transam.h"
+#if PG_VERSION_NUM >= 120000
+#include "access/table.h"
+#else
+#include "access/heapam.h"
+#endif
+#include "catalog/pg_type.h"
+#include "commands/defrem.h"
+#include "foreign/foreign.h"
+#include "catalog/pg_aggregate.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/pathnode.h"
+#include "optimizer/tlist.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/date.h"
+#include "utils/datetime.h"
+#include "utils/formatting.h"
+#include "utils/lsyscache.h"
+#include "utils/rel.h"
+#include "utils/timestamp.h"
+
+#include "db2odbc_fdw.h"
+
+/*
+ * Only built-in operators and functions have known semantics
+ */
+#if PG_VERSION_NUM >= 120000
+#define DB2_IS_BUILTIN(oid) ((oid) < FirstGenbkiObjectId)
+#else
+#define DB2_IS_BUILTIN(oid) ((oid) < FirstBootstrapObjectId)
+#endif
+
+/*
+ * Groups of types comparable both in PostgreSQL and DB2
+ */
+typedef enum db2TypeCategory
+{
+    DB2_TYPE_OTHER,
+    DB2_TYPE_NUMBER,
+    DB2_TYPE_STRING,
+    DB2_TYPE_DATE,
+    DB2_TYPE_TIMESTAMP
+} db2TypeCategory;
+
+/*
+ * Context for foreignExprWalker
+ */
+typedef struct foreign_glob_cxt
+{
+    PlannerInfo *root;
+    // relation scanned, for upper relation the underlying base relation
+    RelOptInfo *foreignrel;
+    // aggregates are allowed in expression
+    bool allow_aggregates;
+    // DB2 result can be a superset, expression should be evaluated locally again
+    bool recheck;
+    // number of enclosing NOT
+    int negated;
+} foreign_glob_cxt;
+
+/*
+ * Context for deparseExpr
+ */
+typedef struct deparse_expr_cxt
+{
+    PlannerInfo *root;
+    RelOptInfo *foreignrel;
+    StringInfo buf;
+    // Params found in expression, in the order of parameter markers
+    List **params_list;
+} deparse_expr_cxt;
+
+static bool foreignExprWalker(Node *node, foreign_glob_cxt *cxt);
+static void deparseExpr(Expr *node, deparse_expr_cxt *context);
+static void deparseParamMarker(Expr *node, Oid type, deparse_expr_cxt *context);
+
+static db2TypeCategory typeCategory(Oid type)
+{
+    switch (type)
+    {
+    case INT2OID:
+    case INT4OID:
+    case INT8OID:
+    case FLOAT4OID:
+    case FLOAT8OID:
+    case NUMERICOID:
+        return DB2_TYPE_NUMBER;
+    case TEXTOID:
+    case VARCHAROID:
+    case BPCHAROID:
+        return DB2_TYPE_STRING;
+    case DATEOID:
+        return DB2_TYPE_DATE;
+    case TIMESTAMPOID:
+        return DB2_TYPE_TIMESTAMP;
+    }
+    return DB2_TYPE_OTHER;
+}
+
+/*
+ * DB2 type used to cast parameter marker
+ */
+static const char *db2TypeName(Oid type)
+{
+    switch (type)
+    {
+    case INT2OID:
+        return "SMALLINT";
+    case INT4OID:
+        return "INTEGER";
+    case INT8OID:
+        return "BIGINT";
+    case FLOAT4OID:
+        return "REAL";
+    case FLOAT8OID:
+        return "DOUBLE";
+    case NUMERICOID:
+        return "DECFLOAT(34)";
+    case DATEOID:
+        return "DATE";
+    case TIMESTAMPOID:
+        return "TIMESTAMP";
+    }
+    return "VARCHAR(32672)";
+}
+
+/*
+ * Text representation of the value accepted by DB2
+ * Date and timestamp are formatted independently of DateStyle
+ */
+char *db2ValueText(Datum value, Oid type)
+{
+    switch (type)
+    {
+    case DATEOID:
+    {
+        int year, mon, mday;
+
+        j2date(DatumGetDateADT(value) + POSTGRES_EPOCH_JDATE, &year, &mon, &mday);
+        return psprintf("%04d-%02d-%02d", year, mon, mday);
+    }
+    case TIMESTAMPOID:
+    {
+        struct pg_tm tm;
+        fsec_t fsec;
+
+        if (timestamp2tm(DatumGetTimestamp(value), NULL, &tm, &fsec, NULL, NULL) != 0)
+        {
+            ereport(ERROR,
+                    (errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+                     errmsg("timestamp out of range")));
+        }
+        return psprintf("%04d-%02d-%02d-%02d.%02d.%02d.%06d",
+                        tm.tm_year, tm.tm_mon, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, (int)fsec);
+    }
+    default:
+    {
+        Oid typoutput;
+        bool typIsVarlena;
+
+        getTypeOutputInfo(type, &typoutput, &typIsVarlena);
+        return OidOutputFunctionCall(typoutput, value);
+    }
+    }
+}
+
+// -------------------------------------------
+// shippability
+// -------------------------------------------
+
+/*
+ * NaN, Infinity and infinite dates have no DB2 counterpart
+ */
+static bool isShippableValue(Datum value, Oid type)
+{
+    char *s;
+
+    switch (typeCategory(type))
+    {
+    case DB2_TYPE_NUMBER:
+        s = db2ValueText(value, type);
+        return strspn(s, "0123456789.-+eE") == strlen(s);
+    case DB2_TYPE_DATE:
+        return !DATE_NOT_FINITE(DatumGetDateADT(value));
+    case DB2_TYPE_TIMESTAMP:
+        return !TIMESTAMP_NOT_FINITE(DatumGetTimestamp(value));
+    case DB2_TYPE_STRING:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * LIKE pattern is shipped with ESCAPE '\'
+ * DB2 accepts only %, _ and escape character itself after the escape character
+ */
+static bool isShippableLikePattern(Node *pattern)
+{
+    Const *c;
+    char *p;
+
+    if (IsA(pattern, RelabelType))
+    {
+        pattern = (Node *)((RelabelType *)pattern)->arg;
+    }
+    if (!IsA(pattern, Const) || ((Const *)pattern)->constisnull)
+    {
+        return false;
+    }
+    c = (Const *)pattern;
+    for (p = TextDatumGetCString(c->constvalue); *p; p++)
+    {
+        if (*p == '\\')
+        {
+            p++;
+            if (*p != '%' && *p != '_' && *p != '\\')
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * Binary operator with both arguments of category cat
+ */
+static bool isShippableOperator(OpExpr *oe, const char *opname, db2TypeCategory cat, foreign_glob_cxt *cxt)
+{
+    if (strcmp(opname, "=") == 0 || strcmp(opname, "<>") == 0 ||
+        strcmp(opname, "<") == 0 || strcmp(opname, "<=") == 0 ||
+        strcmp(opname, ">") == 0 || strcmp(opname, ">=") == 0)
+    {
+        if (cat != DB2_TYPE_STRING)
+        {
+            return true;
+        }
+        // DB2 ignores trailing blanks and uses its own collating sequence, only equality
+        // in positive context is safe: DB2 returns a superset and the rows are checked again
+        if (strcmp(opname, "=") != 0 || cxt->negated > 0)
+        {
+            return false;
+        }
+        cxt->recheck = true;
+        return true;
+    }
+    if (strcmp(opname, "+") == 0 || strcmp(opname, "-") == 0 || strcmp(opname, "*") == 0)
+    {
+        return cat == DB2_TYPE_NUMBER;
+    }
+    if (strcmp(opname, "/") == 0)
+    {
+        // DB2 decimal division uses different result scale
+        return cat == DB2_TYPE_NUMBER &&
+               exprType(linitial(oe->args)) != NUMERICOID && exprType(lsecond(oe->args)) != NUMERICOID;
+    }
+    if (strcmp(opname, "~~") == 0 || strcmp(opname, "!~~") == 0)
+    {
+        // fixed length CHAR is padded in DB2
+        return cat == DB2_TYPE_STRING && exprType(linitial(oe->args)) != BPCHAROID &&
+               isShippableLikePattern(lsecond(oe->args));
+    }
+    return false;
+}
+
+static bool isShippableArray(Node *arr, db2TypeCategory cat, foreign_glob_cxt *cxt)
+{
+    if (IsA(arr, Const))
+    {
+        Const *c = (Const *)arr;
+        ArrayType *array;
+        Oid elemtype;
+        int16 typlen;
+        bool typbyval;
+        char typalign;
+        Datum *elems;
+        bool *nulls;
+        int n, i;
+
+        if (c->constisnull)
+        {
+            return false;
+        }
+        array = DatumGetArrayTypeP(c->constvalue);
+        elemtype = ARR_ELEMTYPE(array);
+        if (typeCategory(elemtype) != cat)
+        {
+            return false;
+        }
+        get_typlenbyvalalign(elemtype, &typlen, &typbyval, &typalign);
+        deconstruct_array(array, elemtype, typlen, typbyval, typalign, &elems, &nulls, &n);
+        // IN () is not valid SQL
+        if (n == 0)
+        {
+            return false;
+        }
+        for (i = 0; i < n; i++)
+        {
+            if (nulls[i] || !isShippableValue(elems[i], elemtype))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    if (IsA(arr, ArrayExpr))
+    {
+        ArrayExpr *ae = (ArrayExpr *)arr;
+        if (ae->elements == NIL || typeCategory(ae->element_typeid) != cat)
+        {
+            return false;
+        }
+        return foreignExprWalker((Node *)ae->elements, cxt);
+    }
+    return false;
+}
+
+static bool foreignExprWalker(Node *node, foreign_glob_cxt *cxt)
+{
+    if (node == NULL)
+    {
+        return true;
+    }
+    switch (nodeTag(node))
+    {
+    case T_Var:
+    {
+        Var *var = (Var *)node;
+        if (var->varlevelsup != 0)
+        {
+            return false;
+        }
+        // column of other relation in parameterized path is sent as parameter, see deparseVar
+        if (!bms_is_member(var->varno, cxt->foreignrel->relids))
+        {
+            return typeCategory(var->vartype) != DB2_TYPE_OTHER;
+        }
+        return var->varattno > 0 && typeCategory(var->vartype) != DB2_TYPE_OTHER;
+    }
+    case T_Const:
+    {
+        Const *c = (Const *)node;
+        // untyped NULL is not accepted by DB2 in most contexts
+        return !c->constisnull && isShippableValue(c->constvalue, c->consttype);
+    }
+    case T_Param:
+    {
+        Param *p = (Param *)node;
+        // PARAM_EXEC values are known when the scan is started, the query is executed by the first fetch
+        return (p->paramkind == PARAM_EXTERN || p->paramkind == PARAM_EXEC) &&
+               typeCategory(p->paramtype) != DB2_TYPE_OTHER;
+    }
+    case T_RelabelType:
+    {
+        RelabelType *r = (RelabelType *)node;
+        if (typeCategory(r->resulttype) != typeCategory(exprType((Node *)r->arg)))
+        {
+            return false;
+        }
+        return foreignExprWalker((Node *)r->arg, cxt);
+    }
+    case T_OpExpr:
+    {
+        OpExpr *oe = (OpExpr *)node;
+        char *opname;
+        db2TypeCategory cat;
+
+        if (!DB2_IS_BUILTIN(oe->opno))
+        {
+            return false;
+        }
+        opname = get_opname(oe->opno);
+        if (list_length(oe->args) == 1)
+        {
+            // unary minus only
+            if (strcmp(opname, "-") != 0 || typeCategory(exprType(linitial(oe->args))) != DB2_TYPE_NUMBER)
+            {
+                return false;
+            }
+            return foreignExprWalker(linitial(oe->args), cxt);
+        }
+        if (list_length(oe->args) != 2)
+        {
+            return false;
+        }
+        cat = typeCategory(exprType(linitial(oe->args)));
+        if (cat == DB2_TYPE_OTHER || cat != typeCategory(exprType(lsecond(oe->args))))
+        {
+            return false;
+        }
+        if (!isShippableOperator(oe, opname, cat, cxt))
+        {
+            return false;
+        }
+        return foreignExprWalker((Node *)oe->args, cxt);
+    }
+    case T_ScalarArrayOpExpr:
+    {
+        ScalarArrayOpExpr *sa = (ScalarArrayOpExpr *)node;
+        char *opname;
+        db2TypeCategory cat;
+
+        if (!DB2_IS_BUILTIN(sa->opno))
+        {
+            return false;
+        }
+        opname = get_opname(sa->opno);
+        // IN and NOT IN
+        if (strcmp(opname, sa->useOr ? "=" : "<>") != 0)
+        {
+            return false;
+        }
+        cat = typeCategory(exprType(linitial(sa->args)));
+        if (cat == DB2_TYPE_OTHER)
+        {
+            return false;
+        }
+        if (cat == DB2_TYPE_STRING)
+        {
+            // the same as for = operator
+            if (!sa->useOr || cxt->negated > 0)
+            {
+                return false;
+            }
+            cxt->recheck = true;
+        }
+        if (!isShippableArray(lsecond(sa->args), cat, cxt))
+        {
+            return false;
+        }
+        return foreignExprWalker(linitial(sa->args), cxt);
+    }
+    case T_NullTest:
+    {
+        NullTest *nt = (NullTest *)node;
+        if (nt->argisrow)
+        {
+            return false;
+        }
+        return foreignExprWalker((Node *)nt->arg, cxt);
+    }
+    case T_BoolExpr:
+    {
+        BoolExpr *b = (BoolExpr *)node;
+        bool res;
+
+        if (b->boolop == NOT_EXPR)
+        {
+            cxt->negated++;
+        }
+        res = foreignExprWalker((Node *)b->args, cxt);
+        if (b->boolop == NOT_EXPR)
+        {
+            cxt->negated--;
+        }
+        return res;
+    }
+    case T_FuncExpr:
+    {
+        FuncExpr *fe = (FuncExpr *)node;
+        char *fname;
+
+        if (!DB2_IS_BUILTIN(fe->funcid) || list_length(fe->args) != 1)
+        {
+            return false;
+        }
+        // implicit numeric conversion, DB2 does the same
+        if (fe->funcformat == COERCE_IMPLICIT_CAST)
+        {
+            if (typeCategory(fe->funcresulttype) != DB2_TYPE_NUMBER ||
+                typeCategory(exprType(linitial(fe->args))) != DB2_TYPE_NUMBER)
+            {
+                return false;
+            }
+            return foreignExprWalker(linitial(fe->args), cxt);
+        }
+        if (fe->funcformat != COERCE_EXPLICIT_CALL)
+        {
+            return false;
+        }
+        fname = get_func_name(fe->funcid);
+        if (strcmp(fname, "abs") == 0)
+        {
+            if (typeCategory(fe->funcresulttype) != DB2_TYPE_NUMBER)
+            {
+                return false;
+            }
+        }
+        else if (strcmp(fname, "upper") == 0 || strcmp(fname, "lower") == 0)
+        {
+            if (typeCategory(fe->funcresulttype) != DB2_TYPE_STRING)
+            {
+                return false;
+            }
+            // case mapping outside ASCII can differ
+            cxt->recheck = true;
+        }
+        else
+        {
+            return false;
+        }
+        return foreignExprWalker(linitial(fe->args), cxt);
+    }
+    case T_Aggref:
+    {
+        Aggref *agg = (Aggref *)node;
+        char *fname;
+        Expr *arg;
+        db2TypeCategory cat;
+        bool res;
+
+        if (!cxt->allow_aggregates)
+        {
+            return false;
+        }
+        if (agg->aggsplit != AGGSPLIT_SIMPLE || agg->aggkind != AGGKIND_NORMAL || agg->aggorder != NIL ||
+            agg->aggfilter != NULL || agg->aggvariadic || !DB2_IS_BUILTIN(agg->aggfnoid))
+        {
+            return false;
+        }
+        fname = get_func_name(agg->aggfnoid);
+        if (agg->aggstar)
+        {
+            return strcmp(fname, "count") == 0;
+        }
+        if (list_length(agg->args) != 1)
+        {
+            return false;
+        }
+        arg = ((TargetEntry *)linitial(agg->args))->expr;
+        cat = typeCategory(exprType((Node *)arg));
+        if (cat == DB2_TYPE_OTHER)
+        {
+            return false;
+        }
+        // DISTINCT and MIN/MAX on strings follow DB2 comparison rules
+        if (agg->aggdistinct != NIL && cat == DB2_TYPE_STRING)
+        {
+            return false;
+        }
+        if (strcmp(fname, "sum") == 0)
+        {
+            if (cat != DB2_TYPE_NUMBER)
+                return false;
+        }
+        else if (strcmp(fname, "avg") == 0)
+        {
+            // numeric AVG of PostgreSQL chooses the scale by the values, DB2 result would print differently
+            Oid argtype = exprType((Node *)arg);
+            if (argtype != FLOAT4OID && argtype != FLOAT8OID)
+                return false;
+        }
+        else if (strcmp(fname, "min") == 0 || strcmp(fname, "max") == 0)
+        {
+            if (cat == DB2_TYPE_STRING)
+                return false;
+        }
+        else if (strcmp(fname, "count") != 0)
+        {
+            return false;
+        }
+        // nested aggregates are not valid
+        cxt->allow_aggregates = false;
+        res = foreignExprWalker((Node *)arg, cxt);
+        cxt->allow_aggregates = true;
+        return res;
+    }
+    case T_List:
+    {
+        ListCell *lc;
+        foreach (lc, (List *)node)
+        {
+            if (!foreignExprWalker((Node *)lfirst(lc), cxt))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+/*
+ * Returns true if expr can be evaluated by DB2
+ * recheck is set if the expression should be evaluated locally as well
+ */
+bool db2IsForeignExpr(PlannerInfo *root, RelOptInfo *baserel, Expr *expr, bool *recheck)
+{
+    foreign_glob_cxt cxt;
+
+    cxt.root = root;
+    cxt.foreignrel = baserel;
+    cxt.allow_aggregates = false;
+    cxt.recheck = false;
+    cxt.negated = 0;
+    // expression over grouped relation references columns of the underlying relation
+    if (baserel->reloptkind == RELOPT_UPPER_REL)
+    {
+        cxt.foreignrel = ((db2FdwRelationInfo *)baserel->fdw_private)->outerrel;
+        cxt.allow_aggregates = true;
+    }
+    if (!foreignExprWalker((Node *)expr, &cxt))
+    {
+        return false;
+    }
+    *recheck = cxt.recheck;
+    return true;
+}
+
+/*
+ * col = ANY(array) where the array is a parameter or a constant of more than lookup_batch_size elements
+ * The array is not inlined, DB2 gets lookup_batch_size parameter markers and the statement is executed
+ * once for every batch of elements. The result is the union of batches, so only positive IN is accepted.
+ * Strings are not batched: DB2 can find the same row for two elements different in PostgreSQL
+ */
+static bool isBatchedLookup(PlannerInfo *root, RelOptInfo *baserel, Expr *expr, bool *recheck)
+{
+    db2FdwRelationInfo *fpinfo = (db2FdwRelationInfo *)baserel->fdw_private;
+    ScalarArrayOpExpr *sa;
+    Node *arr;
+    Oid elemtype;
+    db2TypeCategory cat;
+
+    if (!IsA(expr, ScalarArrayOpExpr))
+    {
+        return false;
+    }
+    sa = (ScalarArrayOpExpr *)expr;
+    if (!sa->useOr || !DB2_IS_BUILTIN(sa->opno) || strcmp(get_opname(sa->opno), "=") != 0)
+    {
+        return false;
+    }
+    arr = lsecond(sa->args);
+    if (IsA(arr, Param))
+    {
+        Param *p = (Param *)arr;
+        if (p->paramkind != PARAM_EXTERN && p->paramkind != PARAM_EXEC)
+        {
+            return false;
+        }
+    }
+    else if (IsA(arr, Const))
+    {
+        Const *c = (Const *)arr;
+        ArrayType *array;
+
+        // short list is inlined
+        if (c->constisnull)
+        {
+            return false;
+        }
+        array = DatumGetArrayTypeP(c->constvalue);
+        if (ArrayGetNItems(ARR_NDIM(array), ARR_DIMS(array)) <= fpinfo->lookup_batch_size)
+        {
+            return false;
+        }
+    }
+    else
+    {
+        return false;
+    }
+    cat = typeCategory(exprType(linitial(sa->args)));
+    elemtype = get_element_type(exprType(arr));
+    if (cat == DB2_TYPE_OTHER || cat == DB2_TYPE_STRING || !OidIsValid(elemtype) || typeCategory(elemtype) != cat)
+    {
+        return false;
+    }
+    return db2IsForeignExpr(root, baserel, linitial(sa->args), recheck);
+}
+
+/*
+ * Split list of RestrictInfo into clauses shipped to DB2 and clauses evaluated locally
+ */
+void db2ClassifyConditions(PlannerInfo *root, RelOptInfo *baserel, List *input_conds,
+                           List **remote_conds, List **local_conds)
+{
+    db2FdwRelationInfo *fpinfo = (db2FdwRelationInfo *)baserel->fdw_private;
+    ListCell *lc;
+
+    *remote_conds = NIL;
+    *local_conds = NIL;
+    foreach (lc, input_conds)
+    {
+        RestrictInfo *ri = lfirst_node(RestrictInfo, lc);
+        bool recheck;
+
+        // only one condition is executed by batches, the others are evaluated locally
+        if (fpinfo->batch_cond == NULL && isBatchedLookup(root, baserel, ri->clause, &recheck))
+        {
+            logdebug("Batched lookup condition");
+            fpinfo->batch_cond = ri;
+        }
+        else if (!db2IsForeignExpr(root, baserel, ri->clause, &recheck))
+        {
+            *local_conds = lappend(*local_conds, ri);
+            continue;
+        }
+        logdebug("Remote condition");
+        *remote_conds = lappend(*remote_conds, ri);
+        if (recheck)
+        {
+            *local_conds = lappend(*local_conds, ri);
+        }
+    }
+}
+
+/*
+ * Expression of the equivalence class computable from rel alone
+ */
+Expr *db2FindEmExprForRel(EquivalenceClass *ec, RelOptInfo *rel)
+{
+    ListCell *lc;
+
+    foreach (lc, ec->ec_members)
+    {
+        EquivalenceMember *em = (EquivalenceMember *)lfirst(lc);
+
+        if (bms_is_subset(em->em_relids, rel->relids) && !bms_is_empty(em->em_relids))
+        {
+            return em->em_expr;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Returns true if DB2 can produce rows of rel in pathkeys order
+ */
+bool db2IsShippablePathkeys(PlannerInfo *root, RelOptInfo *rel, List *pathkeys)
+{
+    ListCell *lc;
+
+    foreach (lc, pathkeys)
+    {
+        PathKey *pathkey = (PathKey *)lfirst(lc);
+        EquivalenceClass *ec = pathkey->pk_eclass;
+        Expr *em_expr;
+        db2TypeCategory cat;
+        bool recheck;
+
+        if (ec->ec_has_volatile || !DB2_IS_BUILTIN(pathkey->pk_opfamily))
+        {
+            return false;
+        }
+        // DB2 sorts NULLs as high values, the same as PostgreSQL default
+        // NULLS FIRST/LAST clause is not used, older DB2 versions do not accept it
+        if (pathkey->pk_nulls_first != (pathkey->pk_strategy == BTGreaterStrategyNumber))
+        {
+            return false;
+        }
+        em_expr = db2FindEmExprForRel(ec, rel);
+        if (em_expr == NULL)
+        {
+            return false;
+        }
+        // strings are ordered by DB2 collating sequence
+        cat = typeCategory(exprType((Node *)em_expr));
+        if (cat == DB2_TYPE_OTHER || cat == DB2_TYPE_STRING)
+        {
+            return false;
+        }
+        if (!db2IsForeignExpr(root, rel, em_expr, &recheck) || recheck)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * LIMIT and OFFSET are shipped only as constants, OPTIMIZE FOR clause needs a number
+ */
+bool db2IsShippableLimit(Node *node)
+{
+    return node == NULL || IsA(node, Const);
+}
+
+// -------------------------------------------
+// deparsing
+// -------------------------------------------
+
+static void deparseStringLiteral(StringInfo buf, const char *val)
+{
+    const char *p;
+
+    appendStringInfoChar(buf, '\'');
+    for (p = val; *p; p++)
+    {
+        if (*p == '\'')
+        {
+            appendStringInfoChar(buf, '\'');
+        }
+        appendStringInfoChar(buf, *p);
+    }
+    appendStringInfoChar(buf, '\'');
+}
+
+static void deparseValue(StringInfo buf, Datum value, Oid type)
+{
+    char *s = db2ValueText(value, type);
+
+    switch (typeCategory(type))
+    {
+    case DB2_TYPE_NUMBER:
+        // "x--1" would start a comment
+        if (s[0] == '-')
+            appendStringInfo(buf, "(%s)", s);
+        else
+            appendStringInfoString(buf, s);
+        break;
+    case DB2_TYPE_DATE:
+        appendStringInfo(buf, "DATE('%s')", s);
+        break;
+    case DB2_TYPE_TIMESTAMP:
+        appendStringInfo(buf, "TIMESTAMP('%s')", s);
+        break;
+    default:
+        deparseStringLiteral(buf, s);
+        break;
+    }
+}
+
+/*
+ * Quoted DB2 identifier, the name is case sensitive
+ */
+static void deparseIdentifier(StringInfo buf, const char *name)
+{
+    const char *p;
+
+    appendStringInfoChar(buf, '"');
+    for (p = name; *p; p++)
+    {
+        if (*p == '"')
+        {
+            appendStringInfoChar(buf, '"');
+        }
+        appendStringInfoChar(buf, *p);
+    }
+    appendStringInfoChar(buf, '"');
+}
+
+/*
+ * DB2 column name: column_name option or attribute name in upper case
+ */
+static char *columnName(Oid relid, int attno)
+{
+    List *options;
+    ListCell *lc;
+    char *attname;
+
+    options = GetForeignColumnOptions(relid, attno);
+    foreach (lc, options)
+    {
+        DefElem *def = (DefElem *)lfirst(lc);
+        if (strcmp(def->defname, "column_name") == 0)
+        {
+            return defGetString(def);
+        }
+    }
+#if PG_VERSION_NUM >= 110000
+    attname = get_attname(relid, attno, false);
+#else
+    attname = get_attname(relid, attno);
+#endif
+    // DB2 keeps unquoted identifiers in upper case
+    return asc_toupper(attname, strlen(attname));
+}
+
+/*
+ * Reference to column attno of foreign table
+ * Columns of sql_query are named positionally C1 .. Cn in derived table, see db2DeparseSelectSql
+ */
+static void deparseColumnRef(StringInfo buf, db2FdwRelationInfo *fpinfo, int attno)
+{
+    if (fpinfo->table == NULL)
+    {
+        appendStringInfo(buf, "C%d", attno);
+        return;
+    }
+    deparseIdentifier(buf, columnName(fpinfo->relid, attno));
+}
+
+/*
+ * Column of base relation, in join qualified with alias of the relation R<rtindex>
+ * Column of outer relation of parameterized path becomes parameter marker
+ */
+static void deparseVar(Var *node, deparse_expr_cxt *context)
+{
+    RelOptInfo *rel;
+
+    if (!bms_is_member(node->varno, context->foreignrel->relids))
+    {
+        deparseParamMarker((Expr *)node, node->vartype, context);
+        return;
+    }
+    rel = find_base_rel(context->root, node->varno);
+    if (context->foreignrel->reloptkind == RELOPT_JOINREL)
+    {
+        appendStringInfo(context->buf, "R%d.", node->varno);
+    }
+    deparseColumnRef(context->buf, (db2FdwRelationInfo *)rel->fdw_private, node->varattno);
+}
+
+/*
+ * DB2 aggregate returning the same value as PostgreSQL one
+ * COUNT returns INTEGER and SUM keeps the argument type in DB2, so arguments are widened
+ */
+static void deparseAggref(Aggref *node, deparse_expr_cxt *context)
+{
+    StringInfo buf = context->buf;
+    char *fname = get_func_name(node->aggfnoid);
+    Expr *arg;
+    Oid argtype;
+    const char *distinct = node->aggdistinct != NIL ? "DISTINCT " : "";
+
+    if (node->aggstar)
+    {
+        appendStringInfoString(buf, "COUNT_BIG(*)");
+        return;
+    }
+    arg = ((TargetEntry *)linitial(node->args))->expr;
+    argtype = exprType((Node *)arg);
+    if (strcmp(fname, "count") == 0)
+    {
+        appendStringInfo(buf, "COUNT_BIG(%s", distinct);
+        deparseExpr(arg, context);
+    }
+    else if (strcmp(fname, "sum") == 0 && (argtype == INT2OID || argtype == INT4OID))
+    {
+        appendStringInfo(buf, "SUM(%sBIGINT(", distinct);
+        deparseExpr(arg, context);
+        appendStringInfoChar(buf, ')');
+    }
+    else if (strcmp(fname, "sum") == 0 && argtype == INT8OID)
+    {
+        appendStringInfo(buf, "SUM(%sDECIMAL(", distinct);
+        deparseExpr(arg, context);
+        appendStringInfoString(buf, ", 31, 0)");
+    }
+    else
+    {
+        // MIN, MAX, SUM of floating point and decimal, AVG of floating point
+        appendStringInfo(buf, "%s(%s", asc_toupper(fname, strlen(fname)), distinct);
+        deparseExpr(arg, context);
+    }
+    appendStringInfoChar(buf, ')');
+}
+
+/*
+ * Parameter marker, the value of expression is bound when the query is executed
+ */
+static void deparseParamMarker(Expr *node, Oid type, deparse_expr_cxt *context)
+{
+    // untyped parameter marker is not accepted in every context
+    appendStringInfo(context->buf, "CAST(? AS %s)", db2TypeName(type));
+    *context->params_list = lappend(*context->params_list, node);
+}
+
+static void deparseParam(Param *node, deparse_expr_cxt *context)
+{
+    deparseParamMarker((Expr *)node, node->paramtype, context);
+}
+
+static void deparseOpExpr(OpExpr *node, deparse_expr_cxt *context)
+{
+    StringInfo buf = context->buf;
+    char *opname = get_opname(node->opno);
+    bool like;
+
+    appendStringInfoChar(buf, '(');
+    if (list_length(node->args) == 1)
+    {
+        appendStringInfoString(buf, "- ");
+        deparseExpr(linitial(node->args), context);
+        appendStringInfoChar(buf, ')');
+        return;
+    }
+    like = false;
+    deparseExpr(linitial(node->args), context);
+    if (strcmp(opname, "~~") == 0)
+    {
+        appendStringInfoString(buf, " LIKE ");
+        like = true;
+    }
+    else if (strcmp(opname, "!~~") == 0)
+    {
+        appendStringInfoString(buf, " NOT LIKE ");
+        like = true;
+    }
+    else
+    {
+        appendStringInfo(buf, " %s ", opname);
+    }
+    deparseExpr(lsecond(node->args), context);
+    if (like)
+    {
+        appendStringInfoString(buf, " ESCAPE '\\'");
+    }
+    appendStringInfoChar(buf, ')');
+}
+
+static void deparseScalarArrayOpExpr(ScalarArrayOpExpr *node, deparse_expr_cxt *context)
+{
+    StringInfo buf = context->buf;
+    Node *arr = lsecond(node->args);
+    db2FdwRelationInfo *fpinfo = (db2FdwRelationInfo *)context->foreignrel->fdw_private;
+
+    appendStringInfoChar(buf, '(');
+    deparseExpr(linitial(node->args), context);
+    appendStringInfoString(buf, node->useOr ? " IN (" : " NOT IN (");
+    if (fpinfo->batch_cond != NULL && fpinfo->batch_cond->clause == (Expr *)node)
+    {
+        Oid elemtype = get_element_type(exprType(arr));
+        int i;
+
+        // the array is one parameter, its elements are bound by batches
+        for (i = 0; i < fpinfo->lookup_batch_size; i++)
+        {
+            if (i > 0)
+                appendStringInfoString(buf, ", ");
+            appendStringInfo(buf, "CAST(? AS %s)", db2TypeName(elemtype));
+        }
+        *context->params_list = lappend(*context->params_list, arr);
+    }
+    else if (IsA(arr, Const))
+    {
+        ArrayType *array = DatumGetArrayTypeP(((Const *)arr)->constvalue);
+        Oid elemtype = ARR_ELEMTYPE(array);
+        int16 typlen;
+        bool typbyval;
+        char typalign;
+        Datum *elems;
+        bool *nulls;
+        int n, i;
+
+        get_typlenbyvalalign(elemtype, &typlen, &typbyval, &typalign);
+        deconstruct_array(array, elemtype, typlen, typbyval, typalign, &elems, &nulls, &n);
+        for (i = 0; i < n; i++)
+        {
+            if (i > 0)
+                appendStringInfoString(buf, ", ");
+            deparseValue(buf, elems[i], elemtype);
+        }
+    }
+    else
+    {
+        ListCell *lc;
+        bool first = true;
+
+        foreach (lc, ((ArrayExpr *)arr)->elements)
+        {
+            if (!first)
+                appendStringInfoString(buf, ", ");
+            first = false;
+            deparseExpr((Expr *)lfirst(lc), context);
+        }
+    }
+    appendStringInfoString(buf, "))");
+}
+
+static void deparseBoolExpr(BoolExpr *node, deparse_expr_cxt *context)
+{
+    StringInfo buf = context->buf;
+    const char *op = NULL;
+    ListCell *lc;
+    bool first = true;
+
+    switch (node->boolop)
+    {
+    case AND_EXPR:
+        op = "AND";
+        break;
+    case OR_EXPR:
+        op = "OR";
+        break;
+    case NOT_EXPR:
+        appendStringInfoString(buf, "(NOT ");
+        deparseExpr(linitial(node->args), context);
+        appendStringInfoChar(buf, ')');
+        return;
+    }
+    appendStringInfoChar(buf, '(');
+    foreach (lc, node->args)
+    {
+        if (!first)
+            appendStringInfo(buf, " %s ", op);
+        first = false;
+        deparseExpr((Expr *)lfirst(lc), context);
+    }
+    appendStringInfoChar(buf, ')');
+}
+
+static void deparseFuncExpr(FuncExpr *node, deparse_expr_cxt *context)
+{
+    StringInfo buf = context->buf;
+    char *fname;
+
+    if (node->funcformat == COERCE_IMPLICIT_CAST)
+    {
+        deparseExpr(linitial(node->args), context);
+        return;
+    }
+    // ABS, UPPER and LOWER have the same names in DB2
+    fname = get_func_name(node->funcid);
+    appendStringInfo(buf, "%s(", asc_toupper(fname, strlen(fname)));
+    deparseExpr(linitial(node->args), context);
+    appendStringInfoChar(buf, ')');
+}
+
+static void deparseExpr(Expr *node, deparse_expr_cxt *context)
+{
+    StringInfo buf = context->buf;
+
+    switch (nodeTag(node))
+    {
+    case T_Var:
+        deparseVar((Var *)node, context);
+        break;
+    case T_Const:
+        deparseValue(buf, ((Const *)node)->constvalue, ((Const *)node)->consttype);
+        break;
+    case T_Param:
+        deparseParam((Param *)node, context);
+        break;
+    case T_RelabelType:
+        deparseExpr(((RelabelType *)node)->arg, context);
+        break;
+    case T_OpExpr:
+        deparseOpExpr((OpExpr *)node, context);
+        break;
+    case T_ScalarArrayOpExpr:
+        deparseScalarArrayOpExpr((ScalarArrayOpExpr *)node, context);
+        break;
+    case T_NullTest:
+    {
+        NullTest *nt = (NullTest *)node;
+        appendStringInfoChar(buf, '(');
+        deparseExpr(nt->arg, context);
+        appendStringInfoString(buf, nt->nulltesttype == IS_NULL ? " IS NULL)" : " IS NOT NULL)");
+        break;
+    }
+    case T_BoolExpr:
+        deparseBoolExpr((BoolExpr *)node, context);
+        break;
+    case T_FuncExpr:
+        deparseFuncExpr((FuncExpr *)node, context);
+        break;
+    case T_Aggref:
+        deparseAggref((Aggref *)node, context);
+        break;
+    default:
+        elog(ERROR, "unsupported expression type for deparse: %d", (int)nodeTag(node));
+        break;
+    }
+}
+
+/*
+ * Append list of conditions (RestrictInfo or bare expressions) joined with AND
+ */
+static void appendConditions(List *exprs, deparse_expr_cxt *context)
+{
+    ListCell *lc;
+    bool first = true;
+
+    foreach (lc, exprs)
+    {
+        Expr *expr = (Expr *)lfirst(lc);
+
+        if (IsA(expr, RestrictInfo))
+        {
+            expr = ((RestrictInfo *)expr)->clause;
+        }
+        if (!first)
+        {
+            appendStringInfoString(context->buf, " AND ");
+        }
+        first = false;
+        deparseExpr(expr, context);
+    }
+}
+
+static void appendOrderByClause(List *pathkeys, deparse_expr_cxt *context)
+{
+    StringInfo buf = context->buf;
+    ListCell *lc;
+    bool first = true;
+
+    appendStringInfoString(buf, " ORDER BY ");
+    foreach (lc, pathkeys)
+    {
+        PathKey *pathkey = (PathKey *)lfirst(lc);
+
+        if (!first)
+        {
+            appendStringInfoString(buf, ", ");
+        }
+        first = false;
+        deparseExpr(db2FindEmExprForRel(pathkey->pk_eclass, context->foreignrel), context);
+        appendStringInfoString(buf, pathkey->pk_strategy == BTLessStrategyNumber ? " ASC" : " DESC");
+    }
+}
+
+static void appendLimitClause(deparse_expr_cxt *context)
+{
+    Query *parse = context->root->parse;
+    StringInfo buf = context->buf;
+    int64 offset = 0;
+
+    if (parse->limitOffset != NULL && !((Const *)parse->limitOffset)->constisnull)
+    {
+        offset = DatumGetInt64(((Const *)parse->limitOffset)->constvalue);
+        appendStringInfo(buf, " OFFSET " INT64_FORMAT " ROWS", offset);
+    }
+    if (parse->limitCount != NULL && !((Const *)parse->limitCount)->constisnull)
+    {
+        int64 count = DatumGetInt64(((Const *)parse->limitCount)->constvalue);
+
+        appendStringInfo(buf, " FETCH FIRST " INT64_FORMAT " ROWS ONLY", count);
+        appendStringInfo(buf, " OPTIMIZE FOR " INT64_FORMAT " ROWS", count + offset);
+    }
+}
+
+/*
+ * User query without trailing semicolon, it is embedded as derived table
+ */
+static void appendUserQuery(StringInfo buf, const char *query)
+{
+    int len = strlen(query);
+
+    while (len > 0 && (query[len - 1] == ';' || isspace((unsigned char)query[len - 1])))
+    {
+        len--;
+    }
+    appendBinaryStringInfo(buf, query, len);
+}
+
+/*
+ * Table reference: schema.table or sql_query as derived table with positional column names
+ * Inside join the relation is named R<rtindex>, otherwise rtindex is 0
+ */
+static void deparseFromTable(StringInfo buf, db2FdwRelationInfo *fpinfo, Index rtindex)
+{
+    int i;
+
+    if (fpinfo->table != NULL)
+    {
+        if (fpinfo->schema != NULL)
+        {
+            deparseIdentifier(buf, fpinfo->schema);
+            appendStringInfoChar(buf, '.');
+        }
+        deparseIdentifier(buf, fpinfo->table);
+        if (rtindex > 0)
+        {
+            appendStringInfo(buf, " R%d", rtindex);
+        }
+        return;
+    }
+    appendStringInfoChar(buf, '(');
+    appendUserQuery(buf, fpinfo->query);
+    if (rtindex > 0)
+    {
+        appendStringInfo(buf, ") AS R%d (", rtindex);
+    }
+    else
+    {
+        appendStringInfoString(buf, ") AS T (");
+    }
+    for (i = 1; i <= fpinfo->natts; i++)
+    {
+        appendStringInfo(buf, "%sC%d", i > 1 ? ", " : "", i);
+    }
+    appendStringInfoChar(buf, ')');
+}
+
+/*
+ * SELECT list containing only the columns referenced by the query
+ * retrieved_attrs receives attribute numbers of the result columns
+ * Returns true if all columns are retrieved
+ */
+static bool deparseTargetList(StringInfo buf, PlannerInfo *root, RelOptInfo *baserel, List **retrieved_attrs)
+{
+    db2FdwRelationInfo *fpinfo = (db2FdwRelationInfo *)baserel->fdw_private;
+    Relation rel;
+    TupleDesc tupdesc;
+    bool have_wholerow;
+    bool all = true;
+    bool first = true;
+    int i;
+
+    *retrieved_attrs = NIL;
+    have_wholerow = bms_is_member(0 - FirstLowInvalidHeapAttributeNumber, fpinfo->attrs_used);
+#if PG_VERSION_NUM >= 120000
+    rel = table_open(fpinfo->relid, NoLock);
+#else
+    rel = heap_open(fpinfo->relid, NoLock);
+#endif
+    tupdesc = RelationGetDescr(rel);
+    for (i = 1; i <= tupdesc->natts; i++)
+    {
+        Form_pg_attribute attr = TupleDescAttr(tupdesc, i - 1);
+
+        if (attr->attisdropped)
+        {
+            continue;
+        }
+        if (!have_wholerow && !bms_is_member(i - FirstLowInvalidHeapAttributeNumber, fpinfo->attrs_used))
+        {
+            all = false;
+            continue;
+        }
+        if (!first)
+        {
+            appendStringInfoString(buf, ", ");
+        }
+        first = false;
+        deparseColumnRef(buf, fpinfo, i);
+        *retrieved_attrs = lappend_int(*retrieved_attrs, i);
+    }
+#if PG_VERSION_NUM >= 120000
+    table_close(rel, NoLock);
+#else
+    heap_close(rel, NoLock);
+#endif
+    // no column is needed, count(*) for instance
+    if (first)
+    {
+        appendStringInfoString(buf, "1");
+    }
+    return all;
+}
+
+/*
+ * Joined tables, nested joins are enclosed in parentheses
+ */
+static void deparseFromRel(RelOptInfo *rel, deparse_expr_cxt *context)
+{
+    db2FdwRelationInfo *fpinfo = (db2FdwRelationInfo *)rel->fdw_private;
+    StringInfo buf = context->buf;
+    const char *jointype;
+
+    if (rel->reloptkind != RELOPT_JOINREL)
+    {
+        deparseFromTable(buf, fpinfo, rel->relid);
+        return;
+    }
+    switch (fpinfo->jointype)
+    {
+    case JOIN_INNER:
+        jointype = "INNER";
+        break;
+    case JOIN_LEFT:
+        jointype = "LEFT OUTER";
+        break;
+    case JOIN_RIGHT:
+        jointype = "RIGHT OUTER";
+        break;
+    default:
+        elog(ERROR, "unsupported join type %d", (int)fpinfo->jointype);
+        break;
+    }
+    appendStringInfoChar(buf, '(');
+    deparseFromRel(fpinfo->outerrel, context);
+    appendStringInfo(buf, " %s JOIN ", jointype);
+    deparseFromRel(fpinfo->innerrel, context);
+    // DB2 requires ON clause, there is no boolean literal
+    appendStringInfoString(buf, " ON (");
+    if (fpinfo->joinclauses != NIL)
+    {
+        appendConditions(fpinfo->joinclauses, context);
+    }
+    else
+    {
+        appendStringInfoString(buf, "1 = 1");
+    }
+    appendStringInfoString(buf, "))");
+}
+
+/*
+ * SELECT over joined relations, result columns correspond to tlist entries
+ */
+static void deparseJoinSelect(StringInfo buf, PlannerInfo *root, RelOptInfo *rel, List *tlist,
+                              List **retrieved_attrs, List **params_list)
+{
+    db2FdwRelationInfo *fpinfo = (db2FdwRelationInfo *)rel->fdw_private;
+    deparse_expr_cxt context;
+    ListCell *lc;
+    int i = 0;
+
+    context.root = root;
+    context.foreignrel = rel;
+    context.buf = buf;
+    context.params_list = params_list;
+
+    *retrieved_attrs = NIL;
+    appendStringInfoString(buf, "SELECT ");
+    foreach (lc, tlist)
+    {
+        TargetEntry *tle = lfirst_node(TargetEntry, lc);
+
+        if (i > 0)
+        {
+            appendStringInfoString(buf, ", ");
+        }
+        deparseExpr(tle->expr, &context);
+        *retrieved_attrs = lappend_int(*retrieved_attrs, ++i);
+    }
+    if (i == 0)
+    {
+        appendStringInfoString(buf, "1");
+    }
+    appendStringInfoString(buf, " FROM ");
+    deparseFromRel(rel, &context);
+    if (fpinfo->remote_conds != NIL)
+    {
+        appendStringInfoString(buf, " WHERE ");
+        appendConditions(fpinfo->remote_conds, &context);
+    }
+}
+
+/*
+ * SELECT ... GROUP BY ... HAVING for grouped relation
+ * Result columns correspond to tlist entries
+ */
+static void deparseGroupedSelect(StringInfo buf, PlannerInfo *root, RelOptInfo *rel, List *tlist,
+                                 List **retrieved_attrs, List **params_list)
+{
+    db2FdwRelationInfo *fpinfo = (db2FdwRelationInfo *)rel->fdw_private;
+    RelOptInfo *scanrel = fpinfo->outerrel;
+    db2FdwRelationInfo *ofpinfo = (db2FdwRelationInfo *)scanrel->fdw_private;
+    Query *query = root->parse;
+    deparse_expr_cxt context;
+    ListCell *lc;
+    int i = 0;
+
+    context.root = root;
+    context.foreignrel = scanrel;
+    context.buf = buf;
+    context.params_list = params_list;
+
+    *retrieved_attrs = NIL;
+    appendStringInfoString(buf, "SELECT ");
+    foreach (lc, tlist)
+    {
+        TargetEntry *tle = lfirst_node(TargetEntry, lc);
+
+        if (i > 0)
+        {
+            appendStringInfoString(buf, ", ");
+        }
+        deparseExpr(tle->expr, &context);
+        *retrieved_attrs = lappend_int(*retrieved_attrs, ++i);
+    }
+    appendStringInfoString(buf, " FROM ");
+    deparseFromTable(buf, ofpinfo, 0);
+    if (ofpinfo->remote_conds != NIL)
+    {
+        appendStringInfoString(buf, " WHERE ");
+        appendConditions(ofpinfo->remote_conds, &context);
+    }
+    // DB2 does not accept positions in GROUP BY, grouping expressions are repeated
+    if (query->groupClause != NIL)
+    {
+        bool first = true;
+
+        appendStringInfoString(buf, " GROUP BY ");
+        foreach (lc, query->groupClause)
+        {
+            SortGroupClause *grp = (SortGroupClause *)lfirst(lc);
+            TargetEntry *tle = get_sortgroupref_tle(grp->tleSortGroupRef, tlist);
+
+            if (!first)
+            {
+                appendStringInfoString(buf, ", ");
+            }
+            first = false;
+            deparseExpr(tle->expr, &context);
+        }
+    }
+    if (fpinfo->remote_conds != NIL)
+    {
+        appendStringInfoString(buf, " HAVING ");
+        appendConditions(fpinfo->remote_conds, &context);
+    }
+}
+
+/*
+ * Condition selecting the table in SYSCAT.TABLES T
+ */
+static void appendCatalogCondition(StringInfo buf, db2FdwRelationInfo *fpinfo)
+{
+    appendStringInfoString(buf, " WHERE T.TABSCHEMA = ");
+    if (fpinfo->schema != NULL)
+    {
+        deparseStringLiteral(buf, fpinfo->schema);
+    }
+    else
+    {
+        appendStringInfoString(buf, "CURRENT SCHEMA");
+    }
+    appendStringInfoString(buf, " AND T.TABNAME = ");
+    deparseStringLiteral(buf, fpinfo->table);
+}
+
+/*
+ * Catalog query for use_remote_estimate: table cardinality and average width of columns
+ * Every row contains CARD, attribute number and AVGCOLLEN of one column, -1 if statistics are missing
+ */
+void db2DeparseEstimateSql(StringInfo buf, RelOptInfo *baserel)
+{
+    db2FdwRelationInfo *fpinfo = (db2FdwRelationInfo *)baserel->fdw_private;
+    Relation rel;
+    TupleDesc tupdesc;
+    int i;
+
+    appendStringInfoString(buf, "SELECT T.CARD, CASE C.COLNAME");
+#if PG_VERSION_NUM >= 120000
+    rel = table_open(fpinfo->relid, NoLock);
+#else
+    rel = heap_open(fpinfo->relid, NoLock);
+#endif
+    tupdesc = RelationGetDescr(rel);
+    for (i = 1; i <= tupdesc->natts; i++)
+    {
+        if (TupleDescAttr(tupdesc, i - 1)->attisdropped)
+        {
+            continue;
+        }
+        appendStringInfoString(buf, " WHEN ");
+        deparseStringLiteral(buf, columnName(fpinfo->relid, i));
+        appendStringInfo(buf, " THEN %d", i);
+    }
+#if PG_VERSION_NUM >= 120000
+    table_close(rel, NoLock);
+#else
+    heap_close(rel, NoLock);
+#endif
+    appendStringInfoString(buf, " ELSE 0 END, C.AVGCOLLEN FROM SYSCAT.TABLES T INNER JOIN SYSCAT.COLUMNS C");
+    appendStringInfoString(buf, " ON (C.TABSCHEMA = T.TABSCHEMA AND C.TABNAME = T.TABNAME)");
+    appendCatalogCondition(buf, fpinfo);
+}
+
+/*
+ * Catalog query for ANALYZE: table cardinality and size in bytes, -1 or negative if statistics are missing
+ */
+void db2DeparseTableStatsSql(StringInfo buf, db2FdwRelationInfo *fpinfo)
+{
+    appendStringInfoString(buf, "SELECT T.CARD, T.NPAGES * S.PAGESIZE FROM SYSCAT.TABLES T INNER JOIN SYSCAT.TABLESPACES S");
+    appendStringInfoString(buf, " ON (S.TBSPACE = T.TBSPACE)");
+    appendCatalogCondition(buf, fpinfo);
+}
+
+/*
+ * Number of rows counted by DB2
+ */
+void db2DeparseCountSql(StringInfo buf, db2FdwRelationInfo *fpinfo)
+{
+    appendStringInfoString(buf, "SELECT COUNT_BIG(*) FROM ");
+    deparseFromTable(buf, fpinfo, 0);
+}
+
+/*
+ * SELECT of all columns for ANALYZE, sample_frac of rows is chosen randomly by DB2
+ * TABLESAMPLE can be applied only to a table, result of sql_query is filtered by RAND()
+ */
+void db2DeparseAnalyzeSql(StringInfo buf, Relation rel, db2FdwRelationInfo *fpinfo, double sample_frac,
+                          List **retrieved_attrs)
+{
+    TupleDesc tupdesc = RelationGetDescr(rel);
+    bool first = true;
+    int i;
+
+    *retrieved_attrs = NIL;
+    if (fpinfo->table == NULL)
+    {
+        // positional mapping of all columns
+        for (i = 1; i <= fpinfo->natts; i++)
+        {
+            *retrieved_attrs = lappend_int(*retrieved_attrs, i);
+        }
+        if (sample_frac >= 1)
+        {
+            appendStringInfoString(buf, fpinfo->query);
+            return;
+        }
+        appendStringInfoString(buf, "SELECT * FROM ");
+        deparseFromTable(buf, fpinfo, 0);
+        appendStringInfo(buf, " WHERE RAND() < %.6f", sample_frac);
+        return;
+    }
+    appendStringInfoString(buf, "SELECT ");
+    for (i = 1; i <= tupdesc->natts; i++)
+    {
+        if (TupleDescAttr(tupdesc, i - 1)->attisdropped)
+        {
+            continue;
+        }
+        if (!first)
+        {
+            appendStringInfoString(buf, ", ");
+        }
+        first = false;
+        deparseColumnRef(buf, fpinfo, i);
+        *retrieved_attrs = lappend_int(*retrieved_attrs, i);
+    }
+    if (first)
+    {
+        appendStringInfoString(buf, "1");
+    }
+    appendStringInfoString(buf, " FROM ");
+    deparseFromTable(buf, fpinfo, 0);
+    if (sample_frac < 1)
+    {
+        appendStringInfo(buf, " TABLESAMPLE BERNOULLI (%.6f)", sample_frac * 100);
+    }
+}
+
+/*
+ * Build SELECT statement sent to DB2
+ * If sql_query is used and there is neither projection nor conditions, sort or limit to push down,
+ * it is sent unchanged
+ * For grouped and join relation tlist is the list of columns to retrieve
+ */
+void db2DeparseSelectSql(StringInfo buf, PlannerInfo *root, RelOptInfo *baserel, List *tlist,
+                         List *remote_conds, List *pathkeys, bool has_limit, int slices,
+                         List **retrieved_attrs, List **params_list)
+{
+    db2FdwRelationInfo *fpinfo = (db2FdwRelationInfo *)baserel->fdw_private;
+    deparse_expr_cxt context;
+    StringInfoData target;
+    int i;
+
+    logdebug(__func__);
+    if (baserel->reloptkind == RELOPT_UPPER_REL)
+    {
+        deparseGroupedSelect(buf, root, baserel, tlist, retrieved_attrs, params_list);
+        return;
+    }
+    if (baserel->reloptkind == RELOPT_JOINREL)
+    {
+        deparseJoinSelect(buf, root, baserel, tlist, retrieved_attrs, params_list);
+        return;
+    }
+    initStringInfo(&target);
+    if (deparseTargetList(&target, root, baserel, retrieved_attrs) && remote_conds == NIL && fpinfo->table == NULL &&
+        pathkeys == NIL && !has_limit && slices == 0)
+    {
+        // positional mapping of all columns, the same as in derived table
+        *retrieved_attrs = NIL;
+        for (i = 1; i <= fpinfo->natts; i++)
+        {
+            *retrieved_attrs = lappend_int(*retrieved_attrs, i);
+        }
+        appendStringInfoString(buf, fpinfo->query);
+        return;
+    }
+    appendStringInfo(buf, "SELECT %s FROM ", target.data);
+    deparseFromTable(buf, fpinfo, 0);
+
+    context.root = root;
+    context.foreignrel = baserel;
+    context.buf = buf;
+    context.params_list = params_list;
+    if (remote_conds != NIL || slices > 0)
+    {
+        appendStringInfoString(buf, " WHERE ");
+        appendConditions(remote_conds, &context);
+    }
+    if (slices > 0)
+    {
+        // slice of parallel scan, the marker is the last one and gets the slice number
+        // negative values and NULL go to the existing slices
+        if (remote_conds != NIL)
+        {
+            appendStringInfoString(buf, " AND ");
+        }
+        appendStringInfoString(buf, "COALESCE(ABS(MOD(");
+        deparseColumnRef(buf, fpinfo, fpinfo->partition_attno);
+        appendStringInfo(buf, ", %d)), 0) = CAST(? AS INTEGER)", slices);
+    }
+    if (pathkeys != NIL)
+    {
+        appendOrderByClause(pathkeys, &context);
+    }
+    if (has_limit)
+    {
+        appendLimitClause(&context);
+    }
+}
+
+/*
+ * INSERT of all columns of the foreign table, one untyped parameter marker per column
+ * DB2 takes the type of the marker from the target column
+ */
+void db2DeparseInsertSql(StringInfo buf, Relation rel, db2FdwRelationInfo *fpinfo, List **target_attrs)
+{
+    TupleDesc tupdesc = RelationGetDescr(rel);
+    int i;
+
+    *target_attrs = NIL;
+    appendStringInfoString(buf, "INSERT INTO ");
+    deparseFromTable(buf, fpinfo, 0);
+    appendStringInfoString(buf, " (");
+    for (i = 1; i <= tupdesc->natts; i++)
+    {
+        if (TupleDescAttr(tupdesc, i - 1)->attisdropped)
+        {
+            continue;
+        }
+        if (*target_attrs != NIL)
+        {
+            appendStringInfoString(buf, ", ");
+        }
+        deparseColumnRef(buf, fpinfo, i);
+        *target_attrs = lappend_int(*target_attrs, i);
+    }
+    appendStringInfoString(buf, ") VALUES (");
+    for (i = 0; i < list_length(*target_attrs); i++)
+    {
+        appendStringInfoString(buf, i > 0 ? ", ?" : "?");
+    }
+    appendStringInfoChar(buf, ')');
+}
+
+/*
+ * UPDATE of the whole set of rows matching remote_conds, exprs are assigned to target_attrs
+ */
+void db2DeparseUpdateSql(StringInfo buf, PlannerInfo *root, RelOptInfo *baserel, List *target_attrs, List *exprs,
+                         List *remote_conds, List **params_list)
+{
+    db2FdwRelationInfo *fpinfo = (db2FdwRelationInfo *)baserel->fdw_private;
+    deparse_expr_cxt context;
+    ListCell *lc, *lc2;
+
+    context.root = root;
+    context.foreignrel = baserel;
+    context.buf = buf;
+    context.params_list = params_list;
+    appendStringInfoString(buf, "UPDATE ");
+    deparseFromTable(buf, fpinfo, 0);
+    appendStringInfoString(buf, " SET ");
+    forboth (lc, target_attrs, lc2, exprs)
+    {
+        Expr *expr = (Expr *)lfirst(lc2);
+
+        if (lc != list_head(target_attrs))
+        {
+            appendStringInfoString(buf, ", ");
+        }
+        deparseColumnRef(buf, fpinfo, lfirst_int(lc));
+        appendStringInfoString(buf, " = ");
+        // NULL is not shippable as a value, but it can be assigned
+        if (IsA(expr, Const) && ((Const *)expr)->constisnull)
+        {
+            appendStringInfoString(buf, "NULL");
+            continue;
+        }
+        deparseExpr(expr, &context);
+    }
+    if (remote_conds != NIL)
+    {
+        appendStringInfoString(buf, " WHERE ");
+        appendConditions(remote_conds, &context);
+    }
+}
+
+/*
+ * DELETE of the rows matching remote_conds
+ */
+void db2DeparseDeleteSql(StringInfo buf, PlannerInfo *root, RelOptInfo *baserel, List *remote_conds,
+                         List **params_list)
+{
+    db2FdwRelationInfo *fpinfo = (db2FdwRelationInfo *)baserel->fdw_private;
+    deparse_expr_cxt context;
+
+    context.root = root;
+    context.foreignrel = baserel;
+    context.buf = buf;
+    context.params_list = params_list;
+    appendStringInfoString(buf, "DELETE FROM ");
+    deparseFromTable(buf, fpinfo, 0);
+    if (remote_conds != NIL)
+    {
+        appendStringInfoString(buf, " WHERE ");
+        appendConditions(remote_conds, &context);
+    }
+}
@@ -0,0 +1,65 @@
+--
+-- db2odbc_fdw
+-- EXPLAIN without ANALYZE does not connect to DB2, the tests check remote SQL only
+--
+CREATE EXTENSION db2odbc_fdw;
+CREATE SERVER db2 FOREIGN DATA WRAPPER db2odbc_fdw OPTIONS (dsn 'SAMPLE');
+CREATE USER MAPPING FOR PUBLIC SERVER db2 OPTIONS (username 'db2inst1', password 'db2inst1');
+CREATE FOREIGN TABLE ft1 (id integer, name text, amount float8, created date)
+  SERVER db2 OPTIONS (schema 'TEST', table 'FT1');
+CREATE FOREIGN TABLE ft2 (id integer, ft1_id integer OPTIONS (column_name 'PARENT'), price numeric)
+  SERVER db2 OPTIONS (schema 'TEST', table 'FT2');
+CREATE FOREIGN TABLE fq (a integer, b text)
+  SERVER db2 OPTIONS (sql_query 'SELECT A, B FROM TEST.FT3');
+CREATE FOREIGN TABLE fpart (id integer, val text)
+  SERVER db2 OPTIONS (schema 'TEST', table 'FT1', partition_column 'id', partitions '4');
+-- conditions and referenced columns
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id, name FROM ft1 WHERE id > 10 AND amount < 5.5;
+EXPLAIN (VERBOSE, COSTS OFF) SELECT 1 FROM ft1 WHERE id > -5;
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id FROM ft1 WHERE created IS NULL OR id IN (1, 2);
+-- string equality is checked again locally, DB2 ignores trailing blanks
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id FROM ft1 WHERE name = 'abc';
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id FROM ft1 WHERE name LIKE 'a%' AND upper(name) = 'ABC' AND name <> 'x';
+-- sql_query is sent unchanged or used as derived table
+EXPLAIN (VERBOSE, COSTS OFF) SELECT * FROM fq;
+EXPLAIN (VERBOSE, COSTS OFF) SELECT b FROM fq WHERE a = 1;
+-- aggregates
+EXPLAIN (VERBOSE, COSTS OFF) SELECT count(*), sum(id), avg(amount) FROM ft1 WHERE created >= DATE '2020-01-01';
+EXPLAIN (VERBOSE, COSTS OFF) SELECT created, count(*) FROM ft1 GROUP BY created HAVING count(*) > 1;
+-- AVG of numeric is computed locally, DB2 result has different scale
+EXPLAIN (VERBOSE, COSTS OFF) SELECT sum(id), max(ft1_id), avg(price) FROM ft2;
+-- ORDER BY and LIMIT
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id, amount FROM ft1 ORDER BY id;
+-- strings are sorted locally, DB2 collating sequence differs
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id, name FROM ft1 ORDER BY name;
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id, amount FROM ft1 WHERE amount > 0 ORDER BY id DESC LIMIT 10 OFFSET 5;
+-- LIMIT cannot be applied before local filter
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id FROM ft1 WHERE name = 'x' LIMIT 3;
+-- joins
+EXPLAIN (VERBOSE, COSTS OFF) SELECT t1.name, t2.price FROM ft1 t1 JOIN ft2 t2 ON t1.id = t2.ft1_id WHERE t1.amount > 0;
+EXPLAIN (VERBOSE, COSTS OFF) SELECT t1.id, t2.price FROM ft1 t1 LEFT JOIN ft2 t2 ON t1.id = t2.ft1_id AND t2.price > 100;
+-- lookup by IN list longer than lookup_batch_size or by array parameter is executed by batches
+ALTER FOREIGN TABLE ft1 OPTIONS (ADD lookup_batch_size '4');
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id, name FROM ft1 WHERE id IN (1, 2, 3);
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id, name FROM ft1 WHERE id IN (1, 2, 3, 4, 5, 6);
+SET plan_cache_mode = force_generic_plan;
+PREPARE lookup(integer[]) AS SELECT id, name FROM ft1 WHERE id = ANY ($1);
+EXPLAIN (VERBOSE, COSTS OFF) EXECUTE lookup('{1, 2}');
+DEALLOCATE lookup;
+RESET plan_cache_mode;
+ALTER FOREIGN TABLE ft1 OPTIONS (DROP lookup_batch_size);
+-- parallel scan reads slices of partition_column
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id, val FROM fpart WHERE id > 0;
+RESET parallel_setup_cost;
+RESET parallel_tuple_cost;
+-- INSERT, UPDATE and DELETE
+EXPLAIN (VERBOSE, COSTS OFF) INSERT INTO ft1 VALUES (1, 'one', 1.5, NULL);
+EXPLAIN (VERBOSE, COSTS OFF) UPDATE ft1 SET amount = amount * 2 WHERE id = 1;
+EXPLAIN (VERBOSE, COSTS OFF) DELETE FROM ft1 WHERE created < DATE '2000-01-01';
+-- rows cannot be deleted one by one, the condition has to be evaluated by DB2 alone
+EXPLAIN (VERBOSE, COSTS OFF) DELETE FROM ft1 WHERE name = 'x';
+-- cleanup
+SET client_min_messages = warning;
+DROP EXTENSION db2odbc_fdw CASCADE;